@@ -0,0 +1,390 @@
+#include <math.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Microbenchmarks of the engine
+ * Every benchmark runs reps times, each time on a fresh simulator, and only
+ * the loop over the operations is timed. The pages are visited
+ *    sequential  in address order, every page has a frame
+ *    random      in a random order, every page has a frame
+ *    full        in a random order with a frame for 1 in 8 pages, so that
+ *                faults evict and the exec log is always full
+ * Results go to stdout as CSV or JSON, a summary to stderr.
+ */
+
+enum BenchPattern { PATTERN_SEQUENTIAL, PATTERN_RANDOM, PATTERN_FULL };
+
+static const char *pattern_names[] = {"sequential", "random", "full"};
+
+#define DEFAULT_BENCH_PAGES 4096
+#define DEFAULT_BENCH_OPS (1 << 20)
+#define DEFAULT_BENCH_REPS 5
+#define FULL_PATTERN_RATIO 8
+#define FULL_EXEC_LOG_BYTES (64 * 1024)
+#define ROLLBACK_EXEC_LOG_BYTES (256 * 1024 * 1024)
+
+struct BenchConfig {
+    size_t page_count;
+    size_t op_count;
+    size_t reps;
+    bool json;
+    const char *filter; // run only benchmarks whose name contains it
+};
+
+struct Bench {
+    enum BenchPattern pattern;
+    struct Proc *proc;
+    size_t *pages; // page of every operation, pages are 1 based
+    size_t op_count;
+    size_t page_count;
+    struct ExecLogEntry *entries;
+    unsigned char *buf; // one page, for the range benchmarks
+    unsigned sink; // keeps reads from being optimized out
+};
+
+struct BenchCase {
+    const char *name;
+    bool exec_log;
+    void (*setup)(struct Bench *bench);
+    size_t (*run)(struct Bench *bench); // returns the operations done
+};
+
+struct BenchResult {
+    const char *name;
+    enum BenchPattern pattern;
+    size_t ops;
+    double mean_ns;
+    double stddev_ns;
+    double min_ns;
+    double max_ns;
+};
+
+static inline virt_addr_t page_addr(size_t page) {
+    return (virt_addr_t)page * PAGE_SIZE;
+}
+
+static void write_every_page(struct Bench *bench) {
+    for (size_t i = 0; i < bench->page_count; i++) {
+        set_memory(bench->proc, page_addr(bench->pages[i]), (unsigned char)i);
+    }
+}
+
+static void no_setup(struct Bench *bench) {
+    (void)bench;
+}
+
+static size_t run_access_memory(struct Bench *bench) {
+    unsigned sink = 0;
+    for (size_t i = 0; i < bench->op_count; i++) {
+        sink += access_memory(bench->proc, page_addr(bench->pages[i]) + (i & 63));
+    }
+    bench->sink += sink;
+    return bench->op_count;
+}
+
+static size_t run_set_memory(struct Bench *bench) {
+    for (size_t i = 0; i < bench->op_count; i++) {
+        set_memory(bench->proc, page_addr(bench->pages[i]) + (i & 63), (unsigned char)i);
+    }
+    return bench->op_count;
+}
+
+// One operation moves a whole page
+static size_t run_read_range(struct Bench *bench) {
+    for (size_t i = 0; i < bench->page_count; i++) {
+        read_range(bench->proc, page_addr(bench->pages[i]), bench->buf, PAGE_SIZE);
+        bench->sink += bench->buf[i & 63];
+    }
+    return bench->page_count;
+}
+
+static size_t run_write_range(struct Bench *bench) {
+    for (size_t i = 0; i < bench->page_count; i++) {
+        write_range(bench->proc, page_addr(bench->pages[i]), bench->buf, PAGE_SIZE);
+    }
+    return bench->page_count;
+}
+
+static size_t run_map_frame_at_addr(struct Bench *bench) {
+    struct PageTable *pt = bench->proc->page_table;
+    for (size_t i = 0; i < bench->page_count; i++) {
+        map_frame_at_addr(pt, page_addr(bench->pages[i]));
+    }
+    return bench->page_count;
+}
+
+static size_t run_unmap_page_by_page_idx(struct Bench *bench) {
+    struct PageTable *pt = bench->proc->page_table;
+    for (size_t i = 0; i < bench->page_count; i++) {
+        unmap_page_by_page_idx(pt, bench->pages[i]);
+    }
+    return bench->page_count;
+}
+
+static void prepare_entries(struct Bench *bench) {
+    for (size_t i = 0; i < bench->op_count; i++) {
+        bench->entries[i] = (struct ExecLogEntry){.proc = bench->proc,
+                                                  .action = WRITE,
+                                                  .virt_addr = page_addr(bench->pages[i]),
+                                                  .new_data = (unsigned char)i};
+    }
+}
+
+static size_t run_push_to_exec_log(struct Bench *bench) {
+    struct ExecLog *log = this_cpu->exec_log;
+    for (size_t i = 0; i < bench->op_count; i++) {
+        push_to_exec_log(log, bench->entries[i]);
+    }
+    return bench->op_count;
+}
+
+// Writes that fault, overwrite and evict, all of them logged
+static void write_logged(struct Bench *bench) {
+    for (size_t i = 0; i < bench->op_count; i++) {
+        set_memory(bench->proc, page_addr(bench->pages[i]), (unsigned char)i);
+    }
+}
+
+// Only what still is in the log can be rolled back
+static size_t run_roll_back_opearation(struct Bench *bench) {
+    struct ExecLog *log = this_cpu->exec_log;
+    size_t ops = 0;
+    (void)bench;
+    while (log->count > 0) {
+        roll_back_opearation(log);
+        ops++;
+    }
+    return ops;
+}
+
+static const struct BenchCase bench_cases[] = {
+    {"access_memory", false, write_every_page, run_access_memory},
+    {"set_memory", false, write_every_page, run_set_memory},
+    {"read_range", false, write_every_page, run_read_range},
+    {"write_range", false, write_every_page, run_write_range},
+    {"map_frame_at_addr", false, no_setup, run_map_frame_at_addr},
+    {"unmap_page_by_page_idx", false, write_every_page, run_unmap_page_by_page_idx},
+    {"push_to_exec_log", true, prepare_entries, run_push_to_exec_log},
+    {"roll_back_opearation", true, write_logged, run_roll_back_opearation},
+};
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// The first page_count operations visit every page once, the rest repeat them
+static size_t *create_page_order(enum BenchPattern pattern, size_t page_count,
+                                 size_t op_count) {
+    size_t count = op_count > page_count ? op_count : page_count;
+    size_t *pages = (size_t *)malloc(count * sizeof(size_t));
+    for (size_t i = 0; i < page_count; i++) {
+        pages[i] = i + 1;
+    }
+    if (pattern != PATTERN_SEQUENTIAL) {
+        uint64_t state = 0x9E3779B97F4A7C15ull;
+        for (size_t i = page_count - 1; i > 0; i--) {
+            size_t j = next_random(&state) % (i + 1);
+            size_t tmp = pages[i];
+            pages[i] = pages[j];
+            pages[j] = tmp;
+        }
+    }
+    for (size_t i = page_count; i < count; i++) {
+        pages[i] = pages[i % page_count];
+    }
+    return pages;
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static struct SimulatorConfig simulator_config(const struct BenchCase *bench_case,
+                                               enum BenchPattern pattern,
+                                               struct BenchConfig *config) {
+    struct SimulatorConfig simulator = {.frame_count = config->page_count + 1,
+                                        .page_shift = DEFAULT_PAGE_SHIFT,
+                                        .cpu_count = 1,
+                                        .policy = DEFAULT_REPLACEMENT_POLICY,
+                                        .tlb = DEFAULT_TLB_CONFIG,
+                                        .keep_exec_log = bench_case->exec_log,
+                                        .exec_log = DEFAULT_EXEC_LOG_CONFIG};
+    if (pattern == PATTERN_FULL) {
+        simulator.frame_count = config->page_count / FULL_PATTERN_RATIO + 1;
+    }
+    // half of the log is for entries, it holds every operation unless full
+    if (pattern == PATTERN_FULL && bench_case->run == run_push_to_exec_log) {
+        simulator.exec_log.max_bytes = FULL_EXEC_LOG_BYTES;
+    } else if (bench_case->run == run_push_to_exec_log) {
+        simulator.exec_log.max_bytes = 2 * config->op_count * sizeof(struct ExecLogEntry);
+    } else if (bench_case->exec_log) {
+        simulator.exec_log.max_bytes = ROLLBACK_EXEC_LOG_BYTES;
+    }
+    return simulator;
+}
+
+static struct BenchResult run_bench(const struct BenchCase *bench_case,
+                                    enum BenchPattern pattern,
+                                    struct BenchConfig *config) {
+    struct BenchResult result = {.name = bench_case->name, .pattern = pattern};
+    struct Bench bench = {.pattern = pattern,
+                          .op_count = config->op_count,
+                          .page_count = config->page_count};
+    bench.pages = create_page_order(pattern, config->page_count, config->op_count);
+    bench.entries =
+        (struct ExecLogEntry *)malloc(config->op_count * sizeof(struct ExecLogEntry));
+    bench.buf = (unsigned char *)calloc(1, (size_t)1 << DEFAULT_PAGE_SHIFT);
+
+    double *samples = (double *)malloc(config->reps * sizeof(double));
+    for (size_t rep = 0; rep < config->reps; rep++) {
+        struct Simulator *simulator =
+            create_simulator(simulator_config(bench_case, pattern, config));
+        bench.proc = create_proc("bench");
+        bench_case->setup(&bench);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t ops = bench_case->run(&bench);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        samples[rep] = ops ? elapsed_ns(&start, &end) / ops : 0;
+        result.ops = ops;
+        destroy_proc(bench.proc);
+        destroy_simulator(simulator);
+    }
+
+    result.min_ns = samples[0];
+    result.max_ns = samples[0];
+    for (size_t rep = 0; rep < config->reps; rep++) {
+        result.mean_ns += samples[rep] / config->reps;
+        result.min_ns = fmin(result.min_ns, samples[rep]);
+        result.max_ns = fmax(result.max_ns, samples[rep]);
+    }
+    for (size_t rep = 0; rep < config->reps && config->reps > 1; rep++) {
+        double diff = samples[rep] - result.mean_ns;
+        result.stddev_ns += diff * diff / (config->reps - 1);
+    }
+    result.stddev_ns = sqrt(result.stddev_ns);
+
+    free(samples);
+    free(bench.buf);
+    free(bench.entries);
+    free(bench.pages);
+    return result;
+}
+
+static void print_results(struct BenchResult *results, size_t count,
+                          struct BenchConfig *config) {
+    if (config->json) {
+        printf("[\n");
+    } else {
+        printf("benchmark,pattern,ops,reps,mean_ns,stddev_ns,min_ns,max_ns\n");
+    }
+    for (size_t i = 0; i < count; i++) {
+        struct BenchResult *r = &results[i];
+        if (config->json) {
+            printf("  {\"benchmark\": \"%s\", \"pattern\": \"%s\", \"ops\": %zu, "
+                   "\"reps\": %zu, \"mean_ns\": %.2f, \"stddev_ns\": %.2f, "
+                   "\"min_ns\": %.2f, \"max_ns\": %.2f}%s\n",
+                   r->name, pattern_names[r->pattern], r->ops, config->reps, r->mean_ns,
+                   r->stddev_ns, r->min_ns, r->max_ns, i + 1 < count ? "," : "");
+        } else {
+            printf("%s,%s,%zu,%zu,%.2f,%.2f,%.2f,%.2f\n", r->name,
+                   pattern_names[r->pattern], r->ops, config->reps, r->mean_ns,
+                   r->stddev_ns, r->min_ns, r->max_ns);
+        }
+    }
+    if (config->json) {
+        printf("]\n");
+    }
+    fflush(stdout);
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --pages <n>       pages of the benchmark process (default: %d)\n",
+           DEFAULT_BENCH_PAGES);
+    printf("  --ops <n>         operations of the access benchmarks (default: %d)\n",
+           DEFAULT_BENCH_OPS);
+    printf("  --reps <n>        runs of every benchmark (default: %d)\n",
+           DEFAULT_BENCH_REPS);
+    printf("  --filter <name>   only run benchmarks whose name contains name\n");
+    printf("  --json            print JSON instead of CSV\n");
+}
+
+static bool parse_options(int argc, char **argv, struct BenchConfig *config) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;
+
+        if (strcmp(arg, "--json") == 0) {
+            config->json = true;
+            continue;
+        }
+        if (value == NULL) {
+            LOG_ERROR("Unknown option or missing value: %s", arg);
+            return false;
+        }
+        i++;
+        if (strcmp(arg, "--filter") == 0) {
+            config->filter = value;
+            continue;
+        }
+
+        unsigned long long number = strtoull(value, &end, 0);
+        if (*end != '\0' || number == 0) {
+            LOG_ERROR("Invalid value for %s: %s", arg, value);
+            return false;
+        } else if (strcmp(arg, "--pages") == 0 && number >= FULL_PATTERN_RATIO) {
+            config->page_count = number;
+        } else if (strcmp(arg, "--ops") == 0) {
+            config->op_count = number;
+        } else if (strcmp(arg, "--reps") == 0) {
+            config->reps = number;
+        } else {
+            LOG_ERROR("Invalid option: %s %s", arg, value);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    struct BenchConfig config = {.page_count = DEFAULT_BENCH_PAGES,
+                                 .op_count = DEFAULT_BENCH_OPS,
+                                 .reps = DEFAULT_BENCH_REPS};
+    if (!parse_options(argc, argv, &config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    size_t case_count = sizeof(bench_cases) / sizeof(bench_cases[0]);
+    struct BenchResult *results =
+        (struct BenchResult *)malloc(case_count * 3 * sizeof(struct BenchResult));
+    size_t result_count = 0;
+
+    for (size_t c = 0; c < case_count; c++) {
+        const struct BenchCase *bench_case = &bench_cases[c];
+        if (config.filter && strstr(bench_case->name, config.filter) == NULL) {
+            continue;
+        }
+        for (int p = PATTERN_SEQUENTIAL; p <= PATTERN_FULL; p++) {
+            struct BenchResult result = run_bench(bench_case, p, &config);
+            LOG_INFO("%-24s %-10s %9.1f ns/op (stddev %.1f, min %.1f)", result.name,
+                     pattern_names[p], result.mean_ns, result.stddev_ns, result.min_ns);
+            results[result_count++] = result;
+        }
+    }
+
+    print_results(results, result_count, &config);
+    free(results);
+    return 0;
+}
@@ -4,7 +4,7 @@
  *    Main/Physical memory
  *    Virtual memory
  *    Page table: map of p:f
- *    Frames(f): 4KB block of main memory
+ *    Frames(f): base page sized block of main memory (4KB by default)
  *    Page(p)
  *
  * Assumptions:
@@ -14,27 +14,121 @@
 #define PAGING_H
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
-#define FRAME_SIZE (4 * 1024)
+/*
+ * The base page size is set per simulated machine (--page-size), page_shift is
+ * the one of the machine the calling thread is bound to. FRAME_SIZE and
+ * PAGE_SIZE read it.
+ */
+#define DEFAULT_PAGE_SHIFT 12
+#define MIN_PAGE_SHIFT 12
+#define MAX_PAGE_SHIFT 16
+extern _Thread_local unsigned page_shift;
+
+#define FRAME_SIZE ((size_t)1 << page_shift)
 #define PAGE_SIZE FRAME_SIZE
-static_assert((FRAME_SIZE & (FRAME_SIZE - 1)) == 0,
-              "FRAME_SIZE should be a power of 2\n");
 static_assert(sizeof(uintptr_t) == 8, "[Error] Not 64 bit arch");
 
 /*
  * 0b0000000000000000000000000000000000000000000000000000 000000000000
  *   |           FRAME/PAGE_ADDR_BITS                    |OFFSET_BITS|
  */
-#define OFFSET_BITS __builtin_ctz(FRAME_SIZE)
+#define OFFSET_BITS page_shift
 #define FRAME_ADDR_BITS 64 - OFFSET_BITS
 #define PAGE_ADDR_BITS 64 - OFFSET_BITS
 
 #define DEFAULT_FRAME_COUNT 10
-#define DEFAULT_MEMORY_SIZE (FRAME_SIZE * DEFAULT_FRAME_COUNT)
-#define DEFAULT_PAGE_TABLE_SIZE (DEFAULT_MEMORY_SIZE / FRAME_SIZE)
+#define DEFAULT_VIEW_PAGE_COUNT 10 // page table rows of the UI
+
+/*
+ * x86-64 style 4-level radix page table, 48 bit virtual addresses with 4KB
+ * pages, every level resolves 9 bits so larger pages widen the address space
+ *
+ * 0b0000000000000000 000000000 000000000 000000000 000000000 000000000000
+ *   |   unused      | PML4    | PDPT    | PD      | PT      |OFFSET_BITS|
+ *
+ * Directory levels are allocated on first map and freed once empty, so the
+ * memory used by a table grows with the number of mapped pages.
+ */
+#define PT_LEVELS 4
+#define PT_INDEX_BITS 9
+#define PT_ENTRIES_PER_NODE (1 << PT_INDEX_BITS)
+#define VIRT_ADDR_BITS (OFFSET_BITS + PT_LEVELS * PT_INDEX_BITS)
+#define MAX_PAGE_COUNT ((size_t)1 << (PT_LEVELS * PT_INDEX_BITS))
+
+/*
+ * Huge pages are leaf entries in a directory level, a PD entry maps 512 base
+ * pages (2MB with 4KB pages) and a PDPT entry 512 * 512 (1GB). They are
+ * backed by naturally aligned runs of frames.
+ */
+enum PageClass { PAGE_BASE, PAGE_HUGE, PAGE_GIGANTIC, PAGE_CLASS_COUNT };
+
+// base pages covered by one page of the class
+static inline size_t page_class_pages(enum PageClass class) {
+    return (size_t)1 << (class * PT_INDEX_BITS);
+}
+
+/*
+ * Last level entries hold the frame address, frames are FRAME_SIZE aligned so
+ * the low bits are free for flags. An entry maps a frame only if it has
+ * PTE_PRESENT, so frame 0 can be mapped too. Accessed and dirty are set by
+ * the accesses. Reclaim (Clock, Second-Chance) clears accessed as it scans,
+ * dirty is only dropped when eviction writes the frame back.
+ */
+// Entry of a page whose frame was reclaimed by the page replacement policy
+#define PTE_EVICTED ((uintptr_t)1)
+// Frame is shared copy-on-write, the first write copies it
+#define PTE_COW ((uintptr_t)1 << 1)
+// Page class of a huge page entry, 0 for base pages and directory pointers
+#define PTE_CLASS_SHIFT 2
+#define PTE_CLASS_MASK ((uintptr_t)3 << PTE_CLASS_SHIFT)
+#define PTE_PRESENT ((uintptr_t)1 << 4)
+#define PTE_WRITABLE ((uintptr_t)1 << 5) // cleared while the page is copy-on-write
+#define PTE_DIRTY ((uintptr_t)1 << 6)
+#define PTE_ACCESSED ((uintptr_t)1 << 7)
+#define PTE_USER ((uintptr_t)1 << 8)
+#define PTE_FLAGS_MASK ((uintptr_t)FRAME_SIZE - 1)
+// flags of a newly mapped page
+#define PTE_USER_PAGE (PTE_PRESENT | PTE_WRITABLE | PTE_USER)
+
+/*
+ * Frame 0 is the zero page, it stays zeroed and is mapped read-only at every
+ * page whose first access is a read. The first write breaks it like a
+ * copy-on-write page and maps a zeroed frame of its own.
+ */
+#define ZERO_FRAME 0
+#define PTE_ZERO_PAGE (PTE_PRESENT | PTE_USER | PTE_COW)
+
+static inline enum PageClass pte_page_class(uintptr_t pte) {
+    return (enum PageClass)((pte & PTE_CLASS_MASK) >> PTE_CLASS_SHIFT);
+}
+
+/*
+ * An evicted entry holds the swap slot with the contents of the page where a
+ * present one holds the frame address. Slot 0 is never used, PTE_EVICTED
+ * alone means the contents were dropped.
+ */
+static inline uintptr_t swap_pte(size_t slot) {
+    return ((uintptr_t)slot << OFFSET_BITS) | PTE_EVICTED;
+}
+
+static inline size_t pte_swap_slot(uintptr_t pte) {
+    return pte >> OFFSET_BITS;
+}
+
+static inline bool is_pte_evicted(uintptr_t pte) {
+    return (pte & PTE_EVICTED) != 0;
+}
+
+static inline bool is_zero_page(uintptr_t pte) {
+    return (pte & PTE_PRESENT) && (pte >> OFFSET_BITS) == ZERO_FRAME;
+}
 
 #define LOG_INFO(fmt, ...) fprintf(stderr, "[INFO] " fmt "\n", ##__VA_ARGS__)
 #define LOG_WARN(fmt, ...) fprintf(stderr, "[WARN] " fmt "\n", ##__VA_ARGS__)
@@ -44,73 +138,1164 @@ typedef uintptr_t virt_addr_t;
 
 enum Action { READ, WRITE, UNMAP };
 
+/*
+ * One 4KB table of the radix tree
+ * In directory levels (PML4/PDPT/PD) entries hold pointers to the next level,
+ * in the last level (PT) they hold the physical address of the mapped frame.
+ */
+struct PageTableNode {
+    uintptr_t entries[PT_ENTRIES_PER_NODE];
+    size_t used;
+};
+
+struct PageTableStats {
+    size_t node_count;
+    size_t mapped_pages;
+    size_t walks;
+    size_t walk_levels;
+    size_t cow_faults;
+    size_t cow_copies;
+    size_t zero_faults; // reads of untouched pages, mapped to the zero page
+    size_t huge_pages[PAGE_CLASS_COUNT]; // mapped huge pages per class
+    size_t huge_faults;
+    size_t huge_fallbacks; // faults that wanted a huge page but got a smaller one
+};
+
 struct PageTable {
-    uintptr_t *entries;
-    size_t size;
-    size_t curr;
+    struct PageTableNode *root;
+    size_t size; // number of addressable pages
+    struct PageTableStats stats;
+    struct Proc *owner;
+    uint64_t version; // changes on every update, never reused
+    enum PageClass fault_class; // largest page a fault maps, like THP
+};
+
+/*
+ * Two level set-associative TLB, entries are tagged with the pid of the owning
+ * process (ASID) so a context switch does not need a flush
+ */
+enum TLBPolicy { TLB_LRU, TLB_FIFO, TLB_RANDOM };
+
+struct TLBConfig {
+    size_t l1_entries;
+    size_t l1_ways;
+    size_t l2_entries;
+    size_t l2_ways;
+    enum TLBPolicy policy;
+};
+
+#define DEFAULT_TLB_CONFIG                                                               \
+    ((struct TLBConfig){.l1_entries = 64,                                                \
+                        .l1_ways = 4,                                                    \
+                        .l2_entries = 1536,                                              \
+                        .l2_ways = 12,                                                   \
+                        .policy = TLB_LRU})
+
+struct TLBEntry {
+    bool valid;
+    enum PageClass page_class;
+    size_t asid;
+    size_t page_idx; // in pages of page_class
+    uintptr_t pte; // frame address and PTE flags
+    uint64_t stamp;
+};
+
+struct TLBLevel {
+    struct TLBEntry *entries;
+    size_t sets;
+    size_t ways;
+};
+
+struct TLB {
+    struct TLBLevel l1;
+    struct TLBLevel l2;
+    enum TLBPolicy policy;
+    uint64_t clock;
+    uint64_t rng_state;
+};
+
+struct TLBStats {
+    size_t l1_hits;
+    size_t l2_hits;
+    size_t misses;
+    size_t flushes;
+};
+
+/*
+ * Event counters of a process, cheap enough to always keep. They are only
+ * written by the CPU the process runs on, except for evictions which happen
+ * with the world stopped.
+ */
+struct ProcCounters {
+    size_t reads;
+    size_t writes;
+    size_t minor_faults; // first touch of a page
+    size_t major_faults; // an evicted page brought back
+    size_t maps; // frames mapped, including private copies
+    size_t unmaps;
+    size_t evictions; // pages of the process reclaimed
+    size_t dirty_evictions; // of those, the ones that would need a write back
 };
 
 struct Proc {
     char *name;
     size_t pid;
     struct PageTable *page_table;
+    struct TLBStats tlb_stats;
+    struct ProcCounters counters;
+    struct CPU *cpu; // the process only runs on this CPU
+};
+
+struct Operation {
+    enum Action action;
+    struct Proc *proc;
+    unsigned char data;
+    virt_addr_t virt_addr;
+};
+
+struct TestCase {
+    struct Operation *ops;
+    size_t operation_count;
+    size_t curr_operation_idx;
+};
+
+/*
+ * Synthetic workloads are generated one operation at a time so that runs of
+ * any length need no memory for the operations themselves.
+ * The first access of a process to a page is always a write, so reads never
+ * hit a page that was never mapped.
+ */
+enum WorkloadKind { WORKLOAD_SEQUENTIAL, WORKLOAD_RANDOM, WORKLOAD_HOTSET };
+
+struct WorkloadConfig {
+    enum WorkloadKind kind;
+    size_t op_count;
+    size_t page_count;
+    size_t proc_count;
+    unsigned int write_percent;
+    uint64_t seed;
+};
+
+#define DEFAULT_WORKLOAD_CONFIG                                                          \
+    ((struct WorkloadConfig){.kind = WORKLOAD_RANDOM,                                    \
+                             .op_count = 10 * 1000 * 1000,                               \
+                             .page_count = 64,                                           \
+                             .proc_count = 2,                                            \
+                             .write_percent = 30,                                        \
+                             .seed = 1})
+
+struct Workload {
+    struct WorkloadConfig config;
+    struct Proc **procs;
+    size_t issued;
+    uint64_t rng_state;
+    virt_addr_t cursor;
+    uint64_t *touched; // bitmap of (proc, page) pairs written at least once
+};
+
+/*
+ * Binary trace file
+ *    header | pid[proc_count] | records
+ *
+ * Each record is
+ *    tag:   1 byte, bits 0-1 action, bits 2-7 proc index (63: varint follows)
+ *    delta: zigzag varint of the address delta to the previous address of the
+ *           same process
+ *    data:  1 byte, WRITE only
+ *
+ * All integers are little endian, the checksum is FNV-1a over the records.
+ */
+#define TRACE_MAGIC "VMTR"
+#define TRACE_VERSION 1
+#define TRACE_PROC_ESCAPE 63
+
+struct TraceHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t proc_count;
+    uint64_t op_count;
+    uint64_t body_size;
+    uint64_t checksum;
+};
+static_assert(sizeof(struct TraceHeader) == 40, "Trace header layout changed");
+
+struct TraceWriter {
+    FILE *file;
+    struct TraceHeader header;
+    virt_addr_t *last_addr;
+    unsigned char *buf;
+    size_t buf_used;
+};
+
+struct TraceReader {
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    const unsigned char *cursor;
+    const unsigned char *end;
+    const unsigned char *released; // start of the mapping still resident
+    struct TraceHeader header;
+    const uint64_t *pids;
+    struct Proc **procs;
+    virt_addr_t *last_addr;
+    uint64_t checksum;
+    uint64_t ops_read;
+};
+
+/*
+ * Text traces of a single process, one access per line
+ *    Valgrind lackey:   "I  0400d7d4,8", " L 04222cac,8", " S 04222cac,8", " M ..."
+ *    plain address log: "R 0x7ffd5ec3a8", "W 7ffd5ec3a8"
+ * Loads (L/R) become READ, stores (S/W) become WRITE and modifies (M) become a
+ * READ followed by a WRITE. Instruction fetches and other lines are skipped.
+ */
+struct TextTraceReader {
+    int fd;
+    char *buf;
+    size_t buf_size;
+    size_t len;
+    size_t pos;
+    bool eof;
+    bool skip_line;
+    struct Proc *proc;
+    struct Operation pending;
+    bool has_pending;
+
+    // open addressing set of pages accessed so far (page_idx + 1, 0 is empty)
+    uint64_t *touched;
+    size_t touched_capacity;
+    size_t touched_count;
+
+    size_t lines;
+    size_t skipped_lines;
 };
 
+/*
+ * Undo journal of executed operations, kept in two fixed size rings so that
+ * its memory use never exceeds max_bytes: one of entries and one of saved
+ * frame contents for unmapped pages. Once a ring is full the oldest operation
+ * is dropped. Reads only change state when they fault a page back in, other
+ * reads are left out unless log_reads is set.
+ */
+#define INVALID_PAGE_SLOT ((size_t)-1)
+
+struct ExecLogConfig {
+    size_t max_bytes;
+    bool log_reads;
+};
+
+#define DEFAULT_EXEC_LOG_CONFIG                                                          \
+    ((struct ExecLogConfig){.max_bytes = 8 * 1024 * 1024, .log_reads = false})
+
 struct ExecLogEntry {
     struct Proc *proc;
     enum Action action;
+    uint32_t length; // bytes of a range write, 0 for a single byte
     virt_addr_t virt_addr;
     unsigned char old_data;
     unsigned char new_data;
-    bool did_map;
+    bool did_map; // a frame got mapped, on a page fault or as a private copy
+    bool was_evicted; // page was evicted before it got (un)mapped
+    bool is_eviction; // UNMAP done for the next entry, by an eviction or a cow copy
+    bool continues; // later page of a range call, undone along with the one before
+    size_t page_slot; // saved frame contents of an UNMAP or a range write
+    uintptr_t old_pte; // entry of a shared frame before it got unmapped or copied
 };
 
 struct ExecLog {
-    struct ExecLogEntry *stack;
-    int top;
-    size_t size;
+    struct ExecLogEntry *entries;
+    size_t head; // oldest entry
+    size_t count;
+    size_t capacity;
+
+    unsigned char *pages;
+    size_t page_head;
+    size_t page_count;
+    size_t page_capacity;
+
+    bool log_reads;
+    size_t dropped;
+
+    // range call being logged, entries of it are kept or dropped as a whole
+    bool in_call;
+    bool call_dropped; // the call did not fit, nothing of it is logged
+    bool call_started; // a page of the call was logged, later ones continue it
+    size_t call_count; // newest entries that belong to the call
+};
+
+/*
+ * Time travel over a sequence of operations
+ * Every interval operations a snapshot of phy_mem, frame_db, the page tables
+ * and the frame allocator/replacement state is taken. Snapshots are
+ * copy-on-write, frames, frame_db chunks and page tables that did not change
+ * since the previous snapshot are shared with it. A seek restores the closest
+ * snapshot at or before the target and replays only the gap.
+ */
+#define DEFAULT_CHECKPOINT_INTERVAL 4096
+#define SNAPSHOT_DB_CHUNK 64 // frames per frame_db chunk, one word of the dirty bitmap
+
+struct SnapshotBlock {
+    size_t ref_count;
+    unsigned char data[];
 };
 
+struct PageTableSnapshot {
+    size_t ref_count;
+    uint64_t version;
+    size_t count;
+    size_t *page_idx;
+    uintptr_t *entries;
+};
+
+struct Snapshot {
+    size_t op_idx;
+    struct SnapshotBlock **frames; // NULL for frames not in use
+    struct SnapshotBlock **frame_db_chunks;
+    struct PageTableSnapshot **page_tables;
+    struct FrameAllocator *allocator;
+    struct ReplacementEngine *replacement;
+};
+
+struct TimelineStats {
+    size_t frame_copies;
+    size_t frames_shared;
+    size_t restores;
+    size_t replayed_ops;
+};
+
+struct Timeline {
+    struct Operation *ops;
+    size_t op_count;
+    size_t op_capacity;
+    struct Proc **procs;
+    size_t proc_count;
+
+    size_t position; // operations executed so far
+    size_t interval;
+    struct Snapshot **snapshots; // sorted by op_idx
+    size_t snapshot_count;
+    size_t snapshot_capacity;
+
+    // state changed since base was taken or restored
+    struct Snapshot *base;
+    uint64_t *dirty;
+    bool diverged; // state was changed outside of the operations
+
+    struct TimelineStats stats;
+};
+
+/*
+ * Headless bisection looks for the first operation after which the condition
+ * holds, the condition is expected to stay true once it holds
+ */
+enum BisectKind { BISECT_USED_FRAMES, BISECT_FAULTS, BISECT_MAPPED, BISECT_BYTE };
+
+struct BisectCondition {
+    enum BisectKind kind;
+    size_t count;
+    size_t proc_idx;
+    virt_addr_t virt_addr;
+    unsigned char value;
+};
+
+/*
+ * ref_count is the number of page table entries mapping the frame
+ * The first mapping is kept in proc/page_idx, the others in a list of
+ * sharers so that a shared frame can be unmapped from all of them.
+ */
 struct FrameDBEntry {
     bool is_used;
+    bool is_shared; // frame of a shared segment, pinned and never copied on write
+    bool accessed; // frame of a huge page was touched, for internal fragmentation
+    enum PageClass page_class; // set on the first frame of a huge page
     size_t ref_count;
     struct Proc *proc;
+    size_t page_idx;
+    size_t sharers; // index into the sharer pool, 0: none
+    size_t swap_slot; // slot still holding the contents of the frame, 0: none
+};
+
+/*
+ * Free frames are kept on a stack of frame indices, so both allocating and
+ * freeing a frame are O(1) regardless of how many frames are in use.
+ * Frame 0 is never handed out, it is the zero page.
+ */
+#define INVALID_FRAME ((size_t)-1)
+
+struct FrameSharer {
+    struct Proc *proc;
+    size_t page_idx;
+    size_t next;
+};
+
+struct FrameAllocatorStats {
+    size_t allocations;
+    // base frames come off the free stack, only huge pages scan for a run
+    size_t huge_allocations;
+    size_t scan_steps; // frames looked at to find free runs
+    size_t max_scan;
 };
 
-extern unsigned char *phy_mem;
-extern size_t last_frame_id;
-extern struct ExecLog *exec_log;
-extern struct FrameDBEntry frame_db[DEFAULT_FRAME_COUNT];
+struct FrameAllocator {
+    size_t *free_stack;
+    size_t free_count;
+    size_t frame_count;
+
+    // sharer list nodes, entry 0 is never used so that 0 can mean "none"
+    struct FrameSharer *sharers;
+    size_t sharer_capacity;
+    size_t sharer_free;
+    size_t sharer_count;
+
+    size_t huge_pages; // runs of frames handed out for huge pages
+    struct FrameAllocatorStats stats;
+};
+
+/*
+ * Pool of zeroed frames, so that faults do not have to zero a frame first
+ * Free frames are moved into the pool after a fault and a background thread
+ * zeroes them in the order they came in. A fault mapping an empty page takes
+ * the oldest zeroed one, a fault that finds memory full takes back a frame of
+ * the pool before anything is evicted.
+ */
+#define DEFAULT_ZERO_POOL_FRAMES 0 // no pool, faults zero their frame
+
+struct ZeroPoolStats {
+    size_t hits; // faults that got a zeroed frame
+    size_t misses; // faults that had to zero their frame
+    size_t taken_back; // frames taken back when memory was full or by a rollback
+    size_t reclaimed; // frames evicted to refill the pool once memory was full
+    size_t zeroed; // by the background thread
+};
+
+struct ZeroPool {
+    unsigned char *phy_mem; // the thread is not bound to the machine
+    size_t page_size;
+
+    // ring of frames in the pool, the first ready ones are zeroed
+    size_t *frames;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t ready;
+    bool busy; // the frame after the ready ones is being zeroed
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t thread;
+    bool stop;
+
+    struct ZeroPoolStats stats;
+};
+
+/*
+ * Shared memory segment (shm, shared library text)
+ * Its frames are allocated when the segment is created and are never picked
+ * by the replacement policy. The segment holds one reference to each frame
+ * (proc NULL, page_idx the page of the segment) and every attached page one
+ * more, so a frame lives until the segment and all attachments are gone.
+ */
+struct SharedSegment {
+    char *name;
+    size_t page_count;
+    size_t *frames;
+};
+
+/*
+ * Page replacement, picks a victim frame when memory is full
+ * Resident frames are tracked in intrusive lists indexed by frame index, so
+ * every policy updates its metadata in O(1) on the access path.
+ */
+enum ReplacementPolicy {
+    REPLACE_FIFO,
+    REPLACE_LRU,
+    REPLACE_CLOCK,
+    REPLACE_SECOND_CHANCE,
+    REPLACE_ARC,
+};
+
+#define DEFAULT_REPLACEMENT_POLICY REPLACE_LRU
+
+struct IndexList {
+    size_t head;
+    size_t tail;
+    size_t size;
+};
+
+struct ReplacementStats {
+    size_t faults;
+    size_t major_faults;
+    size_t evictions;
+};
+
+struct ReplacementEngine {
+    enum ReplacementPolicy policy;
+    size_t frame_count;
+
+    // resident frames, FIFO/LRU/Second-Chance use resident, ARC uses t1 and t2
+    size_t *next;
+    size_t *prev;
+    unsigned char *list_id;
+    struct IndexList resident;
+    size_t clock_hand;
+
+    // ARC: ghost entries remember recently evicted pages by (pid, page_idx)
+    struct IndexList t1, t2, b1, b2;
+    size_t arc_target;
+    size_t ghost_capacity;
+    size_t *ghost_pid;
+    size_t *ghost_page_idx;
+    size_t *ghost_next;
+    size_t *ghost_prev;
+    size_t *ghost_hash_next;
+    unsigned char *ghost_list_id;
+    size_t *ghost_buckets;
+    size_t ghost_bucket_count;
+    struct IndexList ghost_free;
+    unsigned char pending_ghost_hit;
+
+    struct ReplacementStats stats;
+};
+
+/*
+ * Parameter sweep, every combination of the value lists is run on a simulator
+ * of its own. All of them replay the same trace, a generated workload is
+ * recorded to a temporary trace first.
+ */
+#define MAX_SWEEP_VALUES 64
+
+struct SweepConfig {
+    size_t frame_counts[MAX_SWEEP_VALUES];
+    size_t frame_count_values;
+    unsigned page_shifts[MAX_SWEEP_VALUES];
+    size_t page_shift_values;
+    enum ReplacementPolicy policies[MAX_SWEEP_VALUES];
+    size_t policy_values;
+    size_t jobs; // worker threads, 0: one per host core
+};
+
+/*
+ * Stack distance analysis, the LRU miss ratio of every memory size from a
+ * single pass (Mattson). The stack distance of an access is the number of
+ * other pages accessed since the last access to its page, LRU with more frames
+ * than that hits. A Fenwick tree over access times holds a mark at the last
+ * access of every page and counts the marks after a time in O(log n).
+ *
+ * With SHARDS sampling only pages whose hash is below the threshold are
+ * tracked, distances are scaled back up by the sampling rate when printed.
+ * Pages are (pid, page_idx) pairs of base pages.
+ */
+#define SHARDS_MODULUS (1ull << 24)
+#define STACK_DISTANCE_INITIAL_CAPACITY 4096
+
+struct StackDistance {
+    // page -> time of its last access, open addressing, key 0 is empty
+    uint64_t *keys;
+    uint64_t *last_access;
+    size_t map_capacity;
+    size_t page_count;
+
+    // a mark at the last access time of every page
+    uint32_t *tree;
+    size_t tree_capacity;
+    uint64_t now;
+
+    uint64_t *histogram; // reuses by stack distance, in sampled pages
+    size_t histogram_size;
+    uint64_t accesses; // sampled accesses only
+    uint64_t cold_misses;
+    uint64_t skipped; // accesses to pages left out by sampling
+
+    uint64_t sample_threshold; // out of SHARDS_MODULUS
+    size_t compactions;
+};
+
+/*
+ * Access heat of frames and pages, decaying exponentially
+ * A touch at clock t adds 2^(t / half_life) to the score of its frame and
+ * page, the clock counting accesses. Every score divided by the current
+ * weight 2^(clock / half_life) is the decayed number of touches, so scores
+ * compare without decaying each of them. The scores are scaled down before
+ * the weight gets too large for a double.
+ */
+#define DEFAULT_HEAT_HALF_LIFE 4096 // accesses
+#define HEAT_RESCALE_EXPONENT 512
+#define HEATMAP_INITIAL_CAPACITY 4096
+
+struct Heatmap {
+    size_t half_life;
+    uint64_t clock; // accesses since the last rescale
+    double weight;  // 2^(clock / half_life)
+    double step;    // 2^(1 / half_life)
+    uint64_t accesses;
+
+    double *frame_scores;
+    size_t frame_count;
+
+    // (pid << 40 | page_idx) + 1 -> score, open addressing, key 0 is empty
+    uint64_t *page_keys;
+    double *page_scores;
+    size_t page_capacity;
+    size_t page_count;
+};
+
+
+/*
+ * Swap device, evicted pages are written to slots of a swap file and read back
+ * on a major fault. Every page table entry and frame referring to a slot holds
+ * a reference to it, a frame brought back keeps its slot until it is written
+ * to, so evicting it again writes nothing.
+ *
+ * The I/O is done by a pool of threads. Every request goes through an entry of
+ * the swap cache, which holds the page while it is written or read and after
+ * that, until the entry is reused. An eviction only waits for a free entry, a
+ * fault waits for its own read. A read also reads ahead the other used slots
+ * of its cluster, pages evicted together are usually faulted in together.
+ */
+#define SWAP_LATENCY_BUCKETS 64 // log2 of the fault latency in ns
+
+struct SwapConfig {
+    size_t size; // bytes of the swap file
+    size_t io_threads;
+    size_t readahead; // slots per readahead cluster, 1: no readahead
+    size_t cache_pages;
+    uint64_t device_latency_ns; // added to every request, like a slow device
+};
+
+#define DEFAULT_SWAP_CONFIG                                                              \
+    ((struct SwapConfig){.size = 64 << 20,                                               \
+                         .io_threads = 4,                                                \
+                         .readahead = 8,                                                 \
+                         .cache_pages = 64,                                              \
+                         .device_latency_ns = 0})
+
+enum SwapIO { SWAP_IDLE, SWAP_READING, SWAP_WRITING };
+
+struct SwapCacheEntry {
+    size_t slot; // 0: holds nothing
+    enum SwapIO io;
+    bool readahead; // read ahead and not faulted in yet
+    unsigned char *data;
+};
+
+struct SwapStats {
+    size_t writes;
+    size_t clean_evictions; // still on swap, nothing written
+    size_t dropped; // evictions that found swap full, the contents are lost
+    size_t reads;
+    size_t readahead_reads;
+    size_t readahead_hits;
+    size_t cache_hits; // faults on a page still being written or cached
+    size_t cache_waits; // requests that waited for a cache entry
+    size_t major_faults;
+    uint64_t max_latency_ns;
+};
+
+struct Swap {
+    char *path;
+    int fd;
+    size_t page_size; // the I/O threads are not bound to the machine
+    uint64_t device_latency_ns;
+
+    size_t slot_count;
+    size_t used_slots;
+    size_t *slot_refs; // 0: free
+    size_t *slot_cache; // index + 1 of the cache entry of a slot, 0: not cached
+    size_t cursor; // next fit, pages evicted together get neighbouring slots
+    size_t readahead;
+
+    struct SwapCacheEntry *cache;
+    unsigned char *buffers;
+    size_t cache_size;
+    size_t cache_hand;
+
+    // cache entries waiting for an I/O thread, guarded by lock like the io states
+    size_t *queue;
+    size_t queue_head;
+    size_t queue_count;
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    pthread_cond_t done;
+    pthread_t *threads;
+    size_t thread_count;
+    bool stop;
+
+    struct SwapStats stats;
+    uint64_t fault_latency[SWAP_LATENCY_BUCKETS];
+};
+
+/*
+ * Snapshots of the process and machine counters taken while a run goes on,
+ * written as CSV (one line per process and snapshot) or as a JSON array
+ */
+#define DEFAULT_COUNTERS_INTERVAL 10000
+
+struct CounterExport {
+    FILE *file;
+    bool json;
+    struct Proc **procs;
+    size_t proc_count;
+    size_t snapshots;
+    struct timespec start;
+};
+
+struct HeadlessConfig {
+    struct WorkloadConfig workload;
+    const char *trace_path;
+    const char *text_trace_path;
+    const char *record_path;
+    bool prefork;
+    size_t shared_pages; // pages of a segment attached to every process
+    size_t huge_page_size; // 0: faults map base pages only
+    bool sweep;
+    struct SweepConfig sweep_config;
+    bool mrc; // print the LRU miss-ratio curve of the run
+    size_t mrc_sample; // track 1 in n pages, 0 or 1: every page
+    const char *counters_path; // counter snapshots, JSON if it ends in .json
+    size_t counters_interval; // operations between snapshots
+    const char *heatmap_path; // heat of frames, pages and huge page ranges as CSV
+    size_t heat_half_life;
+    bool bisect;
+    struct BisectCondition bisect_condition;
+    size_t checkpoint_interval;
+};
+
+/*
+ * Simulator context, all state of one simulated machine
+ * A host thread works on the machine and CPU bound to it with bind_cpu(), so
+ * machines do not share anything and several of them can run side by side.
+ *
+ * Every CPU has its own TLB and exec log, a process only ever runs on its
+ * CPU. With more than one CPU each one runs on a host thread and takes locks:
+ *    - an access to a mapped page only takes the CPU's own lock
+ *    - so does a base page fault while the CPU has frames in its frame cache
+ *    - other faults and refilling the frame cache take mm_lock, which guards
+ *      the frame allocator, frame_db and the replacement engine
+ *    - a fault that has to evict, a cow break and an unmap change the pages of
+ *      other processes, they take every CPU lock (stop the world)
+ * Locks are taken in CPU id order, mm_lock last.
+ *
+ * Accesses and faults that ran without mm_lock reach the replacement engine
+ * late: the CPU queues them in a batch, full batches go to a ring of the CPU
+ * without a lock and whoever takes mm_lock next hands the rings to the engine.
+ * Stopping the world also takes the batches of the stopped CPUs, so the engine
+ * knows every mapped frame before it picks a victim.
+ */
+enum CPULock { CPU_UNLOCKED, CPU_LOCK_OWN, CPU_LOCK_MM, CPU_LOCK_WORLD };
+
+#define DEFAULT_CPU_COUNT 1
+#define MAX_CPU_COUNT 256
+#define CPU_EVENT_BATCH 64
+#define CPU_EVENT_RING (64 * CPU_EVENT_BATCH) // a power of two
+#define CPU_FRAME_BATCH 16 // frames a frame cache takes off the free stack at once
+
+// Access to a frame, or the fault that mapped it if proc is set
+struct ReplacementEvent {
+    size_t frame_idx;
+    struct Proc *proc;
+    size_t page_idx;
+    bool is_major;
+};
+
+struct CPUStats {
+    size_t ops;
+    size_t local_ops; // ran under the CPU's own lock only
+    size_t mm_locks;
+    size_t mm_waits; // mm_lock was held by another CPU
+    size_t cached_faults; // took a frame from the frame cache without mm_lock
+    size_t ring_full; // the CPU took mm_lock to hand over its own events
+    size_t world_stops;
+    size_t cpu_waits; // a CPU lock was held, by its CPU or one stopping the world
+    uint64_t wait_ns;
+};
+
+struct CPU {
+    size_t id;
+    struct Simulator *sim;
+    struct TLB *tlb;
+    struct ExecLog *exec_log;
+    pthread_mutex_t lock;
+    enum CPULock held;
+
+    // replacement events without mm_lock, the ring is drained under mm_lock
+    struct ReplacementEvent event_batch[CPU_EVENT_BATCH];
+    size_t event_count;
+    struct ReplacementEvent *event_ring;
+    size_t ring_head; // written by the holder of mm_lock
+    size_t ring_tail; // written by the CPU
+
+    // free frames only this CPU maps, marked used like the frames of the zero pool
+    size_t frame_cache[CPU_FRAME_BATCH];
+    size_t cached_frames;
+
+    // page sized buffers, a range copy holds copy_page while its writes fault
+    unsigned char *fault_page;
+    unsigned char *copy_page;
+
+    struct CPUStats stats;
+    struct EventRing *events; // NULL: events are not traced
+} __attribute__((aligned(64)));
+
+struct SimulatorConfig {
+    size_t frame_count;
+    unsigned page_shift;
+    size_t cpu_count;
+    enum ReplacementPolicy policy;
+    struct TLBConfig tlb;
+    bool keep_exec_log;
+    struct ExecLogConfig exec_log;
+    size_t zero_pool_frames;
+};
+
+struct Simulator {
+    unsigned char *phy_mem;
+    size_t frame_count;
+    unsigned page_shift;
+    struct FrameDBEntry *frame_db;
+    struct FrameAllocator *frame_allocator;
+    struct ReplacementEngine *replacement;
+    struct Timeline *timeline;
+    // next page table version, never reused: page tables share one counter, so a
+    // version identifies a table's contents
+    uint64_t page_table_version;
+    struct StackDistance *stack_distance; // NULL: no analysis
+    struct Heatmap *heatmap; // NULL: access heat is not tracked
+    uint32_t *frame_generation; // bumped when the contents of a frame change
+    struct Swap *swap; // NULL: evicted pages lose their contents
+    struct ZeroPool *zero_pool; // NULL: faults zero their frame
+
+    struct CPU *cpus;
+    size_t cpu_count;
+    bool concurrent; // CPUs run on host threads and take locks
+    pthread_mutex_t mm_lock;
+    struct EventTrace *events; // NULL: events are not traced
+};
+
+/*
+ * Binary event trace
+ * Every CPU writes fixed size records into a ring of its own, a writer thread
+ * drains the rings to the trace file. The CPU never waits for the writer, an
+ * event that finds its ring full is dropped and counted.
+ *
+ * Events above EVENT_TRACE_LEVEL are compiled out, the others cost a branch
+ * on this_cpu->events while no trace is written.
+ */
+#define EVENT_LEVEL_NONE 0
+#define EVENT_LEVEL_FAULTS 1 // faults, evictions and segmentation faults
+#define EVENT_LEVEL_ALL 2 // also maps, unmaps and rollbacks
+
+#ifndef EVENT_TRACE_LEVEL
+#define EVENT_TRACE_LEVEL EVENT_LEVEL_ALL
+#endif
+
+#define EVENT_TRACE_MAGIC 0x31545645534d56ull // "VMSEVT1"
+#define EVENT_RING_SIZE (1 << 16) // events per CPU, a power of two
+#define EVENT_FLUSH_INTERVAL_NS 1000000
+
+enum EventType {
+    EVENT_FAULT, // flags: 1 for a major fault
+    EVENT_MAP,
+    EVENT_UNMAP,
+    EVENT_EVICT,
+    EVENT_ROLLBACK, // flags: action of the entry undone
+    EVENT_SEGFAULT,
+};
+
+struct TraceEvent {
+    uint64_t time_ns; // since the trace was opened
+    uint64_t page_idx;
+    uint64_t frame_idx;
+    uint32_t pid;
+    uint8_t type;
+    uint8_t cpu;
+    uint16_t flags;
+};
+
+struct EventTraceHeader {
+    uint64_t magic;
+    uint32_t page_shift;
+    uint32_t cpu_count;
+};
+
+// head and dropped are only written by the CPU, tail only by the writer thread
+struct EventRing {
+    struct TraceEvent events[EVENT_RING_SIZE];
+    size_t head __attribute__((aligned(64)));
+    size_t dropped;
+    size_t tail __attribute__((aligned(64)));
+};
+
+struct EventTrace {
+    FILE *file;
+    struct EventRing *rings; // one per CPU
+    size_t ring_count;
+    uint64_t start_ns;
+    pthread_t writer;
+    bool stop;
+    size_t written;
+};
+
+#define TRACE_EVENT(level, type, pid, page_idx, frame_idx, flags)                        \
+    do {                                                                                 \
+        if (EVENT_TRACE_LEVEL >= (level) && this_cpu->events) {                          \
+            trace_event((type), (pid), (page_idx), (frame_idx), (flags));                \
+        }                                                                                \
+    } while (0)
+
+extern _Thread_local struct Simulator *sim;
+extern _Thread_local struct CPU *this_cpu;
+
+// Views that cache the contents of a frame redraw it once the generation moves
+static inline void bump_frame_generation(size_t frame_idx) {
+    uint32_t *generation = &sim->frame_generation[frame_idx];
+    __atomic_store_n(generation, __atomic_load_n(generation, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+}
+
+typedef bool (*next_operation_fn)(void *source, struct Operation *op);
 
 // Process.c
 struct Proc *create_proc(char *name);
+struct Proc *fork_proc(struct Proc *parent);
 void destroy_proc(struct Proc *proc);
 void set_memory(struct Proc *proc, virt_addr_t virt_addr, unsigned char data);
 unsigned char access_memory(struct Proc *proc, virt_addr_t virt_addr);
 unsigned char inspect_memory(struct Proc *proc, virt_addr_t virt_addr);
+bool read_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char *buf,
+                size_t len);
+bool write_range(struct Proc *proc, virt_addr_t virt_addr, const unsigned char *buf,
+                 size_t len);
+bool fill_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char value,
+                size_t len);
+bool copy_range(struct Proc *dst, virt_addr_t dst_addr, struct Proc *src,
+                virt_addr_t src_addr, size_t len);
+void inspect_memory_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char *buf,
+                          size_t len);
 bool is_proc_same(struct Proc *proc1, struct Proc *proc2);
 
 // PageTable.c
-struct PageTable *create_page_table(size_t size);
+struct PageTable *create_page_table();
 void destroy_page_table(struct PageTable *pt);
+uintptr_t get_page_table_entry(struct PageTable *pt, size_t page_idx);
+uintptr_t get_pte(struct PageTable *pt, size_t page_idx);
+bool is_page_evicted(struct PageTable *pt, size_t page_idx);
+void for_each_mapped_page(struct PageTable *pt,
+                          void (*fn)(size_t page_idx, uintptr_t entry, void *arg),
+                          void *arg);
+size_t page_table_memory_usage(struct PageTable *pt);
 void print_page_table(struct PageTable *pt);
-void map_frame_at_addr(struct PageTable *page_table, virt_addr_t virt_addr);
+void print_page_table_stats(struct PageTable *pt);
+bool map_frame_at_addr(struct PageTable *page_table, virt_addr_t virt_addr);
+void map_zero_page(struct PageTable *pt, size_t page_idx);
 void unmap_page_by_virtual_addr(struct PageTable *pt, virt_addr_t virt_addr);
 void unmap_page_by_page_idx(struct PageTable *pt, size_t page_idx);
+void release_page_table_frames(struct PageTable *pt);
+const char *page_class_to_str(enum PageClass class);
+bool page_class_from_size(size_t size, enum PageClass *class);
+bool break_cow(struct PageTable *pt, size_t page_idx);
+void share_page(struct PageTable *pt, size_t page_idx, uintptr_t pte);
+void protect_page(struct PageTable *pt, size_t page_idx, uintptr_t pte);
+void restore_page(struct PageTable *pt, size_t page_idx, const unsigned char *contents,
+                  uintptr_t flags);
+void release_page(struct PageTable *pt, size_t page_idx, bool was_evicted);
+void mark_page_evicted(struct PageTable *pt, size_t page_idx);
+void set_pte_flags(struct PageTable *pt, size_t page_idx, uintptr_t flags);
+bool test_and_clear_frame_accessed(size_t frame_idx);
+void for_each_page_table_entry(struct PageTable *pt,
+                               void (*fn)(size_t page_idx, uintptr_t entry, void *arg),
+                               void *arg);
+void clear_page_table(struct PageTable *pt);
+void load_page_table_entry(struct PageTable *pt, size_t page_idx, uintptr_t entry);
+
+// FrameAllocator.c
+struct FrameAllocator *create_frame_allocator(size_t frame_count);
+void destroy_frame_allocator(struct FrameAllocator *allocator);
+size_t alloc_frame(struct FrameAllocator *allocator);
+bool alloc_frame_at(struct FrameAllocator *allocator, size_t frame_idx);
+size_t alloc_cached_frame(struct FrameAllocator *allocator);
+void return_cached_frames(struct FrameAllocator *allocator, struct CPU *cpu);
+void free_frame(struct FrameAllocator *allocator, size_t frame_idx);
+bool is_frame_unused(size_t frame_idx);
+size_t used_frame_count(struct FrameAllocator *allocator);
+size_t frame_mapping_count(size_t frame_idx);
+size_t alloc_frames(struct FrameAllocator *allocator, enum PageClass class);
+void free_frames(struct FrameAllocator *allocator, size_t first_frame);
+void print_huge_page_stats();
+void copy_frame_allocator(struct FrameAllocator *dst, struct FrameAllocator *src);
+void add_frame_mapping(struct FrameAllocator *allocator, size_t frame_idx,
+                       struct Proc *proc, size_t page_idx);
+size_t remove_frame_mapping(struct FrameAllocator *allocator, size_t frame_idx,
+                            struct Proc *proc, size_t page_idx);
+
+// ZeroPool.c
+struct ZeroPool *create_zero_pool(size_t capacity);
+void destroy_zero_pool(struct ZeroPool *pool);
+size_t take_zeroed_frame(struct ZeroPool *pool);
+size_t take_back_pool_frame(struct ZeroPool *pool);
+bool take_pool_frame(struct ZeroPool *pool, size_t frame_idx);
+void refill_zero_pool(struct ZeroPool *pool);
+void print_zero_pool_stats(struct ZeroPool *pool);
+
+// SharedMemory.c
+struct SharedSegment *create_shared_segment(const char *name, size_t page_count);
+void destroy_shared_segment(struct SharedSegment *segment);
+bool attach_shared_segment(struct Proc *proc, struct SharedSegment *segment,
+                           virt_addr_t virt_addr);
+void detach_shared_segment(struct Proc *proc, struct SharedSegment *segment,
+                           virt_addr_t virt_addr);
+void print_shared_frame_stats();
+
+// Replacement.c
+struct ReplacementEngine *create_replacement_engine(enum ReplacementPolicy policy,
+                                                    size_t frame_count);
+void destroy_replacement_engine(struct ReplacementEngine *engine);
+void replacement_on_fault(struct ReplacementEngine *engine, struct Proc *proc,
+                          size_t page_idx, bool is_major);
+size_t replacement_select_victim(struct ReplacementEngine *engine);
+void replacement_on_map(struct ReplacementEngine *engine, size_t frame_idx);
+void replacement_on_access(struct ReplacementEngine *engine, size_t frame_idx);
+void replacement_on_free(struct ReplacementEngine *engine, size_t frame_idx);
+const char *replacement_policy_to_str(enum ReplacementPolicy policy);
+bool replacement_policy_from_str(const char *str, enum ReplacementPolicy *policy);
+void print_replacement_stats(struct ReplacementEngine *engine);
+void copy_replacement_engine(struct ReplacementEngine *dst,
+                             struct ReplacementEngine *src);
+
+// TLB.c
+struct TLB *create_tlb(struct TLBConfig config);
+void destroy_tlb(struct TLB *tlb);
+uintptr_t tlb_lookup(struct TLB *tlb, struct Proc *proc, size_t page_idx);
+void tlb_insert(struct TLB *tlb, struct Proc *proc, size_t page_idx, uintptr_t pte);
+void tlb_invalidate(struct TLB *tlb, struct Proc *proc, size_t page_idx);
+void tlb_flush_proc(struct TLB *tlb, struct Proc *proc);
+void print_tlb_stats(struct TLB *tlb, struct Proc *proc);
+const char *tlb_policy_to_str(enum TLBPolicy policy);
+bool tlb_policy_from_str(const char *str, enum TLBPolicy *policy);
+bool is_tlb_config_valid(struct TLBConfig config);
+struct TLBConfig tlb_config(struct TLB *tlb);
 
 // ExecLog.c
-struct ExecLog *create_exec_log();
-void push_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry);
+struct ExecLog *create_exec_log(struct ExecLogConfig config);
+bool push_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry);
+bool push_page_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry,
+                           const unsigned char *page);
+void begin_exec_log_call(struct ExecLog *log);
+void end_exec_log_call(struct ExecLog *log);
 struct ExecLogEntry pop_to_exec_log(struct ExecLog *log);
 struct ExecLogEntry peek_to_exec_log(struct ExecLog *log);
 void destroy_exec_log(struct ExecLog *log);
 void print_exec_stack(struct ExecLog *log);
+void print_exec_log_stats(struct ExecLog *log);
 void roll_back_opearation(struct ExecLog *log);
+void clear_exec_log(struct ExecLog *log);
+
+// Timeline.c
+struct Timeline *create_timeline(struct Proc **procs, size_t proc_count,
+                                 size_t interval);
+void destroy_timeline(struct Timeline *tl);
+void timeline_append(struct Timeline *tl, struct Operation *op);
+bool timeline_step(struct Timeline *tl);
+void timeline_seek(struct Timeline *tl, size_t op_idx);
+void timeline_mark_dirty(struct Timeline *tl, size_t frame_idx);
+void timeline_mark_diverged(struct Timeline *tl);
+void print_timeline_stats(struct Timeline *tl);
+
+// Simulator.c
+struct Simulator *create_simulator(struct SimulatorConfig config);
+void destroy_simulator(struct Simulator *simulator);
+void bind_cpu(struct CPU *cpu);
+void migrate_proc(struct Proc *proc, struct CPU *cpu);
+bool cpu_lock(enum CPULock level);
+void cpu_unlock();
+void note_frame_access(size_t frame_idx);
+void note_frame_fault(size_t frame_idx, struct Proc *proc, size_t page_idx,
+                      bool is_major);
+void run_on_cpus(next_operation_fn next, void **sources);
+void print_cpu_stats();
+
+// EventTrace.c
+bool open_event_trace(const char *path);
+bool close_event_trace();
+void trace_event(enum EventType type, size_t pid, size_t page_idx, size_t frame_idx,
+                 unsigned flags);
+int decode_event_trace(const char *path);
+
+// Workload.c
+void perform_operation(struct Operation *op);
+void print_operation(struct Operation *op);
+struct Workload *create_workload(struct WorkloadConfig config, struct Proc **procs);
+void destroy_workload(struct Workload *workload);
+void mark_workload_populated(struct Workload *workload);
+bool next_workload_operation(struct Workload *workload, struct Operation *op);
+const char *workload_kind_to_str(enum WorkloadKind kind);
+bool workload_kind_from_str(const char *str, enum WorkloadKind *kind);
+
+// Trace.c
+struct TraceWriter *trace_writer_open(const char *path, const uint64_t *pids,
+                                      size_t proc_count);
+bool trace_writer_append(struct TraceWriter *writer, size_t proc_idx,
+                         struct Operation *op);
+bool trace_writer_close(struct TraceWriter *writer);
+struct TraceReader *trace_reader_open(const char *path);
+void trace_reader_bind_proc(struct TraceReader *reader, size_t proc_idx,
+                            struct Proc *proc);
+bool trace_reader_next(struct TraceReader *reader, struct Operation *op);
+bool trace_reader_verify(struct TraceReader *reader);
+void trace_reader_close(struct TraceReader *reader);
+
+// TextTrace.c
+struct TextTraceReader *text_trace_open(const char *path, struct Proc *proc);
+bool text_trace_next(struct TextTraceReader *reader, struct Operation *op);
+void text_trace_close(struct TextTraceReader *reader);
+
+// StackDistance.c
+struct StackDistance *create_stack_distance(size_t sample_rate);
+void destroy_stack_distance(struct StackDistance *sd);
+void stack_distance_access(struct StackDistance *sd, size_t pid, size_t page_idx);
+size_t stack_distance_misses(struct StackDistance *sd, size_t frames);
+void print_miss_ratio_curve(struct StackDistance *sd);
+
+// Heatmap.c
+struct Heatmap *create_heatmap(size_t frame_count, size_t half_life);
+void destroy_heatmap(struct Heatmap *hm);
+void heatmap_access(struct Heatmap *hm, size_t pid, size_t page_idx, size_t frame_idx);
+double heatmap_frame_heat(struct Heatmap *hm, size_t frame_idx);
+void for_each_page_heat(struct Heatmap *hm,
+                        void (*fn)(size_t pid, size_t page_idx, double heat, void *arg),
+                        void *arg);
+bool write_heatmap(struct Heatmap *hm, const char *path);
+
+// Swap.c
+struct Swap *create_swap(const char *path, struct SwapConfig config);
+void destroy_swap(struct Swap *swap);
+size_t swap_out(struct Swap *swap, size_t frame_idx, bool dirty);
+void swap_in(struct Swap *swap, size_t slot, unsigned char *page);
+void swap_dup(struct Swap *swap, size_t slot);
+void swap_free(struct Swap *swap, size_t slot);
+void record_fault_latency(struct Swap *swap, uint64_t ns);
+void print_swap_stats(struct Swap *swap);
+
+// Counters.c
+struct CounterExport *open_counter_export(const char *path, struct Proc **procs,
+                                          size_t proc_count);
+void write_counter_snapshot(struct CounterExport *export, size_t op_count);
+bool close_counter_export(struct CounterExport *export);
+void print_proc_counters(struct Proc *proc);
+
+// Headless.c
+int run_headless(struct HeadlessConfig *config);
+bool bisect_condition_from_str(const char *str, struct BisectCondition *cond);
+
+// Sweep.c
+int run_sweep(struct SweepConfig *config, const char *trace_path);
 
 // visualisation.c
-void multi_process_visualisation(struct Proc *_proc1, struct Proc *_proc2);
+void multi_process_visualisation(struct Proc *_proc1, struct Proc *_proc2,
+                                 size_t page_count);
 
 // visualisation2.c
-void memory_inspector_visualisation(struct Proc *_proc);
+void memory_inspector_visualisation(struct Proc *_proc, size_t page_count);
 
 #endif // PAGING_H
@@ -19,14 +19,54 @@
 
 #define DIVIDER_POS 700
 
+// page tables and frames scroll in the band between the title and the divider
+#define VIEW_HEIGHT (DIVIDER_POS - TOP_PADDING)
+// rows thinner than this are drawn as an overview without text
+#define LOD_ROW_HEIGHT 24
+#define ZOOM_STEP 1.25f
+// at most one arrow per pixel row of each page table
+#define MAX_ARROWS (2 * (VIEW_HEIGHT + 1))
+
+// memory inspector of the second visualisation, rows are drawn into a texture
+#define INSPECTOR_X 930
+#define INSPECTOR_ROWS 48
+#define INSPECTOR_COLS 16
+#define INSPECTOR_FONT_SIZE 14
+#define INSPECTOR_ROW_HEIGHT 15
+#define INSPECTOR_ADDR_WIDTH 50
+#define INSPECTOR_HEX_WIDTH 25
+#define INSPECTOR_CHAR_WIDTH 10
+#define INSPECTOR_WIDTH                                                                  \
+    (INSPECTOR_ADDR_WIDTH + INSPECTOR_COLS * (INSPECTOR_HEX_WIDTH + INSPECTOR_CHAR_WIDTH))
+
+// heatmap mode, the UI steps one operation at a time so heat decays quickly
+#define UI_HEAT_HALF_LIFE 8
+#define HEATMAP_WIDTH 64 // most cells in a line of the heatmap texture
+
+// operations between timeline snapshots of the test case
+#define UI_CHECKPOINT_INTERVAL 4
+
 static const Color BG_COLOR = (Color){20, 20, 21, 255};
 static const Color TEXT_COLOR = (Color){174, 174, 209, 255};
 static const Color TITLE_COLOR = (Color){187, 157, 189, 255};
 static const Color BOX_BOUNDRY_COLOR = (Color){135, 135, 135, 255};
 static const Color HEX_RED_COLOR = (Color){201, 31, 68, 255};
+static const Color SHARED_FRAME_COLOR = (Color){110, 180, 150, 255};
+static const Color HEAT_COLD_COLOR = (Color){40, 40, 48, 255};
+static const Color HEAT_HOT_COLOR = (Color){250, 220, 90, 255};
+
+/*
+ * A scrollable column of rows, only the rows in the view are drawn. Both
+ * page tables share one view so the arrows of a page start at the same row.
+ */
+struct RowView {
+    size_t row_count;
+    float row_height; // BOX_HEIGHT at the closest zoom
+    double scroll;    // rows above the view, double to reach the end of large views
+};
 
-extern size_t sim_page_size;
-extern size_t sim_frame_count;
+extern struct RowView page_view;
+extern struct RowView frame_view;
 
 struct FocusCtx {
     size_t page_table_idx;
@@ -34,34 +74,28 @@ struct FocusCtx {
     bool is_selected;
 };
 
-struct Operation {
-    enum Action action;
-    struct Proc *proc;
-    unsigned char data;
-    virt_addr_t virt_addr;
-};
-
-struct TestCase {
-    struct Operation *ops;
-    size_t operation_count;
-    size_t curr_operation_idx;
-};
-
 extern struct FocusCtx focus;
 extern struct TestCase test_case;
 
 // ui-utils.c
-void draw_arrow_from_proc_left(size_t page_idx, size_t frame_idx);
-void draw_arrow_from_proc_right(size_t page_idx, size_t frame_idx);
+void init_row_views(size_t page_count, size_t frame_count);
+void row_view_scroll_handler();
+void draw_page_arrows(struct Proc *proc, bool from_right);
 void draw_physical_memory();
 void draw_page_table(struct Proc *proc, size_t offset_x);
-void draw_arrow_head(Vector2 arrow_start, Vector2 arrow_end);
+void load_heatmap(struct Proc **procs, size_t proc_count);
+void unload_heatmap();
+void heatmap_key_handler();
+bool is_heatmap_shown();
+void update_heatmap();
+void draw_page_heat(struct Proc *proc, size_t offset_x);
+void draw_frame_heat();
+void draw_arrow_head(Vector2 arrow_start, Vector2 arrow_end, Color color);
 void draw_divider();
 void draw_text_section();
 
 int page_table_idx_at_cursor();
-void print_operation(struct Operation *op);
-void perform_operation(struct Operation *op);
+int operation_idx_at_cursor();
 void operation_to_str(struct Operation *op, size_t idx, char *buf, size_t size);
 char *action_to_str(enum Action action);
 
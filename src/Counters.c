@@ -0,0 +1,130 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Counter snapshots
+ * The counters are only read here, taking a snapshot costs one line per
+ * process and nothing is done between snapshots.
+ */
+
+static bool ends_with(const char *str, const char *suffix) {
+    size_t len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+struct CounterExport *open_counter_export(const char *path, struct Proc **procs,
+                                          size_t proc_count) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open %s for the counters", path);
+        return NULL;
+    }
+
+    struct CounterExport *export =
+        (struct CounterExport *)calloc(1, sizeof(struct CounterExport));
+    export->file = file;
+    export->json = ends_with(path, ".json");
+    export->procs = procs;
+    export->proc_count = proc_count;
+    clock_gettime(CLOCK_MONOTONIC, &export->start);
+
+    if (export->json) {
+        fprintf(file, "[");
+    } else {
+        fprintf(file, "op,seconds,pid,name,reads,writes,minor_faults,major_faults,maps,"
+                      "unmaps,evictions,dirty_evictions,frames_used,allocations,"
+                      "huge_allocations,huge_scan_avg,huge_scan_max,log_entries,"
+                      "log_bytes\n");
+    }
+    return export;
+}
+
+void write_counter_snapshot(struct CounterExport *export, size_t op_count) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds =
+        (now.tv_sec - export->start.tv_sec) + (now.tv_nsec - export->start.tv_nsec) / 1e9;
+
+    struct FrameAllocatorStats *alloc = &sim->frame_allocator->stats;
+    double scan_avg = alloc->huge_allocations
+                          ? (double)alloc->scan_steps / alloc->huge_allocations
+                          : 0;
+    size_t frames_used = used_frame_count(sim->frame_allocator);
+
+    // every CPU keeps a log of its own
+    size_t log_entries = 0, log_bytes = 0;
+    for (size_t i = 0; i < sim->cpu_count; i++) {
+        struct ExecLog *log = sim->cpus[i].exec_log;
+        if (log) {
+            log_entries += log->count;
+            log_bytes += log->count * sizeof(struct ExecLogEntry) +
+                         log->page_count * PAGE_SIZE;
+        }
+    }
+
+    FILE *file = export->file;
+    if (export->json) {
+        fprintf(file,
+                "%s\n  {\"op\": %zu, \"seconds\": %.6f, \"frames_used\": %zu, "
+                "\"allocations\": %zu, \"huge_allocations\": %zu, "
+                "\"huge_scan_avg\": %.3f, \"huge_scan_max\": %zu, "
+                "\"log_entries\": %zu, \"log_bytes\": %zu, \"procs\": [",
+                export->snapshots ? "," : "", op_count, seconds, frames_used,
+                alloc->allocations, alloc->huge_allocations, scan_avg, alloc->max_scan,
+                log_entries, log_bytes);
+    }
+    for (size_t i = 0; i < export->proc_count; i++) {
+        struct Proc *proc = export->procs[i];
+        struct ProcCounters *c = &proc->counters;
+        if (export->json) {
+            fprintf(file,
+                    "%s\n    {\"pid\": %zu, \"name\": \"%s\", \"reads\": %zu, "
+                    "\"writes\": %zu, \"minor_faults\": %zu, \"major_faults\": %zu, "
+                    "\"maps\": %zu, \"unmaps\": %zu, \"evictions\": %zu, "
+                    "\"dirty_evictions\": %zu}",
+                    i ? "," : "", proc->pid, proc->name, c->reads, c->writes,
+                    c->minor_faults, c->major_faults, c->maps, c->unmaps, c->evictions,
+                    c->dirty_evictions);
+        } else {
+            fprintf(file,
+                    "%zu,%.6f,%zu,%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,"
+                    "%zu,%zu,%zu,%.3f,%zu,%zu,%zu\n",
+                    op_count, seconds, proc->pid, proc->name, c->reads, c->writes,
+                    c->minor_faults, c->major_faults, c->maps, c->unmaps, c->evictions,
+                    c->dirty_evictions, frames_used, alloc->allocations,
+                    alloc->huge_allocations, scan_avg, alloc->max_scan, log_entries,
+                    log_bytes);
+        }
+    }
+    if (export->json) {
+        fprintf(file, "\n  ]}");
+    }
+    export->snapshots++;
+}
+
+bool close_counter_export(struct CounterExport *export) {
+    if (export->json) {
+        fprintf(export->file, "\n]\n");
+    }
+    bool ok = !ferror(export->file);
+    ok = fclose(export->file) == 0 && ok;
+    if (!ok) {
+        LOG_ERROR("Failed to write the counters");
+    } else {
+        LOG_INFO("counters: %zu snapshots", export->snapshots);
+    }
+    free(export);
+    return ok;
+}
+
+void print_proc_counters(struct Proc *proc) {
+    struct ProcCounters *c = &proc->counters;
+    LOG_INFO("%s: reads: %zu, writes: %zu, faults: %zu minor, %zu major", proc->name,
+             c->reads, c->writes, c->minor_faults, c->major_faults);
+    LOG_INFO("%s: maps: %zu, unmaps: %zu, evictions: %zu (%zu dirty)", proc->name,
+             c->maps, c->unmaps, c->evictions, c->dirty_evictions);
+}
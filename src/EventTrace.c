@@ -0,0 +1,193 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Event trace writer and decoder
+ * The file is an EventTraceHeader followed by TraceEvent records. Records of
+ * one CPU are in order, the writer interleaves the CPUs in batches, so a
+ * reader that needs a global order sorts by time.
+ */
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Write out what the CPU put in the ring since the last time
+static size_t drain_ring(struct EventTrace *trace, struct EventRing *ring) {
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = ring->tail;
+    size_t count = head - tail;
+
+    while (tail != head) {
+        size_t pos = tail & (EVENT_RING_SIZE - 1);
+        size_t run = head - tail;
+        if (run > EVENT_RING_SIZE - pos) {
+            run = EVENT_RING_SIZE - pos;
+        }
+        fwrite(&ring->events[pos], sizeof(struct TraceEvent), run, trace->file);
+        tail += run;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+static void *event_writer(void *arg) {
+    struct EventTrace *trace = (struct EventTrace *)arg;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = EVENT_FLUSH_INTERVAL_NS};
+
+    for (;;) {
+        // events traced before the stop are seen by the drain after it
+        bool stop = __atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE);
+        size_t drained = 0;
+        for (size_t i = 0; i < trace->ring_count; i++) {
+            drained += drain_ring(trace, &trace->rings[i]);
+        }
+        trace->written += drained;
+        if (stop) {
+            return NULL;
+        }
+        if (drained == 0) {
+            nanosleep(&pause, NULL);
+        }
+    }
+}
+
+// Trace the events of every CPU of the machine to path
+bool open_event_trace(const char *path) {
+    assert(sim->events == NULL && "[FATAL] Event trace is already open");
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open event trace %s", path);
+        return false;
+    }
+
+    struct EventTraceHeader header = {.magic = EVENT_TRACE_MAGIC,
+                                      .page_shift = sim->page_shift,
+                                      .cpu_count = sim->cpu_count};
+    fwrite(&header, sizeof(header), 1, file);
+
+    struct EventTrace *trace = (struct EventTrace *)calloc(1, sizeof(struct EventTrace));
+    trace->file = file;
+    trace->ring_count = sim->cpu_count;
+    trace->rings = (struct EventRing *)aligned_alloc(
+        _Alignof(struct EventRing), trace->ring_count * sizeof(struct EventRing));
+    assert(trace->rings != NULL);
+    for (size_t i = 0; i < trace->ring_count; i++) {
+        trace->rings[i].head = 0;
+        trace->rings[i].tail = 0;
+        trace->rings[i].dropped = 0;
+        sim->cpus[i].events = &trace->rings[i];
+    }
+    trace->start_ns = now_ns();
+
+    int err = pthread_create(&trace->writer, NULL, event_writer, trace);
+    assert(err == 0 && "[FATAL] Could not start the event writer");
+    (void)err;
+
+    sim->events = trace;
+    LOG_INFO("event trace: %s, levels up to %d compiled in", path, EVENT_TRACE_LEVEL);
+    return true;
+}
+
+// Stop tracing, the CPUs must not run anymore
+bool close_event_trace() {
+    struct EventTrace *trace = sim->events;
+    __atomic_store_n(&trace->stop, true, __ATOMIC_RELEASE);
+    pthread_join(trace->writer, NULL);
+
+    size_t dropped = 0;
+    for (size_t i = 0; i < trace->ring_count; i++) {
+        dropped += trace->rings[i].dropped;
+        sim->cpus[i].events = NULL;
+    }
+    bool ok = !ferror(trace->file);
+    ok = fclose(trace->file) == 0 && ok;
+    if (ok) {
+        LOG_INFO("event trace: %zu events, %zu dropped", trace->written, dropped);
+    } else {
+        LOG_ERROR("Failed to write the event trace");
+    }
+
+    free(trace->rings);
+    free(trace);
+    sim->events = NULL;
+    return ok;
+}
+
+void trace_event(enum EventType type, size_t pid, size_t page_idx, size_t frame_idx,
+                 unsigned flags) {
+    struct EventRing *ring = this_cpu->events;
+    size_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == EVENT_RING_SIZE) {
+        ring->dropped++;
+        return;
+    }
+
+    ring->events[head & (EVENT_RING_SIZE - 1)] =
+        (struct TraceEvent){.time_ns = now_ns() - sim->events->start_ns,
+                            .page_idx = page_idx,
+                            .frame_idx = frame_idx,
+                            .pid = (uint32_t)pid,
+                            .type = (uint8_t)type,
+                            .cpu = (uint8_t)this_cpu->id,
+                            .flags = (uint16_t)flags};
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static const char *event_type_to_str(unsigned type) {
+    static const char *names[] = {"fault", "map",      "unmap",
+                                  "evict", "rollback", "segfault"};
+    return type < sizeof(names) / sizeof(names[0]) ? names[type] : "unknown";
+}
+
+// Print the events of a trace file as text, one line per event
+int decode_event_trace(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open event trace %s", path);
+        return 1;
+    }
+
+    struct EventTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != EVENT_TRACE_MAGIC) {
+        LOG_ERROR("%s is not an event trace", path);
+        fclose(file);
+        return 1;
+    }
+    printf("# page size: %zu, cpus: %u\n", (size_t)1 << header.page_shift,
+           header.cpu_count);
+    printf("# time_us cpu event pid page frame\n");
+
+    size_t counts[EVENT_SEGFAULT + 2] = {0};
+    struct TraceEvent event;
+    while (fread(&event, sizeof(event), 1, file) == 1) {
+        printf("%.3f %u %s %u 0x%llx", event.time_ns / 1e3, event.cpu,
+               event_type_to_str(event.type), event.pid,
+               (unsigned long long)event.page_idx);
+        if (event.frame_idx == (uint64_t)INVALID_FRAME) {
+            printf(" -");
+        } else {
+            printf(" %llu", (unsigned long long)event.frame_idx);
+        }
+        if (event.type == EVENT_FAULT) {
+            printf(event.flags ? " major" : " minor");
+        } else if (event.type == EVENT_ROLLBACK) {
+            static const char *actions[] = {"read", "write", "unmap"};
+            printf(" %s", event.flags <= UNMAP ? actions[event.flags] : "unknown");
+        }
+        printf("\n");
+        counts[event.type <= EVENT_SEGFAULT ? event.type : EVENT_SEGFAULT + 1]++;
+    }
+    fclose(file);
+
+    for (unsigned type = 0; type <= EVENT_SEGFAULT; type++) {
+        LOG_INFO("%s: %zu", event_type_to_str(type), counts[type]);
+    }
+    return 0;
+}
@@ -2,89 +2,234 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*
- * ExecLog is a dyanmically sized stack that stores
+ * ExecLog is a bounded stack that stores
  * 1. executed instructions
  * 2. the memory changed by them
+ *
+ * Rolling back an entry restores the bytes and mappings directly, nothing is
+ * re-executed and nothing new gets logged.
  */
 
-#define DEFAULT_EXEC_LOG_SIZE 5
+#define MIN_EXEC_LOG_ENTRIES 16
 
-struct ExecLog *create_exec_log() {
+struct ExecLog *create_exec_log(struct ExecLogConfig config) {
     struct ExecLog *new_log = (struct ExecLog *)malloc(sizeof(struct ExecLog));
-    new_log->top = -1;
-    new_log->stack = (struct ExecLogEntry *)malloc(sizeof(struct ExecLogEntry) *
-                                                   DEFAULT_EXEC_LOG_SIZE);
-    new_log->size = DEFAULT_EXEC_LOG_SIZE;
+
+    // half of the budget for entries, the other half for saved frames
+    size_t budget = config.max_bytes / 2;
+    new_log->capacity = budget / sizeof(struct ExecLogEntry);
+    if (new_log->capacity < MIN_EXEC_LOG_ENTRIES) {
+        new_log->capacity = MIN_EXEC_LOG_ENTRIES;
+    }
+    new_log->page_capacity = budget / PAGE_SIZE ? budget / PAGE_SIZE : 1;
+
+    new_log->entries =
+        (struct ExecLogEntry *)malloc(new_log->capacity * sizeof(struct ExecLogEntry));
+    new_log->pages = (unsigned char *)malloc(new_log->page_capacity * PAGE_SIZE);
+    assert(new_log->entries != NULL && new_log->pages != NULL);
+
+    new_log->head = 0;
+    new_log->count = 0;
+    new_log->page_head = 0;
+    new_log->page_count = 0;
+    new_log->log_reads = config.log_reads;
+    new_log->dropped = 0;
+    new_log->in_call = false;
+    new_log->call_dropped = false;
+    new_log->call_started = false;
+    new_log->call_count = 0;
     return new_log;
 };
 
-static void resize_exec_log(struct ExecLog *log, size_t new_size) {
-    assert(log != NULL && "ExecLog pointer is null");
+static inline size_t entry_pos(struct ExecLog *log, size_t i) {
+    return (log->head + i) % log->capacity;
+}
 
-    if (new_size == log->size) {
-        return;
+// Whether the oldest entry that is no eviction continues a range call
+static bool oldest_continues(struct ExecLog *log) {
+    for (size_t i = 0; i < log->count; i++) {
+        struct ExecLogEntry *entry = &log->entries[entry_pos(log, i)];
+        if (!entry->is_eviction) {
+            return entry->continues;
+        }
+    }
+    return false;
+}
+
+/*
+ * Discard the oldest operation to make room
+ * Evictions are logged right before the entry that caused them, and the pages
+ * of a range call right after its first one, so they are dropped together
+ * with it and an operation is never undone halfway. The range call being
+ * logged is never touched.
+ */
+static void drop_oldest_operation(struct ExecLog *log) {
+    while (log->count > log->call_count) {
+        struct ExecLogEntry *entry = &log->entries[log->head];
+        log->head = entry_pos(log, 1);
+        log->count--;
+        log->dropped++;
+
+        if (entry->page_slot != INVALID_PAGE_SLOT) {
+            assert(entry->page_slot == log->page_head);
+            log->page_head = (log->page_head + 1) % log->page_capacity;
+            log->page_count--;
+        }
+        if (!entry->is_eviction && !oldest_continues(log)) {
+            break;
+        }
+    }
+}
+
+/*
+ * Make room for an entry and a saved frame if page is set, false if the entry
+ * is not logged. A range call that does not fit by itself is not logged at
+ * all, keeping only its later pages would undo it halfway. The log is
+ * cleared for it, older operations were dropped to make room for it anyway.
+ */
+static bool make_room(struct ExecLog *log, bool page) {
+    if (log->call_dropped) {
+        log->dropped++;
+        return false;
+    }
+    while (log->count == log->capacity ||
+           (page && log->page_count == log->page_capacity)) {
+        if (log->count == log->call_count) {
+            log->dropped += log->count + 1;
+            clear_exec_log(log);
+            log->call_dropped = true;
+            return false;
+        }
+        drop_oldest_operation(log);
     }
+    return true;
+}
+
+// Pages of a range call after its first one are undone along with it
+static void append_entry(struct ExecLog *log, struct ExecLogEntry entry) {
+    if (log->in_call) {
+        entry.continues = log->call_started && !entry.is_eviction;
+        log->call_started |= !entry.is_eviction;
+        log->call_count++;
+    }
+    log->entries[entry_pos(log, log->count)] = entry;
+    log->count++;
+}
 
-    log->stack = realloc(log->stack, new_size * sizeof(struct ExecLogEntry));
-    assert(log->stack != NULL);
-    log->size = new_size;
+// Returns false if the entry was not logged
+bool push_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry) {
+    assert(log != NULL && "ExecLog pointer is null");
+
+    if (!make_room(log, false)) {
+        return false;
+    }
+    entry.page_slot = INVALID_PAGE_SLOT;
+    append_entry(log, entry);
+    return true;
 }
 
-void push_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry) {
+// Push an UNMAP or range WRITE entry along with a copy of the frame it changes
+bool push_page_to_exec_log(struct ExecLog *log, struct ExecLogEntry entry,
+                           const unsigned char *page) {
     assert(log != NULL && "ExecLog pointer is null");
+    assert((entry.action == UNMAP || entry.length > 0) && page != NULL);
 
-    if (log->top == (int)log->size - 1) {
-        resize_exec_log(log, log->size * 1.5);
+    if (!make_room(log, true)) {
+        return false;
     }
-    log->top++;
-    log->stack[log->top] = entry;
+    entry.page_slot = (log->page_head + log->page_count) % log->page_capacity;
+    memcpy(&log->pages[entry.page_slot * PAGE_SIZE], page, PAGE_SIZE);
+    log->page_count++;
+    append_entry(log, entry);
+    return true;
+}
+
+/*
+ * Entries pushed until the end of the call are one operation, a rollback
+ * undoes them together
+ */
+void begin_exec_log_call(struct ExecLog *log) {
+    log->in_call = true;
+    log->call_dropped = false;
+    log->call_started = false;
+    log->call_count = 0;
+}
+
+void end_exec_log_call(struct ExecLog *log) {
+    log->in_call = false;
+    log->call_dropped = false;
+    log->call_started = false;
+    log->call_count = 0;
 }
 
 /*
  * Pop a entry from stack
  * Throws a error if stack is empty
+ * The saved frame of the entry stays valid until the next push.
  */
 struct ExecLogEntry pop_to_exec_log(struct ExecLog *log) {
     assert(log != NULL && "ExecLog pointer is null");
-    assert(log->top > -1 && "Stack is empty");
+    assert(log->count > 0 && "Stack is empty");
 
-    return log->stack[log->top--];
+    log->count--;
+    if (log->call_count > 0) {
+        log->call_count--;
+    }
+    struct ExecLogEntry entry = log->entries[entry_pos(log, log->count)];
+    if (entry.page_slot != INVALID_PAGE_SLOT) {
+        log->page_count--;
+    }
+    return entry;
 }
 
 struct ExecLogEntry peek_to_exec_log(struct ExecLog *log) {
     assert(log != NULL && "ExecLog pointer is null");
+    assert(log->count > 0 && "Stack is empty");
 
-    return log->stack[log->top];
+    return log->entries[entry_pos(log, log->count - 1)];
 }
 
-void destroy_exec_log_entry(struct ExecLogEntry *entry) {
-    free(entry);
+// Forget every entry, used when the state was replaced as a whole
+void clear_exec_log(struct ExecLog *log) {
+    log->head = 0;
+    log->count = 0;
+    log->page_head = 0;
+    log->page_count = 0;
+    log->call_started = false;
+    log->call_count = 0;
 }
 
 void destroy_exec_log(struct ExecLog *log) {
-    free(log->stack);
+    free(log->entries);
+    free(log->pages);
     free(log);
 }
 
 void print_exec_stack(struct ExecLog *log) {
     LOG_INFO("--------------------ExecLog Stack--------------------");
-    for (int i = log->top; i >= 0; i--) {
-        struct ExecLogEntry entry = log->stack[i];
+    for (size_t i = log->count; i-- > 0;) {
+        struct ExecLogEntry entry = log->entries[entry_pos(log, i)];
 
         switch (entry.action) {
         case WRITE:
             printf(">> Action: WRITE, ");
+            if (entry.length > 0) {
+                printf("%u bytes at %p, did_map: %d ", entry.length,
+                       (void *)entry.virt_addr, entry.did_map);
+                break;
+            }
             printf("old data: %c, new data: %c, at %p, did_map: %d ", entry.old_data,
                    entry.new_data, (void *)entry.virt_addr, entry.did_map);
             break;
         case READ:
             printf(">> Action: READ, ");
-            printf("at %p, ", (void *)entry.virt_addr);
+            printf("at %p, did_map: %d ", (void *)entry.virt_addr, entry.did_map);
             break;
         case UNMAP:
-            printf(">> Action: UNMAP, ");
+            printf(">> Action: %s, ", entry.is_eviction ? "EVICT" : "UNMAP");
             printf("addr: %p, ", (void *)entry.virt_addr);
             break;
 
@@ -98,28 +243,84 @@ void print_exec_stack(struct ExecLog *log) {
     LOG_INFO("-----------------------------------------------------");
 }
 
-void roll_back_opearation(struct ExecLog *log) {
-    if (log->top == -1)
-        return;
-    struct ExecLogEntry entry = pop_to_exec_log(log);
+void print_exec_log_stats(struct ExecLog *log) {
+    size_t bytes = log->capacity * sizeof(struct ExecLogEntry) +
+                   log->page_capacity * PAGE_SIZE;
+    LOG_INFO("exec log: %zu / %zu entries, %zu / %zu saved frames, %zu dropped",
+             log->count, log->capacity, log->page_count, log->page_capacity,
+             log->dropped);
+    LOG_INFO("exec log memory: %zu bytes", bytes);
+}
+
+static void undo_entry(struct ExecLog *log, struct ExecLogEntry *entry) {
+    struct PageTable *pt = entry->proc->page_table;
+    size_t page_idx = entry->virt_addr / PAGE_SIZE;
+    TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_ROLLBACK, entry->proc->pid, page_idx,
+                INVALID_FRAME, entry->action);
 
-    switch (entry.action) {
+    switch (entry->action) {
     case WRITE:
-        // Triggering a write will cause a unnecessary log to get added
-        // Hence after every operation we need to pop a log entry
-        set_memory(entry.proc, entry.virt_addr, entry.old_data);
-        pop_to_exec_log(log);
-        if (entry.did_map) {
-            unmap_page_by_virtual_addr(entry.proc->page_table, entry.virt_addr);
-            pop_to_exec_log(log);
+        if (!entry->did_map) {
+            uintptr_t frame_addr = get_page_table_entry(pt, page_idx);
+            assert(frame_addr != 0 && "[FATAL] Rolling back a write to an unmapped page");
+            size_t offset = entry->virt_addr & (PAGE_SIZE - 1);
+            if (entry->length > 0) {
+                memcpy(&sim->phy_mem[frame_addr + offset],
+                       &log->pages[entry->page_slot * PAGE_SIZE + offset], entry->length);
+            } else {
+                sim->phy_mem[frame_addr + offset] = entry->old_data;
+            }
+            bump_frame_generation(frame_addr >> OFFSET_BITS);
+            if (sim->timeline) {
+                timeline_mark_dirty(sim->timeline, frame_addr >> OFFSET_BITS);
+            }
+            // a copy-on-write page that was taken over is shared again
+            if (entry->old_pte) {
+                protect_page(pt, page_idx, entry->old_pte);
+            }
+            break;
         }
+        // a private copy goes away, the entry logged before it shares the frame again
+        release_page(pt, page_idx, entry->was_evicted);
         break;
     case READ:
+        if (entry->did_map) {
+            release_page(pt, page_idx, entry->was_evicted);
+        }
         break;
     case UNMAP:
+        if (entry->page_slot != INVALID_PAGE_SLOT) {
+            restore_page(pt, page_idx, &log->pages[entry->page_slot * PAGE_SIZE],
+                         entry->old_pte);
+            // sharers logged before the eviction expect the frame back at its address
+            assert(!entry->is_eviction || get_pte(pt, page_idx) == entry->old_pte);
+        } else if (entry->old_pte && !is_pte_evicted(entry->old_pte)) {
+            share_page(pt, page_idx, entry->old_pte);
+        } else if (entry->was_evicted) {
+            mark_page_evicted(pt, page_idx);
+        }
         break;
 
     default:
         assert("Invalid action");
     }
 }
+
+// Undo the last operation along with the evictions it caused
+void roll_back_opearation(struct ExecLog *log) {
+    if (log->count == 0)
+        return;
+
+    struct ExecLogEntry entry = pop_to_exec_log(log);
+    undo_entry(log, &entry);
+
+    // the earlier pages of a range call follow its evictions
+    bool continues = entry.continues;
+    while (log->count > 0 && (continues || peek_to_exec_log(log).is_eviction)) {
+        entry = pop_to_exec_log(log);
+        undo_entry(log, &entry);
+        if (!entry.is_eviction) {
+            continues = entry.continues;
+        }
+    }
+}
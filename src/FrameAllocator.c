@@ -0,0 +1,384 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct FrameAllocator *create_frame_allocator(size_t frame_count) {
+    assert(frame_count > 1 && "Need at least one frame besides frame 0");
+
+    struct FrameAllocator *allocator =
+        (struct FrameAllocator *)malloc(sizeof(struct FrameAllocator));
+    allocator->free_stack = (size_t *)malloc(frame_count * sizeof(size_t));
+    assert(allocator->free_stack != NULL);
+    allocator->frame_count = frame_count;
+    allocator->free_count = 0;
+
+    // push in reverse so that frames are handed out in increasing order
+    for (size_t i = frame_count - 1; i >= 1; i--) {
+        allocator->free_stack[allocator->free_count++] = i;
+    }
+
+    allocator->sharer_capacity = 0;
+    allocator->sharers = NULL;
+    allocator->sharer_free = 0;
+    allocator->sharer_count = 0;
+    allocator->huge_pages = 0;
+    allocator->stats = (struct FrameAllocatorStats){0};
+    return allocator;
+}
+
+void destroy_frame_allocator(struct FrameAllocator *allocator) {
+    free(allocator->free_stack);
+    free(allocator->sharers);
+    free(allocator);
+}
+
+static void resize_sharers(struct FrameAllocator *allocator, size_t capacity) {
+    allocator->sharers = (struct FrameSharer *)realloc(
+        allocator->sharers, capacity * sizeof(struct FrameSharer));
+    assert(allocator->sharers != NULL);
+
+    // entry 0 is reserved, chain the new entries into the free list
+    size_t first = allocator->sharer_capacity ? allocator->sharer_capacity : 1;
+    for (size_t i = capacity; i-- > first;) {
+        allocator->sharers[i].next = allocator->sharer_free;
+        allocator->sharer_free = i;
+    }
+    allocator->sharer_capacity = capacity;
+}
+
+static size_t alloc_sharer(struct FrameAllocator *allocator) {
+    if (allocator->sharer_free == 0) {
+        resize_sharers(allocator, allocator->sharer_capacity ? allocator->sharer_capacity * 2
+                                                             : 64);
+    }
+    size_t idx = allocator->sharer_free;
+    allocator->sharer_free = allocator->sharers[idx].next;
+    allocator->sharer_count++;
+    return idx;
+}
+
+static void count_huge_allocation(struct FrameAllocator *allocator, size_t scan_steps) {
+    allocator->stats.huge_allocations++;
+    allocator->stats.scan_steps += scan_steps;
+    if (scan_steps > allocator->stats.max_scan) {
+        allocator->stats.max_scan = scan_steps;
+    }
+}
+
+static void free_sharer(struct FrameAllocator *allocator, size_t idx) {
+    allocator->sharers[idx].next = allocator->sharer_free;
+    allocator->sharer_free = idx;
+    allocator->sharer_count--;
+}
+
+// Lookup the global frame_db to check if a frame is unused
+bool is_frame_unused(size_t frame_idx) {
+    return !sim->frame_db[frame_idx].is_used;
+}
+
+static void take_frame(struct FrameAllocator *allocator, size_t frame_idx) {
+    assert(is_frame_unused(frame_idx) && "[FATAL] Used frame on the free list");
+    allocator->stats.allocations++;
+    sim->frame_db[frame_idx] = (struct FrameDBEntry){.is_used = true, .ref_count = 1};
+    // the caller fills the frame, views of its old contents are stale
+    bump_frame_generation(frame_idx);
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_idx);
+    }
+}
+
+// Take a free frame and mark it used, returns INVALID_FRAME if memory is full
+size_t alloc_frame(struct FrameAllocator *allocator) {
+    if (allocator->free_count == 0) {
+        return INVALID_FRAME;
+    }
+
+    size_t frame_idx = allocator->free_stack[--allocator->free_count];
+    take_frame(allocator, frame_idx);
+    return frame_idx;
+}
+
+/*
+ * Move a batch of free frames to the frame cache of the running CPU
+ * Cached frames are marked used so that the huge page scan skips them, only
+ * the CPU touches them until one is mapped. Needs mm_lock.
+ */
+static void refill_frame_cache(struct FrameAllocator *allocator) {
+    struct CPU *cpu = this_cpu;
+    while (cpu->cached_frames < CPU_FRAME_BATCH && allocator->free_count > 0) {
+        size_t frame_idx = allocator->free_stack[--allocator->free_count];
+        assert(is_frame_unused(frame_idx) && "[FATAL] Used frame on the free list");
+        sim->frame_db[frame_idx].is_used = true;
+        allocator->stats.allocations++;
+        cpu->frame_cache[cpu->cached_frames++] = frame_idx;
+    }
+}
+
+// Give the frames cached by cpu back to the free stack, needs mm_lock
+void return_cached_frames(struct FrameAllocator *allocator, struct CPU *cpu) {
+    while (cpu->cached_frames > 0) {
+        size_t frame_idx = cpu->frame_cache[--cpu->cached_frames];
+        sim->frame_db[frame_idx].is_used = false;
+        allocator->stats.allocations--;
+        allocator->free_stack[allocator->free_count++] = frame_idx;
+    }
+}
+
+/*
+ * Take a frame from the frame cache of the running CPU, which only needs the
+ * lock of the CPU while the cache is not empty
+ * An empty cache is refilled under mm_lock, with the world stopped the frames
+ * of every cache are free memory again. Returns INVALID_FRAME if memory is full.
+ */
+size_t alloc_cached_frame(struct FrameAllocator *allocator) {
+    struct CPU *cpu = this_cpu;
+    if (cpu->held == CPU_LOCK_WORLD && allocator->free_count == 0) {
+        for (size_t i = 0; i < sim->cpu_count; i++) {
+            return_cached_frames(allocator, &sim->cpus[i]);
+        }
+    }
+    if (cpu->cached_frames == 0 && cpu->held >= CPU_LOCK_MM) {
+        refill_frame_cache(allocator);
+    }
+    if (cpu->cached_frames == 0) {
+        return INVALID_FRAME;
+    }
+
+    // is_used stays set, the huge page scan reads it under mm_lock
+    size_t frame_idx = cpu->frame_cache[--cpu->cached_frames];
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    frame->ref_count = 1;
+    frame->proc = NULL;
+    frame->page_idx = 0;
+    bump_frame_generation(frame_idx);
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_idx);
+    }
+    return frame_idx;
+}
+
+/*
+ * Take the given frame off the free stack, false if it is not free
+ * Used by rollback to get an evicted frame back at its address, it was freed
+ * recently so the search from the top is short.
+ */
+bool alloc_frame_at(struct FrameAllocator *allocator, size_t frame_idx) {
+    if (frame_idx == 0 || frame_idx >= allocator->frame_count ||
+        !is_frame_unused(frame_idx)) {
+        return false;
+    }
+    size_t i = allocator->free_count;
+    while (i-- > 0 && allocator->free_stack[i] != frame_idx) {
+    }
+    assert(i < allocator->free_count && "[FATAL] Unused frame is not on the free list");
+    memmove(&allocator->free_stack[i], &allocator->free_stack[i + 1],
+            (allocator->free_count - i - 1) * sizeof(size_t));
+    allocator->free_count--;
+    take_frame(allocator, frame_idx);
+    return true;
+}
+
+void free_frame(struct FrameAllocator *allocator, size_t frame_idx) {
+    assert(frame_idx != 0 && frame_idx < allocator->frame_count);
+    assert(!is_frame_unused(frame_idx) && "[FATAL] Double free of a frame");
+
+    // mappings left over are the ones an eviction just removed
+    for (size_t i = sim->frame_db[frame_idx].sharers; i != 0;) {
+        size_t next = allocator->sharers[i].next;
+        free_sharer(allocator, i);
+        i = next;
+    }
+    sim->frame_db[frame_idx] = (struct FrameDBEntry){0};
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_idx);
+    }
+    allocator->free_stack[allocator->free_count++] = frame_idx;
+}
+
+/*
+ * Take a naturally aligned run of free frames for a page of the class
+ * The run is found by scanning the frame db and taken off the free stack in
+ * one pass, both O(frame_count), so huge page faults are slow like compaction.
+ * Returns INVALID_FRAME if memory is too fragmented.
+ */
+size_t alloc_frames(struct FrameAllocator *allocator, enum PageClass class) {
+    size_t count = page_class_pages(class);
+    if (allocator->free_count < count) {
+        return INVALID_FRAME;
+    }
+
+    // frame 0 is reserved, so the first run starts at count
+    size_t first = count;
+    size_t scanned = 0;
+    for (; first + count <= allocator->frame_count; first += count) {
+        size_t i = 0;
+        while (i < count && is_frame_unused(first + i)) {
+            i++;
+        }
+        scanned += i < count ? i + 1 : i;
+        if (i == count) {
+            break;
+        }
+    }
+    if (first + count > allocator->frame_count) {
+        return INVALID_FRAME;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < allocator->free_count; i++) {
+        size_t frame_idx = allocator->free_stack[i];
+        if (frame_idx < first || frame_idx >= first + count) {
+            allocator->free_stack[kept++] = frame_idx;
+        }
+    }
+    allocator->free_count = kept;
+
+    for (size_t i = 0; i < count; i++) {
+        sim->frame_db[first + i] = (struct FrameDBEntry){.is_used = true};
+        bump_frame_generation(first + i);
+    }
+    sim->frame_db[first].ref_count = 1;
+    sim->frame_db[first].page_class = class;
+    allocator->huge_pages++;
+    allocator->stats.allocations++;
+    count_huge_allocation(allocator, scanned);
+    return first;
+}
+
+// Give back a run of frames taken by alloc_frames
+void free_frames(struct FrameAllocator *allocator, size_t first_frame) {
+    assert(sim->frame_db[first_frame].page_class != PAGE_BASE &&
+           "[FATAL] Not a huge page");
+    size_t count = page_class_pages(sim->frame_db[first_frame].page_class);
+
+    // push in reverse so that the frames are handed out in increasing order
+    for (size_t i = count; i-- > 0;) {
+        sim->frame_db[first_frame + i] = (struct FrameDBEntry){0};
+        bump_frame_generation(first_frame + i);
+        if (sim->timeline) {
+            timeline_mark_dirty(sim->timeline, first_frame + i);
+        }
+        allocator->free_stack[allocator->free_count++] = first_frame + i;
+    }
+    allocator->huge_pages--;
+}
+
+size_t used_frame_count(struct FrameAllocator *allocator) {
+    // frame 0 is reserved and never on the free list, frames of the zero pool
+    // are free memory that is being zeroed and cached frames are not mapped yet
+    size_t pooled = sim->zero_pool ? sim->zero_pool->count : 0;
+    for (size_t i = 0; i < sim->cpu_count; i++) {
+        pooled += sim->cpus[i].cached_frames;
+    }
+    return allocator->frame_count - 1 - allocator->free_count - pooled;
+}
+
+// Page table entries mapping a frame, the reference of a shared segment has no proc
+size_t frame_mapping_count(size_t frame_idx) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    return frame->ref_count - (frame->is_shared && frame->proc == NULL);
+}
+
+/*
+ * Huge pages in use and their internal fragmentation, the memory of base pages
+ * inside them that was never touched
+ */
+void print_huge_page_stats() {
+    size_t pages[PAGE_CLASS_COUNT] = {0};
+    size_t untouched = 0, total = 0;
+
+    for (size_t i = 1; i < sim->frame_count; i++) {
+        enum PageClass class = sim->frame_db[i].page_class;
+        if (!sim->frame_db[i].is_used || class == PAGE_BASE) {
+            continue;
+        }
+        size_t count = page_class_pages(class);
+        pages[class]++;
+        total += count;
+        for (size_t j = 0; j < count; j++) {
+            untouched += !sim->frame_db[i + j].accessed;
+        }
+        i += count - 1;
+    }
+    if (total == 0) {
+        return;
+    }
+    LOG_INFO("huge pages: %zu, gigantic pages: %zu (%zu KB)", pages[PAGE_HUGE],
+             pages[PAGE_GIGANTIC], total * FRAME_SIZE / 1024);
+    LOG_INFO("internal fragmentation: %zu KB untouched (%.1f%%)",
+             untouched * FRAME_SIZE / 1024, 100.0 * untouched / total);
+}
+
+// Copy the free list and sharers of an allocator with the same frame count
+void copy_frame_allocator(struct FrameAllocator *dst, struct FrameAllocator *src) {
+    assert(dst->frame_count == src->frame_count);
+    memcpy(dst->free_stack, src->free_stack, src->free_count * sizeof(size_t));
+    dst->free_count = src->free_count;
+
+    if (dst->sharer_capacity != src->sharer_capacity) {
+        dst->sharers = (struct FrameSharer *)realloc(
+            dst->sharers, src->sharer_capacity * sizeof(struct FrameSharer));
+        dst->sharer_capacity = src->sharer_capacity;
+    }
+    if (src->sharer_capacity) {
+        memcpy(dst->sharers, src->sharers,
+               src->sharer_capacity * sizeof(struct FrameSharer));
+    }
+    dst->sharer_free = src->sharer_free;
+    dst->sharer_count = src->sharer_count;
+}
+
+// Map a used frame into one more page table entry
+void add_frame_mapping(struct FrameAllocator *allocator, size_t frame_idx,
+                       struct Proc *proc, size_t page_idx) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    assert(!is_frame_unused(frame_idx) && "[FATAL] Sharing an unused frame");
+
+    size_t idx = alloc_sharer(allocator);
+    allocator->sharers[idx] =
+        (struct FrameSharer){.proc = proc, .page_idx = page_idx, .next = frame->sharers};
+    frame->sharers = idx;
+    frame->ref_count++;
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_idx);
+    }
+}
+
+/*
+ * Drop one mapping of a frame, the first sharer takes over if the first
+ * mapping goes. Returns the number of mappings left, the frame is freed by
+ * the caller once it drops to 0.
+ */
+size_t remove_frame_mapping(struct FrameAllocator *allocator, size_t frame_idx,
+                            struct Proc *proc, size_t page_idx) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    assert(frame->ref_count > 0);
+
+    size_t *link = &frame->sharers;
+    if (frame->proc == proc && frame->page_idx == page_idx) {
+        if (frame->sharers != 0) {
+            struct FrameSharer *first = &allocator->sharers[frame->sharers];
+            frame->proc = first->proc;
+            frame->page_idx = first->page_idx;
+        } else {
+            link = NULL;
+        }
+    } else {
+        while (*link != 0 && (allocator->sharers[*link].proc != proc ||
+                              allocator->sharers[*link].page_idx != page_idx)) {
+            link = &allocator->sharers[*link].next;
+        }
+        assert(*link != 0 && "[FATAL] Frame is not mapped at this page");
+    }
+
+    if (link != NULL) {
+        size_t idx = *link;
+        *link = allocator->sharers[idx].next;
+        free_sharer(allocator, idx);
+    }
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_idx);
+    }
+    return --frame->ref_count;
+}
@@ -0,0 +1,650 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Headless mode runs a workload end to end without opening a window
+ * Nothing here depends on raylib, the loop is just fetch + perform.
+ * Operations come either from the synthetic workload generator or from a
+ * trace file streamed through mmap. With more than one CPU every CPU runs a
+ * workload of its own on a host thread.
+ */
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static struct Proc **create_procs(size_t count, const uint64_t *pids) {
+    struct Proc **procs = (struct Proc **)malloc(count * sizeof(struct Proc *));
+    for (size_t i = 0; i < count; i++) {
+        char name[32];
+        if (pids) {
+            snprintf(name, sizeof(name), "pid %lu", (unsigned long)pids[i]);
+        } else {
+            snprintf(name, sizeof(name), "proc %zu", i + 1);
+        }
+        procs[i] = create_proc(name);
+    }
+    return procs;
+}
+
+/*
+ * Pre-fork worker pool: the first process writes every page of the workload,
+ * the others are forked from it and start out sharing all of its frames
+ */
+static struct Proc **create_forked_procs(size_t count, size_t page_count,
+                                        struct SharedSegment *segment) {
+    struct Proc **procs = (struct Proc **)malloc(count * sizeof(struct Proc *));
+    procs[0] = create_proc("proc 1");
+    if (segment) {
+        attach_shared_segment(procs[0], segment, PAGE_SIZE);
+    }
+    for (size_t page = 0; page < page_count; page++) {
+        set_memory(procs[0], (page + 1) * PAGE_SIZE, 'p');
+    }
+    for (size_t i = 1; i < count; i++) {
+        procs[i] = fork_proc(procs[0]);
+    }
+    LOG_INFO("forked %zu procs from %s after touching %zu pages", count - 1,
+             procs[0]->name, page_count);
+    return procs;
+}
+
+static void destroy_procs(struct Proc **procs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        destroy_proc(procs[i]);
+    }
+    free(procs);
+}
+
+static void print_memory_state(struct Proc **procs, size_t proc_count) {
+    size_t used = used_frame_count(sim->frame_allocator);
+    size_t usable = sim->frame_count - 1;
+
+    LOG_INFO("frames used: %zu / %zu (%.1f%%)", used, usable, 100.0 * used / usable);
+    print_shared_frame_stats();
+    print_huge_page_stats();
+    for (size_t i = 0; i < proc_count; i++) {
+        struct PageTable *pt = procs[i]->page_table;
+        LOG_INFO("%s: mapped pages: %zu, page table: %zu bytes", procs[i]->name,
+                 pt->stats.mapped_pages, page_table_memory_usage(pt));
+        print_proc_counters(procs[i]);
+        if (pt->stats.huge_faults || pt->stats.huge_fallbacks) {
+            LOG_INFO("%s: huge page faults: %zu, fallbacks to smaller pages: %zu",
+                     procs[i]->name, pt->stats.huge_faults, pt->stats.huge_fallbacks);
+        }
+        if (pt->stats.cow_faults) {
+            LOG_INFO("%s: cow faults: %zu (copies: %zu)", procs[i]->name,
+                     pt->stats.cow_faults, pt->stats.cow_copies);
+        }
+        if (pt->stats.zero_faults) {
+            LOG_INFO("%s: zero page faults: %zu", procs[i]->name, pt->stats.zero_faults);
+        }
+        if (procs[i]->cpu->tlb) {
+            print_tlb_stats(procs[i]->cpu->tlb, procs[i]);
+        }
+    }
+}
+
+// Counter snapshots are taken every interval operations and after the last one
+static int run_operations(next_operation_fn next, void *source, struct Proc **procs,
+                          size_t proc_count, struct HeadlessConfig *config) {
+    size_t op_count[UNMAP + 1] = {0};
+    struct Operation op;
+    struct timespec start, end;
+
+    struct CounterExport *counters = NULL;
+    size_t interval = config->counters_interval;
+    if (config->counters_path) {
+        counters = open_counter_export(config->counters_path, procs, proc_count);
+        if (counters == NULL) {
+            return 1;
+        }
+    }
+
+    size_t total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (next(source, &op)) {
+        perform_operation(&op);
+        op_count[op.action]++;
+        if (counters && ++total % interval == 0) {
+            write_counter_snapshot(counters, total);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = elapsed_seconds(&start, &end);
+    total = op_count[READ] + op_count[WRITE] + op_count[UNMAP];
+
+    LOG_INFO("-------------------- Headless run ---------------------");
+    LOG_INFO("ops: %zu (reads: %zu, writes: %zu, unmaps: %zu)", total, op_count[READ],
+             op_count[WRITE], op_count[UNMAP]);
+    LOG_INFO("time: %.3f s, %.2f Mops/s", seconds, total / seconds / 1e6);
+    if (sim->replacement) {
+        print_replacement_stats(sim->replacement);
+    }
+    if (sim->swap) {
+        print_swap_stats(sim->swap);
+    }
+    if (sim->zero_pool) {
+        print_zero_pool_stats(sim->zero_pool);
+    }
+    print_memory_state(procs, proc_count);
+    if (this_cpu->exec_log) {
+        print_exec_log_stats(this_cpu->exec_log);
+    }
+    LOG_INFO("-------------------------------------------------------");
+
+    if (counters == NULL) {
+        return 0;
+    }
+    if (total % interval != 0) {
+        write_counter_snapshot(counters, total);
+    }
+    return close_counter_export(counters) ? 0 : 1;
+}
+
+static bool next_generated_operation(void *source, struct Operation *op) {
+    return next_workload_operation((struct Workload *)source, op);
+}
+
+/*
+ * Run the workload on all CPUs at once. Process i runs on CPU i % cpu_count,
+ * every CPU generates the operations of its own processes with its share of
+ * the operation count and a seed of its own.
+ */
+static int run_concurrent(struct HeadlessConfig *headless_config, struct Proc **procs,
+                          size_t proc_count) {
+    struct WorkloadConfig *config = &headless_config->workload;
+    bool populated = headless_config->prefork;
+
+    // the CPUs do not stop for snapshots, there is only the one at the end
+    struct CounterExport *counters = NULL;
+    if (headless_config->counters_path) {
+        counters = open_counter_export(headless_config->counters_path, procs, proc_count);
+        if (counters == NULL) {
+            return 1;
+        }
+    }
+
+    size_t cpu_count = sim->cpu_count;
+    struct Proc **cpu_procs = (struct Proc **)malloc(proc_count * sizeof(struct Proc *));
+    struct Workload **workloads =
+        (struct Workload **)malloc(cpu_count * sizeof(struct Workload *));
+
+    size_t first = 0;
+    for (size_t c = 0; c < cpu_count; c++) {
+        struct WorkloadConfig cpu_config = *config;
+        cpu_config.proc_count = 0;
+        for (size_t i = c; i < proc_count; i += cpu_count) {
+            migrate_proc(procs[i], &sim->cpus[c]);
+            cpu_procs[first + cpu_config.proc_count++] = procs[i];
+        }
+        cpu_config.op_count =
+            config->op_count / cpu_count + (c < config->op_count % cpu_count);
+        cpu_config.seed = config->seed + c;
+
+        workloads[c] = create_workload(cpu_config, &cpu_procs[first]);
+        if (populated) {
+            mark_workload_populated(workloads[c]);
+        }
+        first += cpu_config.proc_count;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_on_cpus(next_generated_operation, (void **)workloads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = elapsed_seconds(&start, &end);
+    size_t total = 0;
+    for (size_t c = 0; c < cpu_count; c++) {
+        total += sim->cpus[c].stats.ops;
+        destroy_workload(workloads[c]);
+    }
+    free(workloads);
+    free(cpu_procs);
+
+    LOG_INFO("-------------------- Headless run ---------------------");
+    LOG_INFO("ops: %zu on %zu cpus", total, cpu_count);
+    LOG_INFO("time: %.3f s, %.2f Mops/s", seconds, total / seconds / 1e6);
+    print_cpu_stats();
+    if (sim->replacement) {
+        print_replacement_stats(sim->replacement);
+    }
+    if (sim->zero_pool) {
+        print_zero_pool_stats(sim->zero_pool);
+    }
+    print_memory_state(procs, proc_count);
+    for (size_t c = 0; c < cpu_count; c++) {
+        if (sim->cpus[c].exec_log) {
+            LOG_INFO("cpu %zu:", c);
+            print_exec_log_stats(sim->cpus[c].exec_log);
+        }
+    }
+    LOG_INFO("-------------------------------------------------------");
+
+    if (counters == NULL) {
+        return 0;
+    }
+    write_counter_snapshot(counters, total);
+    return close_counter_export(counters) ? 0 : 1;
+}
+
+bool bisect_condition_from_str(const char *str, struct BisectCondition *cond) {
+    unsigned long long count, proc;
+    long long addr;
+    int value, end = 0;
+
+    *cond = (struct BisectCondition){0};
+    if (sscanf(str, "used:%llu%n", &count, &end) == 1 && str[end] == '\0') {
+        cond->kind = BISECT_USED_FRAMES;
+        cond->count = count;
+    } else if (sscanf(str, "faults:%llu%n", &count, &end) == 1 && str[end] == '\0') {
+        cond->kind = BISECT_FAULTS;
+        cond->count = count;
+    } else if (sscanf(str, "mapped:%llu:%lli%n", &proc, &addr, &end) == 2 &&
+               str[end] == '\0') {
+        cond->kind = BISECT_MAPPED;
+        cond->proc_idx = proc;
+        cond->virt_addr = addr;
+    } else if (sscanf(str, "byte:%llu:%lli=%i%n", &proc, &addr, &value, &end) == 3 &&
+               str[end] == '\0' && value >= 0 && value <= 0xFF) {
+        cond->kind = BISECT_BYTE;
+        cond->proc_idx = proc;
+        cond->virt_addr = addr;
+        cond->value = value;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool condition_holds(struct BisectCondition *cond, struct Proc **procs) {
+    struct Proc *proc = procs[cond->proc_idx];
+
+    switch (cond->kind) {
+    case BISECT_USED_FRAMES:
+        return used_frame_count(sim->frame_allocator) >= cond->count;
+    case BISECT_FAULTS:
+        return sim->replacement && sim->replacement->stats.faults >= cond->count;
+    case BISECT_MAPPED:
+        return get_page_table_entry(proc->page_table, cond->virt_addr / PAGE_SIZE) != 0;
+    case BISECT_BYTE:
+        return get_page_table_entry(proc->page_table, cond->virt_addr / PAGE_SIZE) != 0 &&
+               inspect_memory(proc, cond->virt_addr) == cond->value;
+
+    default:
+        assert("Invalid bisect condition");
+    }
+    return false;
+}
+
+/*
+ * Run every operation through a timeline, then binary search the first
+ * operation after which the condition holds. Each probe is a seek, so only
+ * the gap from the closest snapshot is replayed.
+ */
+static int bisect_operations(next_operation_fn next, void *source, struct Proc **procs,
+                             size_t proc_count, struct HeadlessConfig *config) {
+    struct BisectCondition *cond = &config->bisect_condition;
+    if ((cond->kind == BISECT_MAPPED || cond->kind == BISECT_BYTE) &&
+        cond->proc_idx >= proc_count) {
+        LOG_ERROR("No process %zu to bisect on, the run has %zu", cond->proc_idx,
+                  proc_count);
+        return 1;
+    }
+
+    sim->timeline = create_timeline(procs, proc_count, config->checkpoint_interval);
+    struct Operation op;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (next(source, &op)) {
+        timeline_append(sim->timeline, &op);
+        timeline_step(sim->timeline);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    LOG_INFO("recorded %zu ops in %.3f s", sim->timeline->op_count,
+             elapsed_seconds(&start, &end));
+
+    int status = 0;
+    size_t lo = 0;
+    size_t hi = sim->timeline->op_count;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!condition_holds(cond, procs)) {
+        LOG_INFO("condition does not hold after the last operation");
+        status = 1;
+    } else {
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            timeline_seek(sim->timeline, mid);
+            if (condition_holds(cond, procs)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        timeline_seek(sim->timeline, lo);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (status == 0 && lo == 0) {
+        LOG_INFO("condition already holds before the first operation");
+    } else if (status == 0) {
+        LOG_INFO("condition first holds after operation %zu:", lo - 1);
+        print_operation(&sim->timeline->ops[lo - 1]);
+    }
+    LOG_INFO("bisect time: %.3f ms", elapsed_seconds(&start, &end) * 1e3);
+    print_timeline_stats(sim->timeline);
+
+    destroy_timeline(sim->timeline);
+    sim->timeline = NULL;
+    return status;
+}
+
+// Let faults map huge pages of the configured size, false if it is not supported
+static bool set_fault_class(struct HeadlessConfig *config, struct Proc **procs,
+                            size_t proc_count) {
+    if (config->huge_page_size == 0) {
+        return true;
+    }
+
+    enum PageClass class;
+    if (!page_class_from_size(config->huge_page_size, &class) || class == PAGE_BASE) {
+        LOG_ERROR("Huge pages of %zu bytes are not supported with %zu byte pages",
+                  config->huge_page_size, PAGE_SIZE);
+        return false;
+    }
+    // snapshots only hold base pages
+    if (config->bisect) {
+        LOG_ERROR("--huge-page can not be combined with --bisect");
+        return false;
+    }
+    for (size_t i = 0; i < proc_count; i++) {
+        procs[i]->page_table->fault_class = class;
+    }
+    return true;
+}
+
+/*
+ * Run the operations, or bisect them when a condition was given. The miss-ratio
+ * curve is taken from the accesses of the run itself.
+ */
+static int run_source(struct HeadlessConfig *config, next_operation_fn next,
+                      void *source, struct Proc **procs, size_t proc_count) {
+    if (!set_fault_class(config, procs, proc_count)) {
+        return 1;
+    }
+
+    if (config->bisect) {
+        return bisect_operations(next, source, procs, proc_count, config);
+    }
+    if (config->mrc) {
+        sim->stack_distance = create_stack_distance(config->mrc_sample);
+    }
+    if (config->heatmap_path) {
+        sim->heatmap = create_heatmap(sim->frame_count, config->heat_half_life);
+    }
+    int status = run_operations(next, source, procs, proc_count, config);
+    if (sim->heatmap) {
+        if (status == 0 && !write_heatmap(sim->heatmap, config->heatmap_path)) {
+            status = 1;
+        }
+        destroy_heatmap(sim->heatmap);
+        sim->heatmap = NULL;
+    }
+    if (sim->stack_distance) {
+        size_t frames = sim->frame_count - 1;
+        LOG_INFO("stack distance: lru with %zu frames faults %zu times", frames,
+                 stack_distance_misses(sim->stack_distance, frames));
+        print_miss_ratio_curve(sim->stack_distance);
+        destroy_stack_distance(sim->stack_distance);
+        sim->stack_distance = NULL;
+    }
+    return status;
+}
+
+static bool next_trace_operation(void *source, struct Operation *op) {
+    return trace_reader_next((struct TraceReader *)source, op);
+}
+
+static bool next_text_trace_operation(void *source, struct Operation *op) {
+    return text_trace_next((struct TextTraceReader *)source, op);
+}
+
+static int replay_trace(struct HeadlessConfig *config) {
+    const char *path = config->trace_path;
+    struct TraceReader *reader = trace_reader_open(path);
+    if (reader == NULL) {
+        return 1;
+    }
+
+    size_t proc_count = reader->header.proc_count;
+    struct Proc **procs = create_procs(proc_count, reader->pids);
+    for (size_t i = 0; i < proc_count; i++) {
+        trace_reader_bind_proc(reader, i, procs[i]);
+    }
+
+    LOG_INFO("trace: %s, %lu ops, %zu procs", path,
+             (unsigned long)reader->header.op_count, proc_count);
+    int status = run_source(config, next_trace_operation, reader, procs, proc_count);
+    if (!trace_reader_verify(reader)) {
+        status = 1;
+    }
+    trace_reader_close(reader);
+    destroy_procs(procs, proc_count);
+    return status;
+}
+
+// Write the operations to a trace file instead of running them
+static int record_trace(next_operation_fn next, void *source, struct Proc **procs,
+                        size_t proc_count, const char *path) {
+    uint64_t *pids = (uint64_t *)malloc(proc_count * sizeof(uint64_t));
+    for (size_t i = 0; i < proc_count; i++) {
+        pids[i] = procs[i]->pid;
+    }
+
+    struct TraceWriter *writer = trace_writer_open(path, pids, proc_count);
+    free(pids);
+    if (writer == NULL) {
+        return 1;
+    }
+
+    struct Operation op;
+    bool ok = true;
+    while (ok && next(source, &op)) {
+        size_t proc_idx = 0;
+        while (procs[proc_idx] != op.proc) {
+            proc_idx++;
+        }
+        ok = trace_writer_append(writer, proc_idx, &op);
+    }
+
+    uint64_t op_count = writer->header.op_count;
+    ok = trace_writer_close(writer) && ok;
+    if (ok) {
+        LOG_INFO("recorded %lu ops to %s", (unsigned long)op_count, path);
+    }
+    return ok ? 0 : 1;
+}
+
+// Replay (or convert) a text trace of a single process
+static int import_text_trace(struct HeadlessConfig *config) {
+    const char *path = config->text_trace_path;
+    const char *record_path = config->record_path;
+    struct Proc **procs = create_procs(1, NULL);
+    struct TextTraceReader *reader = text_trace_open(path, procs[0]);
+    if (reader == NULL) {
+        destroy_procs(procs, 1);
+        return 1;
+    }
+
+    int status = 0;
+    if (record_path) {
+        status = record_trace(next_text_trace_operation, reader, procs, 1, record_path);
+    } else {
+        LOG_INFO("text trace: %s", path);
+        status = run_source(config, next_text_trace_operation, reader, procs, 1);
+    }
+
+    text_trace_close(reader);
+    destroy_procs(procs, 1);
+    return status;
+}
+
+/*
+ * Sweeps replay a trace file, a workload or text trace is recorded to a
+ * temporary one first and removed afterwards
+ */
+static int sweep_source(struct HeadlessConfig *config) {
+    if (config->bisect || config->record_path || config->prefork ||
+        config->shared_pages || config->huge_page_size || config->mrc ||
+        config->counters_path || config->heatmap_path) {
+        LOG_ERROR("a sweep can not be combined with --bisect, --record, --fork, "
+                  "--shared, --huge-page, --mrc, --counters or --heatmap");
+        return 1;
+    }
+    if (config->trace_path) {
+        return run_sweep(&config->sweep_config, config->trace_path);
+    }
+
+    char path[] = "/tmp/vm-sweep-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        LOG_ERROR("Failed to create a temporary trace");
+        return 1;
+    }
+    close(fd);
+
+    struct HeadlessConfig record = *config;
+    record.sweep = false;
+    record.record_path = path;
+    int status = run_headless(&record);
+    if (status == 0) {
+        status = run_sweep(&config->sweep_config, path);
+    }
+    unlink(path);
+    return status;
+}
+
+int run_headless(struct HeadlessConfig *config) {
+    struct WorkloadConfig *workload_config = &config->workload;
+
+    // swap slots are not part of the exec log or snapshots, and only one CPU swaps
+    if (sim->swap && (config->sweep || sim->cpu_count > 1 || config->record_path ||
+                      config->bisect || this_cpu->exec_log)) {
+        LOG_ERROR("--swap can not be combined with a sweep, --cpus, --record, --bisect "
+                  "or --log");
+        return 1;
+    }
+    // snapshots do not know which used frames belong to the pool
+    if (sim->zero_pool && config->bisect) {
+        LOG_ERROR("--zero-pool can not be combined with --bisect");
+        return 1;
+    }
+    if (config->sweep) {
+        return sweep_source(config);
+    }
+
+    // traces interleave the processes in one order, which concurrent CPUs can not keep
+    if (sim->cpu_count > 1 && (config->trace_path || config->text_trace_path ||
+                               config->record_path || config->bisect)) {
+        LOG_ERROR("--cpus can not be combined with --trace, --lackey, --record or "
+                  "--bisect");
+        return 1;
+    }
+    if (config->counters_path && (config->record_path || config->bisect)) {
+        LOG_ERROR("--counters can not be combined with --record or --bisect");
+        return 1;
+    }
+    // the analysis keeps one stack for the whole run
+    if (config->mrc && (sim->cpu_count > 1 || config->record_path || config->bisect)) {
+        LOG_ERROR("--mrc can not be combined with --cpus, --record or --bisect");
+        return 1;
+    }
+    if (config->heatmap_path &&
+        (sim->cpu_count > 1 || config->record_path || config->bisect)) {
+        LOG_ERROR("--heatmap can not be combined with --cpus, --record or --bisect");
+        return 1;
+    }
+    if (sim->cpu_count > workload_config->proc_count) {
+        LOG_ERROR("%zu cpus need at least as many processes, got %zu", sim->cpu_count,
+                  workload_config->proc_count);
+        return 1;
+    }
+
+    if (config->trace_path) {
+        return replay_trace(config);
+    }
+    if (config->text_trace_path) {
+        return import_text_trace(config);
+    }
+
+    if (config->prefork && (config->record_path || config->bisect)) {
+        LOG_ERROR("--fork can not be combined with --record or --bisect");
+        return 1;
+    }
+    if (config->shared_pages && config->record_path) {
+        LOG_ERROR("--shared can not be combined with --record");
+        return 1;
+    }
+
+    // the first pages of every process are one segment, like a shared library
+    struct SharedSegment *segment = NULL;
+    if (config->shared_pages) {
+        segment = create_shared_segment("shm", config->shared_pages);
+        if (segment == NULL) {
+            return 1;
+        }
+    }
+
+    size_t proc_count = workload_config->proc_count;
+    struct Proc **procs = NULL;
+    if (config->prefork) {
+        procs = create_forked_procs(proc_count, workload_config->page_count, segment);
+    } else {
+        procs = create_procs(proc_count, NULL);
+        for (size_t i = 0; segment && i < proc_count; i++) {
+            attach_shared_segment(procs[i], segment, PAGE_SIZE);
+        }
+    }
+    if (sim->cpu_count > 1) {
+        int status = 1;
+        if (set_fault_class(config, procs, proc_count)) {
+            status = run_concurrent(config, procs, proc_count);
+        }
+        if (segment) {
+            destroy_shared_segment(segment);
+        }
+        destroy_procs(procs, proc_count);
+        return status;
+    }
+
+    struct Workload *workload = create_workload(*workload_config, procs);
+    if (config->prefork) {
+        mark_workload_populated(workload);
+    }
+    if (config->record_path) {
+        int status = record_trace(next_generated_operation, workload, procs, proc_count,
+                                  config->record_path);
+        destroy_workload(workload);
+        destroy_procs(procs, proc_count);
+        return status;
+    }
+
+    LOG_INFO("workload: %s, %zu ops over %zu pages, %zu procs, %u%% writes",
+             workload_kind_to_str(workload_config->kind), workload_config->op_count,
+             workload_config->page_count, proc_count, workload_config->write_percent);
+
+    int status = run_source(config, next_generated_operation, workload, procs, proc_count);
+
+    destroy_workload(workload);
+    if (segment) {
+        destroy_shared_segment(segment);
+    }
+    destroy_procs(procs, proc_count);
+    return status;
+}
@@ -0,0 +1,208 @@
+#include <math.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Access heat
+ * Heats are only ever compared or printed, both divide the scores by the
+ * weight at that time. Ranges of PT_ENTRIES_PER_NODE pages whose heat is
+ * summed up in the CSV are the candidates for huge pages.
+ */
+
+static inline uint64_t page_key(size_t pid, size_t page_idx) {
+    return ((uint64_t)pid << 40 | page_idx) + 1;
+}
+
+static inline size_t page_slot(struct Heatmap *hm, uint64_t key) {
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (hm->page_capacity - 1);
+    while (hm->page_keys[slot] != 0 && hm->page_keys[slot] != key) {
+        slot = (slot + 1) & (hm->page_capacity - 1);
+    }
+    return slot;
+}
+
+// half_life 0 takes the default
+struct Heatmap *create_heatmap(size_t frame_count, size_t half_life) {
+    struct Heatmap *hm = (struct Heatmap *)calloc(1, sizeof(struct Heatmap));
+    hm->half_life = half_life ? half_life : DEFAULT_HEAT_HALF_LIFE;
+    hm->weight = 1;
+    hm->step = exp2(1.0 / hm->half_life);
+    hm->frame_count = frame_count;
+    hm->frame_scores = (double *)calloc(frame_count, sizeof(double));
+    hm->page_capacity = HEATMAP_INITIAL_CAPACITY;
+    hm->page_keys = (uint64_t *)calloc(hm->page_capacity, sizeof(uint64_t));
+    hm->page_scores = (double *)calloc(hm->page_capacity, sizeof(double));
+    return hm;
+}
+
+void destroy_heatmap(struct Heatmap *hm) {
+    free(hm->frame_scores);
+    free(hm->page_keys);
+    free(hm->page_scores);
+    free(hm);
+}
+
+static void grow_pages(struct Heatmap *hm) {
+    size_t old_capacity = hm->page_capacity;
+    uint64_t *old_keys = hm->page_keys;
+    double *old_scores = hm->page_scores;
+
+    hm->page_capacity *= 2;
+    hm->page_keys = (uint64_t *)calloc(hm->page_capacity, sizeof(uint64_t));
+    hm->page_scores = (double *)calloc(hm->page_capacity, sizeof(double));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != 0) {
+            size_t slot = page_slot(hm, old_keys[i]);
+            hm->page_keys[slot] = old_keys[i];
+            hm->page_scores[slot] = old_scores[i];
+        }
+    }
+    free(old_keys);
+    free(old_scores);
+}
+
+// Scale every score and the weight down by 2^HEAT_RESCALE_EXPONENT
+static void rescale(struct Heatmap *hm) {
+    for (size_t i = 0; i < hm->frame_count; i++) {
+        hm->frame_scores[i] = ldexp(hm->frame_scores[i], -HEAT_RESCALE_EXPONENT);
+    }
+    for (size_t i = 0; i < hm->page_capacity; i++) {
+        hm->page_scores[i] = ldexp(hm->page_scores[i], -HEAT_RESCALE_EXPONENT);
+    }
+    hm->clock = 0;
+    hm->weight = 1;
+}
+
+void heatmap_access(struct Heatmap *hm, size_t pid, size_t page_idx, size_t frame_idx) {
+    if (hm->clock == (uint64_t)HEAT_RESCALE_EXPONENT * hm->half_life) {
+        rescale(hm);
+    }
+    if ((hm->page_count + 1) * 2 > hm->page_capacity) {
+        grow_pages(hm);
+    }
+
+    hm->frame_scores[frame_idx] += hm->weight;
+    uint64_t key = page_key(pid, page_idx);
+    size_t slot = page_slot(hm, key);
+    if (hm->page_keys[slot] == 0) {
+        hm->page_keys[slot] = key;
+        hm->page_count++;
+    }
+    hm->page_scores[slot] += hm->weight;
+
+    hm->clock++;
+    hm->weight *= hm->step;
+    hm->accesses++;
+}
+
+// Decayed number of accesses to the frame
+double heatmap_frame_heat(struct Heatmap *hm, size_t frame_idx) {
+    return hm->frame_scores[frame_idx] / hm->weight;
+}
+
+// Calls fn for every page that was accessed, in no particular order
+void for_each_page_heat(struct Heatmap *hm,
+                        void (*fn)(size_t pid, size_t page_idx, double heat, void *arg),
+                        void *arg) {
+    for (size_t i = 0; i < hm->page_capacity; i++) {
+        if (hm->page_keys[i] != 0) {
+            uint64_t key = hm->page_keys[i] - 1;
+            fn(key >> 40, key & ((1ull << 40) - 1), hm->page_scores[i] / hm->weight, arg);
+        }
+    }
+}
+
+struct PageHeat {
+    uint64_t key;
+    double heat;
+};
+
+static int compare_page_key(const void *a, const void *b) {
+    uint64_t ka = ((const struct PageHeat *)a)->key;
+    uint64_t kb = ((const struct PageHeat *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static int compare_heat_desc(const void *a, const void *b) {
+    double ha = *(const double *)a;
+    double hb = *(const double *)b;
+    return (ha < hb) - (ha > hb);
+}
+
+// Share of the heat in the hottest tenth of the pages, the headroom for tiering
+static double hottest_tenth_share(struct PageHeat *pages, size_t count) {
+    double *heats = (double *)malloc(count * sizeof(double));
+    double total = 0;
+    for (size_t i = 0; i < count; i++) {
+        heats[i] = pages[i].heat;
+        total += heats[i];
+    }
+    qsort(heats, count, sizeof(double), compare_heat_desc);
+
+    double hot = 0;
+    for (size_t i = 0; i < (count + 9) / 10; i++) {
+        hot += heats[i];
+    }
+    free(heats);
+    return total > 0 ? hot / total : 0;
+}
+
+/*
+ * Write the heat as CSV: kind,pid,idx,heat with a line for every frame and
+ * page that was accessed, and one per huge page range with the sum of its
+ * pages, idx being the first page of the range
+ */
+bool write_heatmap(struct Heatmap *hm, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        LOG_ERROR("Failed to open %s for the heatmap", path);
+        return false;
+    }
+
+    fprintf(file, "kind,pid,idx,heat\n");
+    for (size_t i = 0; i < hm->frame_count; i++) {
+        if (hm->frame_scores[i] != 0) {
+            fprintf(file, "frame,,%zu,%.3f\n", i, heatmap_frame_heat(hm, i));
+        }
+    }
+
+    // pages in order of process and index, so the ranges are consecutive
+    struct PageHeat *pages =
+        (struct PageHeat *)malloc((hm->page_count + 1) * sizeof(struct PageHeat));
+    size_t count = 0;
+    for (size_t i = 0; i < hm->page_capacity; i++) {
+        if (hm->page_keys[i] != 0) {
+            pages[count++] =
+                (struct PageHeat){hm->page_keys[i] - 1, hm->page_scores[i] / hm->weight};
+        }
+    }
+    qsort(pages, count, sizeof(struct PageHeat), compare_page_key);
+
+    uint64_t range_mask = ~(uint64_t)(PT_ENTRIES_PER_NODE - 1);
+    double range_heat = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t key = pages[i].key;
+        fprintf(file, "page,%llu,%llu,%.3f\n", (unsigned long long)(key >> 40),
+                (unsigned long long)(key & ((1ull << 40) - 1)), pages[i].heat);
+        range_heat += pages[i].heat;
+        if (i + 1 == count || (pages[i + 1].key & range_mask) != (key & range_mask)) {
+            fprintf(file, "huge,%llu,%llu,%.3f\n", (unsigned long long)(key >> 40),
+                    (unsigned long long)(key & range_mask & ((1ull << 40) - 1)),
+                    range_heat);
+            range_heat = 0;
+        }
+    }
+
+    LOG_INFO("heatmap: %zu pages touched, the hottest 10%% hold %.1f%% of the heat",
+             count, 100 * hottest_tenth_share(pages, count));
+    free(pages);
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        LOG_ERROR("Failed to write the heatmap");
+    }
+    return ok;
+}
@@ -4,66 +4,655 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-struct PageTable *create_page_table(size_t size) {
+// index into the table at given level (0: PML4, ..., PT_LEVELS - 1: PT)
+static inline size_t level_idx(size_t page_idx, int level) {
+    int shift = (PT_LEVELS - 1 - level) * PT_INDEX_BITS;
+    return (page_idx >> shift) & (PT_ENTRIES_PER_NODE - 1);
+}
+
+static struct PageTableNode *create_page_table_node(struct PageTable *pt) {
+    struct PageTableNode *node =
+        (struct PageTableNode *)calloc(1, sizeof(struct PageTableNode));
+    assert(node != NULL);
+    pt->stats.node_count++;
+    return node;
+}
+
+// a directory entry with a page class is a huge page, not a pointer to a table
+static inline bool is_table_pointer(uintptr_t entry, int level) {
+    return level < PT_LEVELS - 1 && entry != 0 && pte_page_class(entry) == PAGE_BASE;
+}
+
+// The counter is shared by the machine, accessed and dirty are set under the CPU's
+// own lock only
+static inline uint64_t next_page_table_version() {
+    return __atomic_fetch_add(&sim->page_table_version, 1, __ATOMIC_RELAXED);
+}
+
+// level whose entries map pages of the class
+static inline int class_level(enum PageClass class) {
+    return PT_LEVELS - 1 - (int)class;
+}
+
+static void destroy_page_table_node(struct PageTable *pt, struct PageTableNode *node,
+                                    int level) {
+    for (size_t i = 0; i < PT_ENTRIES_PER_NODE; i++) {
+        if (is_table_pointer(node->entries[i], level)) {
+            destroy_page_table_node(pt, (struct PageTableNode *)node->entries[i],
+                                    level + 1);
+        }
+    }
+    pt->stats.node_count--;
+    free(node);
+}
+
+struct PageTable *create_page_table() {
     struct PageTable *pt = (struct PageTable *)malloc(sizeof(struct PageTable));
-    pt->entries = (uintptr_t *)malloc(size * sizeof(uintptr_t));
-    pt->size = size;
-    pt->curr = 0;
-    memset(pt->entries, 0, size * sizeof(uintptr_t));
+    pt->stats = (struct PageTableStats){0};
+    pt->size = MAX_PAGE_COUNT;
+    pt->owner = NULL;
+    pt->version = next_page_table_version();
+    pt->fault_class = PAGE_BASE;
+    pt->root = create_page_table_node(pt);
     return pt;
 }
 
 void destroy_page_table(struct PageTable *pt) {
-    free(pt->entries);
+    destroy_page_table_node(pt, pt->root, 0);
     free(pt);
 }
 
-// Lookup the global frame_db to check if a frame is unused
-bool is_frame_unused(size_t frame_idx) {
-    return !frame_db[frame_idx].is_used;
+/*
+ * Walk the radix tree down to the table at target level for page_idx
+ * Missing directory levels are allocated only if alloc is set, otherwise NULL
+ * is returned. NULL is also returned if a huge page maps the range above the
+ * target level. If path is given, it is filled with the tables visited per level.
+ */
+static struct PageTableNode *walk_page_table(struct PageTable *pt, size_t page_idx,
+                                             int target, bool alloc,
+                                             struct PageTableNode **path) {
+    struct PageTableNode *node = pt->root;
+    pt->stats.walks++;
+
+    for (int level = 0; level < target; level++) {
+        pt->stats.walk_levels++;
+        if (path) {
+            path[level] = node;
+        }
+
+        size_t idx = level_idx(page_idx, level);
+        if (node->entries[idx] == 0) {
+            if (!alloc) {
+                return NULL;
+            }
+            node->entries[idx] = (uintptr_t)create_page_table_node(pt);
+            node->used++;
+        } else if (!is_table_pointer(node->entries[idx], level)) {
+            assert(!alloc && "[FATAL] Mapping a page inside a huge page");
+            return NULL;
+        }
+        node = (struct PageTableNode *)node->entries[idx];
+    }
+
+    pt->stats.walk_levels++;
+    if (path) {
+        path[target] = node;
+    }
+    return node;
+}
+
+static inline bool is_entry_present(uintptr_t entry) {
+    return (entry & PTE_PRESENT) != 0;
+}
+
+/*
+ * Entry of the base page, a page inside a huge page gets the entry of the
+ * huge page moved to the frame backing it, with the page class kept in the flags
+ */
+static uintptr_t get_raw_entry(struct PageTable *pt, size_t page_idx) {
+    if (page_idx >= pt->size) {
+        return 0;
+    }
+
+    struct PageTableNode *node = pt->root;
+    pt->stats.walks++;
+    for (int level = 0;; level++) {
+        pt->stats.walk_levels++;
+        uintptr_t entry = node->entries[level_idx(page_idx, level)];
+        if (level == PT_LEVELS - 1 || entry == 0) {
+            return entry;
+        }
+        if (!is_table_pointer(entry, level)) {
+            size_t offset = page_idx & (page_class_pages(pte_page_class(entry)) - 1);
+            return entry + offset * FRAME_SIZE;
+        }
+        node = (struct PageTableNode *)entry;
+    }
+}
+
+// Returns the frame address mapped at page_idx, 0 if page is not mapped
+uintptr_t get_page_table_entry(struct PageTable *pt, size_t page_idx) {
+    uintptr_t entry = get_raw_entry(pt, page_idx);
+    return is_entry_present(entry) ? entry & ~PTE_FLAGS_MASK : 0;
+}
+
+// Same as get_page_table_entry but keeps the PTE flags
+uintptr_t get_pte(struct PageTable *pt, size_t page_idx) {
+    uintptr_t entry = get_raw_entry(pt, page_idx);
+    return is_entry_present(entry) ? entry : 0;
+}
+
+// Check if the page was mapped before its frame got reclaimed
+bool is_page_evicted(struct PageTable *pt, size_t page_idx) {
+    return is_pte_evicted(get_raw_entry(pt, page_idx));
+}
+
+static void set_entry_at_level(struct PageTable *pt, size_t page_idx, int level,
+                               uintptr_t entry) {
+    assert(page_idx < pt->size && "[FATAL] Page index out of range");
+    assert(entry != 0);
+
+    struct PageTableNode *node = walk_page_table(pt, page_idx, level, true, NULL);
+    size_t idx = level_idx(page_idx, level);
+    uintptr_t old_entry = node->entries[idx];
+    assert((old_entry == 0 || !is_table_pointer(old_entry, level)) &&
+           "[FATAL] Huge page over mapped pages");
+    if (old_entry == 0) {
+        node->used++;
+    }
+    size_t pages = page_class_pages(pte_page_class(entry));
+    pt->stats.mapped_pages += is_entry_present(entry) * pages;
+    pt->stats.mapped_pages -= is_entry_present(old_entry) * pages;
+    node->entries[idx] = entry;
+    pt->version = next_page_table_version();
+}
+
+static void set_page_table_entry(struct PageTable *pt, size_t page_idx,
+                                 uintptr_t entry) {
+    set_entry_at_level(pt, page_idx, PT_LEVELS - 1, entry);
+}
+
+// Clears the entry and releases every table that became empty on the way up
+static uintptr_t clear_entry_at_level(struct PageTable *pt, size_t page_idx, int level) {
+    struct PageTableNode *path[PT_LEVELS];
+    if (page_idx >= pt->size || walk_page_table(pt, page_idx, level, false, path) == NULL) {
+        return 0;
+    }
+
+    size_t idx = level_idx(page_idx, level);
+    uintptr_t entry = path[level]->entries[idx];
+    if (entry == 0) {
+        return 0;
+    }
+    path[level]->entries[idx] = 0;
+    path[level]->used--;
+    pt->stats.mapped_pages -=
+        is_entry_present(entry) * page_class_pages(pte_page_class(entry));
+    pt->version = next_page_table_version();
+
+    // never free the root, it lives as long as the page table
+    for (; level > 0; level--) {
+        if (path[level]->used != 0) {
+            break;
+        }
+        free(path[level]);
+        pt->stats.node_count--;
+        path[level - 1]->entries[level_idx(page_idx, level - 1)] = 0;
+        path[level - 1]->used--;
+    }
+    return entry;
+}
+
+static uintptr_t clear_page_table_entry(struct PageTable *pt, size_t page_idx) {
+    return clear_entry_at_level(pt, page_idx, PT_LEVELS - 1);
+}
+
+static void for_each_in_node(struct PageTableNode *node, int level, size_t prefix,
+                             bool present_only, void (*fn)(size_t, uintptr_t, void *),
+                             void *arg) {
+    for (size_t i = 0; i < PT_ENTRIES_PER_NODE && node->used != 0; i++) {
+        if (node->entries[i] == 0) {
+            continue;
+        }
+        size_t page_idx = (prefix << PT_INDEX_BITS) | i;
+        if (is_table_pointer(node->entries[i], level)) {
+            for_each_in_node((struct PageTableNode *)node->entries[i], level + 1,
+                             page_idx, present_only, fn, arg);
+        } else if (!present_only || is_entry_present(node->entries[i])) {
+            // a huge page is visited once, at its first base page
+            fn(page_idx << ((PT_LEVELS - 1 - level) * PT_INDEX_BITS), node->entries[i],
+               arg);
+        }
+    }
+}
+
+// Calls fn for every mapped page in increasing page index order, huge pages once
+void for_each_mapped_page(struct PageTable *pt,
+                          void (*fn)(size_t page_idx, uintptr_t entry, void *arg),
+                          void *arg) {
+    for_each_in_node(pt->root, 0, 0, true, fn, arg);
+}
+
+// Same as for_each_mapped_page but also visits evicted pages
+void for_each_page_table_entry(struct PageTable *pt,
+                               void (*fn)(size_t page_idx, uintptr_t entry, void *arg),
+                               void *arg) {
+    for_each_in_node(pt->root, 0, 0, false, fn, arg);
+}
+
+// Drop every entry without touching the frames they point to
+void clear_page_table(struct PageTable *pt) {
+    destroy_page_table_node(pt, pt->root, 0);
+    pt->root = create_page_table_node(pt);
+    pt->stats.mapped_pages = 0;
+    pt->version = next_page_table_version();
+}
+
+// Set a raw entry as is, used to reload a page table from a snapshot
+void load_page_table_entry(struct PageTable *pt, size_t page_idx, uintptr_t entry) {
+    set_page_table_entry(pt, page_idx, entry);
+}
+
+// Bytes used by the tables of the radix tree
+size_t page_table_memory_usage(struct PageTable *pt) {
+    return pt->stats.node_count * sizeof(struct PageTableNode);
+}
+
+static void print_page_table_entry(size_t page_idx, uintptr_t entry, void *arg) {
+    (void)arg;
+    printf("%#14zx -> %8p\n", page_idx * PAGE_SIZE, (void *)entry);
 }
 
 void print_page_table(struct PageTable *pt) {
     LOG_INFO("size: %zu", pt->size);
-    LOG_INFO("curr: %zu", pt->curr);
-    for (size_t i = 0; i < pt->size; i++) {
-        if (i % 16 == 0)
-            printf("\n");
-        printf("%8p ", (void *)pt->entries[i]);
-        // printf("0x%8" PRIxPTR " ", pt->entries[i]);
+    LOG_INFO("mapped: %zu", pt->stats.mapped_pages);
+    for_each_mapped_page(pt, print_page_table_entry, NULL);
+}
+
+void print_page_table_stats(struct PageTable *pt) {
+    struct PageTableStats *stats = &pt->stats;
+    double avg_depth = stats->walks ? (double)stats->walk_levels / stats->walks : 0;
+
+    LOG_INFO("mapped pages: %zu", stats->mapped_pages);
+    LOG_INFO("tables: %zu (%zu bytes)", stats->node_count, page_table_memory_usage(pt));
+    LOG_INFO("walks: %zu, avg walk depth: %.2f", stats->walks, avg_depth);
+    LOG_INFO("cow faults: %zu (copies: %zu), zero page faults: %zu", stats->cow_faults,
+             stats->cow_copies, stats->zero_faults);
+    LOG_INFO("huge pages: %zu, gigantic pages: %zu, huge faults: %zu, fallbacks: %zu",
+             stats->huge_pages[PAGE_HUGE], stats->huge_pages[PAGE_GIGANTIC],
+             stats->huge_faults, stats->huge_fallbacks);
+}
+
+static void invalidate_page(struct PageTable *pt, size_t page_idx) {
+    // a shootdown when the owner runs on another CPU
+    if (pt->owner && pt->owner->cpu->tlb) {
+        tlb_invalidate(pt->owner->cpu->tlb, pt->owner, page_idx);
+    }
+}
+
+static bool log_eviction(struct Proc *proc, size_t page_idx, uintptr_t pte,
+                         const unsigned char *contents) {
+    struct ExecLogEntry entry = {.proc = proc,
+                                 .action = UNMAP,
+                                 .virt_addr = page_idx * PAGE_SIZE,
+                                 .is_eviction = true,
+                                 .old_pte = pte};
+    if (contents) {
+        return push_page_to_exec_log(this_cpu->exec_log, entry, contents);
+    }
+    return push_to_exec_log(this_cpu->exec_log, entry);
+}
+
+// A frame is dirty once any page mapping it was written to
+static bool is_frame_dirty(struct FrameDBEntry *frame) {
+    bool dirty = get_pte(frame->proc->page_table, frame->page_idx) & PTE_DIRTY;
+    for (size_t i = frame->sharers; i != 0; i = sim->frame_allocator->sharers[i].next) {
+        struct FrameSharer *sharer = &sim->frame_allocator->sharers[i];
+        dirty |= (get_pte(sharer->proc->page_table, sharer->page_idx) & PTE_DIRTY) != 0;
+    }
+    return dirty;
+}
+
+/*
+ * Reclaim a used frame for reuse
+ * Every page mapping the frame is marked as evicted so that the next access
+ * to it is handled as a (major) page fault instead of a segmentation fault.
+ * With swap the entries keep the slot the contents were written to.
+ */
+static void evict_frame(size_t frame_idx) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    assert(frame->proc != NULL && "[FATAL] Evicting a frame with no owner");
+    uintptr_t phy_addr = frame_idx * FRAME_SIZE;
+
+    // a clean frame still matches what it was loaded with, no write back needed
+    bool dirty = is_frame_dirty(frame);
+    if (dirty) {
+        frame->proc->counters.dirty_evictions++;
+    }
+    uintptr_t evicted = PTE_EVICTED;
+    if (sim->swap) {
+        evicted = swap_pte(swap_out(sim->swap, frame_idx, dirty));
+    }
+
+    // sharers are logged first, so a rollback restores the frame before them
+    for (size_t i = frame->sharers; i != 0; i = sim->frame_allocator->sharers[i].next) {
+        struct FrameSharer *sharer = &sim->frame_allocator->sharers[i];
+        struct PageTable *pt = sharer->proc->page_table;
+        uintptr_t pte = get_pte(pt, sharer->page_idx);
+        assert((pte & ~PTE_FLAGS_MASK) == phy_addr);
+
+        if (this_cpu->exec_log) {
+            log_eviction(sharer->proc, sharer->page_idx, pte, NULL);
+        }
+        set_page_table_entry(pt, sharer->page_idx, evicted);
+        invalidate_page(pt, sharer->page_idx);
+        sharer->proc->counters.evictions++;
+        TRACE_EVENT(EVENT_LEVEL_FAULTS, EVENT_EVICT, sharer->proc->pid, sharer->page_idx,
+                    frame_idx, 0);
+    }
+
+    struct PageTable *pt = frame->proc->page_table;
+    uintptr_t pte = get_pte(pt, frame->page_idx);
+    assert((pte & ~PTE_FLAGS_MASK) == phy_addr);
+
+    // eviction drops the contents, keep them so the fault can be rolled back
+    if (this_cpu->exec_log) {
+        log_eviction(frame->proc, frame->page_idx, pte, &sim->phy_mem[phy_addr]);
+    }
+    set_page_table_entry(pt, frame->page_idx, evicted);
+    invalidate_page(pt, frame->page_idx);
+    frame->proc->counters.evictions++;
+    TRACE_EVENT(EVENT_LEVEL_FAULTS, EVENT_EVICT, frame->proc->pid, frame->page_idx,
+                frame_idx, 0);
+
+    free_frame(sim->frame_allocator, frame_idx);
+}
+
+/*
+ * Take a frame for page_idx, reclaiming one through the replacement policy if
+ * memory is full, and fill it with contents (zeros if NULL)
+ */
+static bool map_new_frame(struct PageTable *pt, size_t page_idx,
+                          const unsigned char *contents) {
+    // without mm_lock the frame comes from the frame cache and the engine learns
+    // about the fault later
+    bool is_major = is_page_evicted(pt, page_idx);
+    bool queued = sim->concurrent && this_cpu->held < CPU_LOCK_MM;
+    if (sim->replacement && !queued) {
+        replacement_on_fault(sim->replacement, pt->owner, page_idx, is_major);
+    }
+
+    // with memory full a victim goes through the pool, the thread zeroes it while
+    // the fault takes a frame zeroed earlier
+    struct ZeroPool *pool = sim->zero_pool;
+    if (pool && pool->count < pool->capacity && sim->frame_allocator->free_count == 0 &&
+        sim->replacement) {
+        size_t victim = replacement_select_victim(sim->replacement);
+        if (victim != INVALID_FRAME) {
+            evict_frame(victim);
+            refill_zero_pool(pool);
+            pool->stats.reclaimed++;
+        }
+    }
+
+    size_t frame_idx = INVALID_FRAME;
+    bool zeroed = false;
+    if (pool && contents == NULL) {
+        frame_idx = take_zeroed_frame(pool);
+        zeroed = frame_idx != INVALID_FRAME;
+    }
+    if (frame_idx == INVALID_FRAME) {
+        frame_idx = sim->concurrent && !pool ? alloc_cached_frame(sim->frame_allocator)
+                                             : alloc_frame(sim->frame_allocator);
+    }
+    // memory is only full once the pool is empty too
+    if (frame_idx == INVALID_FRAME && pool) {
+        frame_idx = take_back_pool_frame(pool);
+    }
+    if (frame_idx == INVALID_FRAME && sim->replacement) {
+        size_t victim = replacement_select_victim(sim->replacement);
+        if (victim != INVALID_FRAME) {
+            evict_frame(victim);
+            frame_idx = alloc_frame(sim->frame_allocator);
+        }
+    }
+    if (frame_idx == INVALID_FRAME) {
+        return false;
+    }
+
+    uintptr_t phy_addr = FRAME_SIZE * frame_idx;
+    sim->frame_db[frame_idx].proc = pt->owner;
+    sim->frame_db[frame_idx].page_idx = page_idx;
+
+    if (contents) {
+        memcpy(&sim->phy_mem[phy_addr], contents, PAGE_SIZE);
+    } else if (!zeroed) {
+        // zero out a frame before mapping it
+        memset(&sim->phy_mem[phy_addr], 0, PAGE_SIZE);
     }
-    printf("\n");
+    if (pool) {
+        // the pool thread wrote to the frame after it was allocated
+        bump_frame_generation(frame_idx);
+    }
+    set_page_table_entry(pt, page_idx, phy_addr | PTE_USER_PAGE);
+    pt->owner->counters.maps++;
+    TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_MAP, pt->owner->pid, page_idx, frame_idx, 0);
+
+    if (queued) {
+        note_frame_fault(frame_idx, pt->owner, page_idx, is_major);
+    } else if (sim->replacement) {
+        replacement_on_map(sim->replacement, frame_idx);
+    }
+    if (pool) {
+        refill_zero_pool(pool);
+    }
+    return true;
+}
+
+const char *page_class_to_str(enum PageClass class) {
+    switch (class) {
+    case PAGE_BASE:
+        return "base";
+    case PAGE_HUGE:
+        return "huge";
+    case PAGE_GIGANTIC:
+        return "gigantic";
+
+    default:
+        assert("Invalid page class");
+    }
+    return NULL;
+}
+
+// Page class of a page size in bytes, for the current base page size
+bool page_class_from_size(size_t size, enum PageClass *class) {
+    for (enum PageClass c = PAGE_BASE; c < PAGE_CLASS_COUNT; c++) {
+        if (size == page_class_pages(c) * PAGE_SIZE) {
+            *class = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Map the naturally aligned huge page holding page_idx
+ * Only done if nothing is mapped in its range yet and a free run of frames is
+ * left, huge pages are not reclaimed by the replacement policy.
+ */
+static bool map_huge_page(struct PageTable *pt, size_t page_idx, enum PageClass class) {
+    size_t pages = page_class_pages(class);
+    size_t first_page = page_idx & ~(pages - 1);
+    int level = class_level(class);
+
+    // the range holding the guard page is never mapped as a whole
+    if (first_page == 0 || first_page + pages > pt->size) {
+        return false;
+    }
+    struct PageTableNode *node = walk_page_table(pt, first_page, level, false, NULL);
+    if (node != NULL && node->entries[level_idx(first_page, level)] != 0) {
+        return false;
+    }
+
+    size_t frame_idx = alloc_frames(sim->frame_allocator, class);
+    if (frame_idx == INVALID_FRAME) {
+        return false;
+    }
+
+    uintptr_t phy_addr = FRAME_SIZE * frame_idx;
+    sim->frame_db[frame_idx].proc = pt->owner;
+    sim->frame_db[frame_idx].page_idx = first_page;
+    memset(&sim->phy_mem[phy_addr], 0, pages * PAGE_SIZE);
+    set_entry_at_level(pt, first_page, level,
+                       phy_addr | PTE_USER_PAGE | ((uintptr_t)class << PTE_CLASS_SHIFT));
+
+    pt->stats.huge_pages[class]++;
+    pt->stats.huge_faults++;
+    pt->owner->counters.maps++;
+    TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_MAP, pt->owner->pid, first_page, frame_idx, class);
+    return true;
+}
+
+// Unmap the huge page holding page_idx and give back its frames
+static void release_huge_page(struct PageTable *pt, size_t page_idx, uintptr_t pte) {
+    enum PageClass class = pte_page_class(pte);
+    size_t first_page = page_idx & ~(page_class_pages(class) - 1);
+
+    uintptr_t entry = clear_entry_at_level(pt, first_page, class_level(class));
+    assert(entry != 0 && "[FATAL] Releasing a huge page that is not mapped");
+    invalidate_page(pt, first_page);
+    pt->stats.huge_pages[class]--;
+    free_frames(sim->frame_allocator, entry >> OFFSET_BITS);
+}
+
+/*
+ * Bring an evicted page back from its swap slot, the reference of the entry
+ * moves to the new frame, which is clean until it is written to
+ */
+static bool swap_in_page(struct PageTable *pt, size_t page_idx, size_t slot) {
+    // read first, making room for the page may reuse the cache entry of the slot
+    unsigned char *contents = this_cpu->fault_page;
+    swap_in(sim->swap, slot, contents);
+    if (!map_new_frame(pt, page_idx, contents)) {
+        return false;
+    }
+    sim->frame_db[get_page_table_entry(pt, page_idx) >> OFFSET_BITS].swap_slot = slot;
+    return true;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
 // find a unused frame and map it to given virutal address
-void map_frame_at_addr(struct PageTable *page_table, virt_addr_t virt_addr) {
+// if memory is full a frame is reclaimed through the replacement policy
+// Returns false if the address can not be mapped or memory is full
+bool map_frame_at_addr(struct PageTable *page_table, virt_addr_t virt_addr) {
     if (virt_addr == 0) {
         LOG_ERROR("Attempted to map guard page (0x0) to a valid physical frame");
-        return;
+        return false;
     }
 
     size_t page_idx = virt_addr / PAGE_SIZE;
-    size_t total_frames = DEFAULT_MEMORY_SIZE / FRAME_SIZE;
+    if (page_idx >= page_table->size) {
+        LOG_ERROR("Address %p is outside the virtual address space", (void *)virt_addr);
+        return false;
+    }
 
-    // TODO: Handle out of memory infinite loop
-    while (1) {
-        last_frame_id++;
-        if (last_frame_id == total_frames) {
-            last_frame_id = 1;
+    uintptr_t evicted = get_raw_entry(page_table, page_idx);
+    bool is_major = is_pte_evicted(evicted);
+    if (is_major) {
+        page_table->owner->counters.major_faults++;
+    } else {
+        page_table->owner->counters.minor_faults++;
+    }
+    TRACE_EVENT(EVENT_LEVEL_FAULTS, EVENT_FAULT, page_table->owner->pid, page_idx,
+                INVALID_FRAME, is_major);
+
+    // like THP, a fault in an untouched aligned range maps a huge page if it can
+    for (enum PageClass class = page_table->fault_class; class > PAGE_BASE; class--) {
+        if (map_huge_page(page_table, page_idx, class)) {
+            return true;
         }
+    }
+    if (page_table->fault_class > PAGE_BASE) {
+        page_table->stats.huge_fallbacks++;
+    }
+    if (!is_major || sim->swap == NULL) {
+        return map_new_frame(page_table, page_idx, NULL);
+    }
+
+    uint64_t start = now_ns();
+    size_t slot = pte_swap_slot(evicted);
+    bool ok = slot != 0 ? swap_in_page(page_table, page_idx, slot)
+                        : map_new_frame(page_table, page_idx, NULL);
+    record_fault_latency(sim->swap, now_ns() - start);
+    return ok;
+}
+
+/*
+ * Map the zero page read-only at an untouched page whose first access is a
+ * read, the fault needs no frame of its own
+ */
+void map_zero_page(struct PageTable *pt, size_t page_idx) {
+    assert(page_idx != 0 && page_idx < pt->size && get_raw_entry(pt, page_idx) == 0);
+    pt->owner->counters.minor_faults++;
+    TRACE_EVENT(EVENT_LEVEL_FAULTS, EVENT_FAULT, pt->owner->pid, page_idx, INVALID_FRAME,
+                0);
+
+    set_page_table_entry(pt, page_idx, ZERO_FRAME * FRAME_SIZE | PTE_ZERO_PAGE);
+    pt->stats.zero_faults++;
+    TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_MAP, pt->owner->pid, page_idx, ZERO_FRAME, 0);
+}
+
+/*
+ * Handle a write to a copy-on-write page
+ * The last page still mapping a shared frame takes it over, every other one
+ * gets a private copy of the frame. The zero page is never taken over, a
+ * write to it maps a zeroed frame.
+ */
+bool break_cow(struct PageTable *pt, size_t page_idx) {
+    uintptr_t pte = get_pte(pt, page_idx);
+    assert((pte & PTE_COW) && "[FATAL] Page is not copy-on-write");
 
-        if (is_frame_unused(last_frame_id)) {
-            uintptr_t phy_addr = FRAME_SIZE * last_frame_id;
-            frame_db[last_frame_id] =
-                (struct FrameDBEntry){.is_used = true, .ref_count = 1};
+    size_t frame_idx = pte >> OFFSET_BITS;
+    pt->stats.cow_faults++;
+    invalidate_page(pt, page_idx);
 
-            // zero out a frame before mapping it
-            memset(&phy_mem[phy_addr], 0, PAGE_SIZE);
-            page_table->entries[page_idx] = phy_addr;
-            return;
+    bool is_zero = frame_idx == ZERO_FRAME;
+    if (!is_zero && sim->frame_db[frame_idx].ref_count == 1) {
+        set_page_table_entry(pt, page_idx, (pte & ~PTE_COW) | PTE_WRITABLE);
+        return true;
+    }
+
+    // the shared frame itself may be picked as the victim for the copy
+    unsigned char *contents = this_cpu->fault_page;
+    if (!is_zero) {
+        memcpy(contents, &sim->phy_mem[pte & ~PTE_FLAGS_MASK], PAGE_SIZE);
+    }
+    clear_page_table_entry(pt, page_idx);
+    if (!is_zero) {
+        remove_frame_mapping(sim->frame_allocator, frame_idx, pt->owner, page_idx);
+    }
+
+    // logged like an eviction so that it is undone after the ones the copy causes,
+    // which may bring the shared frame back first
+    struct ExecLog *log = this_cpu->exec_log;
+    bool logged = log && log_eviction(pt->owner, page_idx, pte, NULL);
+    if (!map_new_frame(pt, page_idx, is_zero ? NULL : contents)) {
+        // a range call that outgrew the log while mapping took the entry with it
+        if (logged && !log->call_dropped) {
+            pop_to_exec_log(log);
         }
+        share_page(pt, page_idx, pte);
+        return false;
     }
+    pt->stats.cow_copies++;
+    return true;
 }
 
 void unmap_page_by_virtual_addr(struct PageTable *pt, virt_addr_t virt_addr) {
@@ -71,16 +660,221 @@ void unmap_page_by_virtual_addr(struct PageTable *pt, virt_addr_t virt_addr) {
     unmap_page_by_page_idx(pt, page_idx);
 }
 
+static void release_frame(struct PageTable *pt, size_t page_idx, size_t frame_idx) {
+    invalidate_page(pt, page_idx);
+    // the zero page is not reference counted
+    if (frame_idx == ZERO_FRAME) {
+        return;
+    }
+    if (remove_frame_mapping(sim->frame_allocator, frame_idx, pt->owner, page_idx) != 0) {
+        return;
+    }
+    // the copy on swap goes away with the frame
+    if (sim->frame_db[frame_idx].swap_slot != 0) {
+        swap_free(sim->swap, sim->frame_db[frame_idx].swap_slot);
+    }
+    if (sim->replacement) {
+        replacement_on_free(sim->replacement, frame_idx);
+    }
+    free_frame(sim->frame_allocator, frame_idx);
+}
+
+static void release_mapped_frame(size_t page_idx, uintptr_t entry, void *arg) {
+    if (is_pte_evicted(entry)) {
+        if (pte_swap_slot(entry) != 0) {
+            swap_free(sim->swap, pte_swap_slot(entry));
+        }
+        return;
+    }
+    if (pte_page_class(entry) != PAGE_BASE) {
+        release_huge_page((struct PageTable *)arg, page_idx, entry);
+        return;
+    }
+    release_frame((struct PageTable *)arg, page_idx, entry >> OFFSET_BITS);
+}
+
+// Give back every frame and swap slot the table maps, used when its process exits
+void release_page_table_frames(struct PageTable *pt) {
+    for_each_page_table_entry(pt, release_mapped_frame, pt);
+}
+
 // TODO: Bad API design, these functions are not supposed to be called directly
 // NEED a prcess level abstraction for these
 // also then it would be possible to log the process in the entry
 void unmap_page_by_page_idx(struct PageTable *pt, size_t page_idx) {
-    size_t phy_addr = pt->entries[page_idx];
-    pt->entries[page_idx] = 0;
+    // the exec log can not hold the contents of a huge page
+    uintptr_t huge_pte = get_pte(pt, page_idx);
+    if (pte_page_class(huge_pte) != PAGE_BASE) {
+        if (this_cpu->exec_log) {
+            LOG_WARN("Unmapping a %s page, the exec log is cleared",
+                     page_class_to_str(pte_page_class(huge_pte)));
+            clear_exec_log(this_cpu->exec_log);
+        }
+        release_huge_page(pt, page_idx, huge_pte);
+        pt->owner->counters.unmaps++;
+        TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_UNMAP, pt->owner->pid, page_idx,
+                    huge_pte >> OFFSET_BITS, pte_page_class(huge_pte));
+        return;
+    }
+
+    uintptr_t pte = clear_page_table_entry(pt, page_idx);
+    if (pte == 0) {
+        LOG_WARN("Page %zu is not mapped", page_idx);
+        return;
+    }
+    pt->owner->counters.unmaps++;
+    TRACE_EVENT(EVENT_LEVEL_ALL, EVENT_UNMAP, pt->owner->pid, page_idx,
+                is_pte_evicted(pte) ? INVALID_FRAME : pte >> OFFSET_BITS, 0);
+
+    struct ExecLogEntry entry = {.proc = pt->owner,
+                                 .action = UNMAP,
+                                 .virt_addr = page_idx * PAGE_SIZE,
+                                 .was_evicted = is_pte_evicted(pte),
+                                 .old_pte = pte};
+
+    // an evicted page has no frame left to release, only its swap slot
+    if (is_pte_evicted(pte)) {
+        if (pte_swap_slot(pte) != 0) {
+            swap_free(sim->swap, pte_swap_slot(pte));
+        }
+        if (this_cpu->exec_log) {
+            push_to_exec_log(this_cpu->exec_log, entry);
+        }
+        return;
+    }
+
+    // the frame lives on while other pages map it, only the mapping is logged
+    size_t frame_idx = pte >> OFFSET_BITS;
+    if (this_cpu->exec_log &&
+        (frame_idx == ZERO_FRAME || sim->frame_db[frame_idx].ref_count > 1)) {
+        push_to_exec_log(this_cpu->exec_log, entry);
+    } else if (this_cpu->exec_log) {
+        // free_frame leaves the contents in place, save them before the frame is reused
+        push_page_to_exec_log(this_cpu->exec_log, entry,
+                              &sim->phy_mem[pte & ~PTE_FLAGS_MASK]);
+    }
+    release_frame(pt, page_idx, frame_idx);
+    // the thread zeroes the frame before a fault needs it
+    if (sim->zero_pool) {
+        refill_zero_pool(sim->zero_pool);
+    }
+}
+
+/*
+ * Rollback helpers, these change mappings directly without faulting, running
+ * the replacement policy or logging anything
+ */
+
+// Map page_idx to a free frame holding a copy of contents
+void restore_page(struct PageTable *pt, size_t page_idx, const unsigned char *contents,
+                  uintptr_t flags) {
+    // sharers of an evicted frame are restored at its address, it is free or in
+    // the pool unless it was reused
+    size_t frame_idx = flags >> OFFSET_BITS;
+    if (!alloc_frame_at(sim->frame_allocator, frame_idx) &&
+        !(sim->zero_pool && take_pool_frame(sim->zero_pool, frame_idx))) {
+        frame_idx = alloc_frame(sim->frame_allocator);
+    }
+    if (frame_idx == INVALID_FRAME && sim->zero_pool) {
+        frame_idx = take_back_pool_frame(sim->zero_pool);
+    }
+    assert(frame_idx != INVALID_FRAME && "[FATAL] No free frame to restore a page");
+
+    uintptr_t phy_addr = FRAME_SIZE * frame_idx;
+    sim->frame_db[frame_idx].proc = pt->owner;
+    sim->frame_db[frame_idx].page_idx = page_idx;
+    memcpy(&sim->phy_mem[phy_addr], contents, PAGE_SIZE);
+    set_page_table_entry(pt, page_idx, phy_addr | (flags & PTE_FLAGS_MASK));
+
+    if (sim->replacement) {
+        replacement_on_map(sim->replacement, frame_idx);
+    }
+}
+
+// Map page_idx to the used frame of pte, as one more sharer of it
+void share_page(struct PageTable *pt, size_t page_idx, uintptr_t pte) {
+    size_t frame_idx = pte >> OFFSET_BITS;
+    assert(get_pte(pt, page_idx) == 0);
 
-    size_t frame_idx = phy_addr >> 12;
-    frame_db[frame_idx] = (struct FrameDBEntry){0};
+    if (frame_idx != ZERO_FRAME) {
+        add_frame_mapping(sim->frame_allocator, frame_idx, pt->owner, page_idx);
+    }
+    set_page_table_entry(pt, page_idx, pte);
+}
+
+// Change the flags of a present page, pte must point to the same frame
+void protect_page(struct PageTable *pt, size_t page_idx, uintptr_t pte) {
+    assert((get_pte(pt, page_idx) & ~PTE_FLAGS_MASK) == (pte & ~PTE_FLAGS_MASK));
+    set_page_table_entry(pt, page_idx, pte);
+    invalidate_page(pt, page_idx);
+}
+
+// Unmap a present page and put its entry back to what it was before the map
+void release_page(struct PageTable *pt, size_t page_idx, bool was_evicted) {
+    uintptr_t pte = get_pte(pt, page_idx);
+    assert(pte != 0 && "[FATAL] Releasing a page that is not mapped");
+    if (pte_page_class(pte) != PAGE_BASE) {
+        release_huge_page(pt, page_idx, pte);
+        return;
+    }
+    uintptr_t phy_addr = pte & ~PTE_FLAGS_MASK;
 
-    struct ExecLogEntry entry = {.action = UNMAP, .virt_addr = page_idx * PAGE_SIZE};
-    push_to_exec_log(exec_log, entry);
+    if (was_evicted) {
+        set_page_table_entry(pt, page_idx, PTE_EVICTED);
+    } else {
+        clear_page_table_entry(pt, page_idx);
+    }
+    release_frame(pt, page_idx, phy_addr >> OFFSET_BITS);
+}
+
+void mark_page_evicted(struct PageTable *pt, size_t page_idx) {
+    assert(get_raw_entry(pt, page_idx) == 0);
+    set_page_table_entry(pt, page_idx, PTE_EVICTED);
+}
+
+/*
+ * Set and clear flags in the entry of a present page, in the entry of the huge
+ * page if it is part of one. The mapping does not change, the version still
+ * does so that snapshots keep the flags.
+ */
+static void update_pte_flags(struct PageTable *pt, size_t page_idx, uintptr_t set,
+                             uintptr_t clear) {
+    uintptr_t pte = get_pte(pt, page_idx);
+    assert(pte != 0 && "[FATAL] Setting flags of a page that is not mapped");
+    int level = class_level(pte_page_class(pte));
+    struct PageTableNode *node = walk_page_table(pt, page_idx, level, false, NULL);
+    uintptr_t *entry = &node->entries[level_idx(page_idx, level)];
+    *entry = (*entry | set) & ~clear;
+    pt->version = next_page_table_version();
+}
+
+// Set flags as the MMU does for accessed and dirty, callers update their TLB entry
+void set_pte_flags(struct PageTable *pt, size_t page_idx, uintptr_t flags) {
+    update_pte_flags(pt, page_idx, flags, 0);
+}
+
+static bool test_and_clear_accessed(struct PageTable *pt, size_t page_idx) {
+    if (!(get_pte(pt, page_idx) & PTE_ACCESSED)) {
+        return false;
+    }
+    update_pte_flags(pt, page_idx, 0, PTE_ACCESSED);
+    // the next access misses the TLB and sets the bit again
+    invalidate_page(pt, page_idx);
+    return true;
+}
+
+/*
+ * Test and clear the accessed bit of every page mapping a frame, found through
+ * the owner and the sharers of the frame, as clock reclaim does. Only called
+ * while memory is full, when the world is stopped.
+ */
+bool test_and_clear_frame_accessed(size_t frame_idx) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    assert(frame->proc != NULL && "[FATAL] Reclaiming a frame with no owner");
+    bool accessed = test_and_clear_accessed(frame->proc->page_table, frame->page_idx);
+    for (size_t i = frame->sharers; i != 0; i = sim->frame_allocator->sharers[i].next) {
+        struct FrameSharer *sharer = &sim->frame_allocator->sharers[i];
+        accessed |= test_and_clear_accessed(sharer->proc->page_table, sharer->page_idx);
+    }
+    return accessed;
 }
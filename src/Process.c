@@ -5,16 +5,88 @@
 #include <stdlib.h>
 #include <string.h>
 
+// pids double as TLB ASIDs, so they must never collide between live processes
+// Simulators on other threads create processes too
+static size_t next_pid = 1;
+
 struct Proc *create_proc(char *name) {
     struct Proc *new_proc = (struct Proc *)malloc(sizeof(struct Proc));
-    new_proc->pid = (size_t)new_proc & 0xFFFF;
+    new_proc->pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_RELAXED);
     new_proc->name = (char *)malloc(strlen(name) + 1);
     strcpy(new_proc->name, name);
-    new_proc->page_table = create_page_table(DEFAULT_PAGE_TABLE_SIZE);
+    new_proc->page_table = create_page_table();
+    new_proc->page_table->owner = new_proc;
+    new_proc->tlb_stats = (struct TLBStats){0};
+    new_proc->counters = (struct ProcCounters){0};
+    new_proc->cpu = this_cpu;
     return new_proc;
 }
 
+struct ForkCtx {
+    struct Proc *parent;
+    struct Proc *child;
+};
+
+static void fork_page(size_t page_idx, uintptr_t entry, void *arg) {
+    struct ForkCtx *ctx = (struct ForkCtx *)arg;
+
+    // the child refers to the same copy on swap
+    if (is_pte_evicted(entry)) {
+        if (pte_swap_slot(entry) != 0) {
+            swap_dup(sim->swap, pte_swap_slot(entry));
+        }
+        load_page_table_entry(ctx->child->page_table, page_idx, entry);
+        return;
+    }
+    // shared segments stay shared with the child
+    if (sim->frame_db[entry >> OFFSET_BITS].is_shared) {
+        share_page(ctx->child->page_table, page_idx, entry);
+        return;
+    }
+    // write protect the parent too, whoever writes first gets the copy
+    uintptr_t cow_entry = (entry | PTE_COW) & ~PTE_WRITABLE;
+    if (!(entry & PTE_COW)) {
+        protect_page(ctx->parent->page_table, page_idx, cow_entry);
+    }
+    share_page(ctx->child->page_table, page_idx, cow_entry);
+}
+
+/*
+ * Create a copy of a process that shares all of its frames copy-on-write
+ * Only the page table is copied, a frame is copied on the first write to it.
+ * The exec log can not roll back across a fork and is cleared.
+ */
+struct Proc *fork_proc(struct Proc *parent) {
+    if (sim->timeline) {
+        LOG_ERROR("%s: fork is not supported while a timeline is recording",
+                  parent->name);
+        return NULL;
+    }
+    struct PageTableStats *stats = &parent->page_table->stats;
+    if (stats->huge_pages[PAGE_HUGE] || stats->huge_pages[PAGE_GIGANTIC]) {
+        LOG_ERROR("%s: fork of a process with huge pages is not supported", parent->name);
+        return NULL;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s fork", parent->name);
+    struct Proc *child = create_proc(name);
+    child->cpu = parent->cpu;
+
+    struct ForkCtx ctx = {.parent = parent, .child = child};
+    for_each_page_table_entry(parent->page_table, fork_page, &ctx);
+
+    if (this_cpu->exec_log) {
+        clear_exec_log(this_cpu->exec_log);
+    }
+    return child;
+}
+
 void destroy_proc(struct Proc *proc) {
+    if (proc->cpu->tlb) {
+        tlb_flush_proc(proc->cpu->tlb, proc);
+    }
+    release_page_table_frames(proc->page_table);
     destroy_page_table(proc->page_table);
     free(proc->name);
     free(proc);
@@ -23,36 +95,146 @@ void destroy_proc(struct Proc *proc) {
 uintptr_t convert_virtual_addr_to_physical_addr(struct PageTable *pt,
                                                 virt_addr_t virt_addr) {
     size_t page_idx = virt_addr / PAGE_SIZE;
-    assert(pt->entries[page_idx] != 0 && "[FATAL] Invalid page");
+    uintptr_t frame_addr = get_page_table_entry(pt, page_idx);
+    assert(frame_addr != 0 && "[FATAL] Invalid page");
 
-    uintptr_t frame_addr = pt->entries[page_idx];
     uintptr_t offset = virt_addr & (PAGE_SIZE - 1);
     return frame_addr + offset;
 }
 
+// Translate a page through the TLB, walking the page table on a TLB miss
+// Returns the page table entry (frame address and flags), 0 if the page is not mapped
+static uintptr_t translate_page(struct Proc *proc, size_t page_idx) {
+    struct TLB *tlb = proc->cpu->tlb;
+    if (tlb == NULL) {
+        return get_pte(proc->page_table, page_idx);
+    }
+
+    uintptr_t pte = tlb_lookup(tlb, proc, page_idx);
+    if (pte != 0) {
+        return pte;
+    }
+
+    pte = get_pte(proc->page_table, page_idx);
+    if (pte != 0) {
+        tlb_insert(tlb, proc, page_idx, pte);
+    }
+    return pte;
+}
+
+/*
+ * Set accessed, and dirty for a write, in the page table and the TLB entry the
+ * first time the page is used with them, later accesses only test the bits
+ */
+static inline uintptr_t mark_page_used(struct Proc *proc, size_t page_idx, uintptr_t pte,
+                                       uintptr_t flags) {
+    if ((pte & flags) == flags) {
+        return pte;
+    }
+    set_pte_flags(proc->page_table, page_idx, flags);
+    pte |= flags;
+    if (proc->cpu->tlb) {
+        tlb_insert(proc->cpu->tlb, proc, page_idx, pte);
+    }
+    return pte;
+}
+
+// Note which base pages of huge pages are used, the rest is internal fragmentation
+static inline void touch_huge_page(uintptr_t pte) {
+    if (pte_page_class(pte) != PAGE_BASE) {
+        sim->frame_db[pte >> OFFSET_BITS].accessed = true;
+    }
+}
+
+/*
+ * Faults change the frame allocator and replacement state shared by all CPUs,
+ * one that has to evict also changes pages of other processes and stops every
+ * CPU. A base page fault of a CPU with cached frames needs neither. Returns
+ * false if locks were dropped on the way, the caller starts over.
+ */
+static bool lock_for_fault(struct Proc *proc) {
+    if (this_cpu->cached_frames > 0 && proc->page_table->fault_class == PAGE_BASE) {
+        this_cpu->stats.cached_faults += this_cpu->held < CPU_LOCK_MM;
+        return true;
+    }
+    cpu_lock(CPU_LOCK_MM);
+    return sim->frame_allocator->free_count > 0 || this_cpu->cached_frames > 0 ||
+           cpu_lock(CPU_LOCK_WORLD);
+}
+
+/*
+ * Fault in the page of virt_addr for a read and note the access, the fault is
+ * recorded in entry. Returns the page table entry, 0 on a segmentation fault
+ * or when out of memory.
+ */
+static uintptr_t fault_in_for_read(struct Proc *proc, virt_addr_t virt_addr,
+                                   struct ExecLogEntry *entry) {
+    size_t page_idx = virt_addr / PAGE_SIZE;
+
+    // check for segmentation fault
+    uintptr_t frame_addr = translate_page(proc, page_idx);
+    if (frame_addr == 0 && is_page_evicted(proc->page_table, page_idx)) {
+        if (!lock_for_fault(proc)) {
+            return fault_in_for_read(proc, virt_addr, entry);
+        }
+        // page was reclaimed, fault it back in
+        if (!map_frame_at_addr(proc->page_table, virt_addr)) {
+            LOG_ERROR("%s: Out of memory while mapping %p", proc->name,
+                      (void *)virt_addr);
+            return 0;
+        }
+        frame_addr = translate_page(proc, page_idx);
+        entry->did_map = true;
+        entry->was_evicted = true;
+    } else if (frame_addr == 0 &&
+               (page_idx == 0 || page_idx >= proc->page_table->size)) {
+        TRACE_EVENT(EVENT_LEVEL_FAULTS, EVENT_SEGFAULT, proc->pid, page_idx,
+                    INVALID_FRAME, 0);
+        LOG_ERROR("%s: Segmentation fault at %p", proc->name, (void *)virt_addr);
+        return 0;
+    } else if (frame_addr == 0) {
+        // reading an untouched page needs no frame until it is written, nor mm_lock
+        map_zero_page(proc->page_table, page_idx);
+        frame_addr = translate_page(proc, page_idx);
+        entry->did_map = true;
+    } else if (!is_zero_page(frame_addr)) {
+        note_frame_access(frame_addr >> OFFSET_BITS);
+    }
+    touch_huge_page(frame_addr);
+    frame_addr = mark_page_used(proc, page_idx, frame_addr, PTE_ACCESSED);
+    if (sim->stack_distance) {
+        stack_distance_access(sim->stack_distance, proc->pid, page_idx);
+    }
+    if (sim->heatmap) {
+        heatmap_access(sim->heatmap, proc->pid, page_idx, frame_addr >> OFFSET_BITS);
+    }
+    return frame_addr;
+}
+
 // Standard method to read one byte of data with virtual address
 unsigned char access_memory(struct Proc *proc, virt_addr_t virt_addr) {
     assert(proc != NULL);
     assert(proc->page_table != NULL);
 
     struct ExecLogEntry entry = {0};
-    size_t page_idx = virt_addr / PAGE_SIZE;
-
-    // check for segmentation fault
-    if (page_idx >= proc->page_table->size || proc->page_table->entries[page_idx] == 0) {
-        LOG_ERROR("Page fault while accessing %p", (void *)virt_addr);
-        LOG_ERROR("%s: Segmentation fault", proc->name);
+    uintptr_t frame_addr = fault_in_for_read(proc, virt_addr, &entry);
+    if (frame_addr == 0) {
         return -1;
     }
 
+    // only a read that faulted a page in has something to roll back
     entry.action = READ;
     entry.virt_addr = virt_addr;
     entry.proc = proc;
-    push_to_exec_log(exec_log, entry);
+    if (this_cpu->exec_log && (entry.did_map || this_cpu->exec_log->log_reads)) {
+        push_to_exec_log(this_cpu->exec_log, entry);
+    }
 
-    uintptr_t phy_addr =
-        convert_virtual_addr_to_physical_addr(proc->page_table, virt_addr);
-    return phy_mem[phy_addr];
+    proc->counters.reads++;
+
+    // shared frames may be written by another CPU at the same time
+    uintptr_t phy_addr = (frame_addr & ~PTE_FLAGS_MASK) + (virt_addr & (PAGE_SIZE - 1));
+    return __atomic_load_n(&sim->phy_mem[phy_addr], __ATOMIC_RELAXED);
 }
 
 // This methods is only supposed to be used by the visulaisation to show memory dump
@@ -64,40 +246,302 @@ unsigned char inspect_memory(struct Proc *proc, virt_addr_t virt_addr) {
     size_t page_idx = virt_addr / PAGE_SIZE;
 
     // check for segmentation fault
-    if (page_idx >= proc->page_table->size || proc->page_table->entries[page_idx] == 0) {
+    if (get_page_table_entry(proc->page_table, page_idx) == 0) {
         return 0;
     }
 
     uintptr_t phy_addr =
         convert_virtual_addr_to_physical_addr(proc->page_table, virt_addr);
-    return phy_mem[phy_addr];
+    return sim->phy_mem[phy_addr];
 }
 
-void set_memory(struct Proc *proc, virt_addr_t virt_addr, unsigned char data) {
+// Copy memory for the visualisation, one translation per page, unmapped bytes read 0
+void inspect_memory_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char *buf,
+                          size_t len) {
     assert(proc != NULL);
     assert(proc->page_table != NULL);
 
-    struct ExecLogEntry entry = {0};
+    while (len > 0) {
+        size_t offset = virt_addr & (PAGE_SIZE - 1);
+        size_t run = PAGE_SIZE - offset < len ? PAGE_SIZE - offset : len;
+        uintptr_t frame_addr =
+            get_page_table_entry(proc->page_table, virt_addr / PAGE_SIZE);
+        if (frame_addr == 0) {
+            memset(buf, 0, run);
+        } else {
+            memcpy(buf, &sim->phy_mem[frame_addr + offset], run);
+        }
+        virt_addr += run;
+        buf += run;
+        len -= run;
+    }
+}
+
+/*
+ * Fault in the page of virt_addr for a write, breaking copy-on-write, and note
+ * the access, the fault is recorded in entry. Returns the page table entry, 0
+ * when out of memory.
+ */
+static uintptr_t fault_in_for_write(struct Proc *proc, virt_addr_t virt_addr,
+                                    struct ExecLogEntry *entry) {
     size_t page_idx = virt_addr / PAGE_SIZE;
 
     // check for page fault
-    if (proc->page_table->entries[page_idx] == 0) {
-        map_frame_at_addr(proc->page_table, virt_addr);
-        entry.did_map = true;
+    uintptr_t frame_addr = translate_page(proc, page_idx);
+    if (frame_addr == 0) {
+        if (!lock_for_fault(proc)) {
+            return fault_in_for_write(proc, virt_addr, entry);
+        }
+        entry->was_evicted = is_page_evicted(proc->page_table, page_idx);
+        if (!map_frame_at_addr(proc->page_table, virt_addr)) {
+            LOG_ERROR("%s: Out of memory while mapping %p", proc->name,
+                      (void *)virt_addr);
+            return 0;
+        }
+        frame_addr = translate_page(proc, page_idx);
+        entry->did_map = true;
+    } else if (frame_addr & PTE_COW) {
+        // the other mappings of the frame belong to processes on any CPU, the
+        // zero page only needs a frame of its own
+        bool locked =
+            is_zero_page(frame_addr) ? lock_for_fault(proc) : cpu_lock(CPU_LOCK_WORLD);
+        if (!locked) {
+            return fault_in_for_write(proc, virt_addr, entry);
+        }
+        // first write to a shared frame, copy it or take it over
+        entry->old_pte = frame_addr;
+        entry->did_map = is_zero_page(frame_addr) ||
+                         sim->frame_db[frame_addr >> OFFSET_BITS].ref_count > 1;
+        if (!break_cow(proc->page_table, page_idx)) {
+            LOG_ERROR("%s: Out of memory while copying %p", proc->name,
+                      (void *)virt_addr);
+            return 0;
+        }
+        frame_addr = translate_page(proc, page_idx);
+    } else {
+        note_frame_access(frame_addr >> OFFSET_BITS);
     }
+    touch_huge_page(frame_addr);
+    frame_addr = mark_page_used(proc, page_idx, frame_addr, PTE_ACCESSED | PTE_DIRTY);
+    if (sim->stack_distance) {
+        stack_distance_access(sim->stack_distance, proc->pid, page_idx);
+    }
+    if (sim->heatmap) {
+        heatmap_access(sim->heatmap, proc->pid, page_idx, frame_addr >> OFFSET_BITS);
+    }
+    return frame_addr;
+}
 
-    uintptr_t phy_addr =
-        convert_virtual_addr_to_physical_addr(proc->page_table, virt_addr);
+// The frame of a written page changed, views and snapshots of it are stale
+static inline void note_frame_write(uintptr_t frame_addr) {
+    bump_frame_generation(frame_addr >> OFFSET_BITS);
+    if (sim->timeline) {
+        timeline_mark_dirty(sim->timeline, frame_addr >> OFFSET_BITS);
+    }
+}
+
+void set_memory(struct Proc *proc, virt_addr_t virt_addr, unsigned char data) {
+    assert(proc != NULL);
+    assert(proc->page_table != NULL);
+
+    struct ExecLogEntry entry = {0};
+    uintptr_t frame_addr = fault_in_for_write(proc, virt_addr, &entry);
+    if (frame_addr == 0) {
+        return;
+    }
+
+    uintptr_t phy_addr = (frame_addr & ~PTE_FLAGS_MASK) + (virt_addr & (PAGE_SIZE - 1));
 
     // Maintain a log of the opeartion for rollback
     entry.action = WRITE;
     entry.virt_addr = virt_addr;
-    entry.old_data = phy_mem[phy_addr];
+    entry.old_data = __atomic_load_n(&sim->phy_mem[phy_addr], __ATOMIC_RELAXED);
     entry.new_data = data;
     entry.proc = proc;
-    push_to_exec_log(exec_log, entry);
+    if (this_cpu->exec_log) {
+        push_to_exec_log(this_cpu->exec_log, entry);
+    }
+
+    __atomic_store_n(&sim->phy_mem[phy_addr], data, __ATOMIC_RELAXED);
+    proc->counters.writes++;
+    note_frame_write(frame_addr);
+}
+
+/*
+ * Range accesses
+ * A range is split at page boundaries and every page is translated, faulted
+ * in and logged once, the bytes inside a page are moved with memcpy. A page
+ * counts as one read or write. The entries of one call are logged as one
+ * operation, a rollback undoes the call as a whole and a call too large for
+ * the log is not logged at all. Frames of shared segments may be accessed by
+ * another CPU at the same time, they are copied a byte at a time like the
+ * single byte accesses do.
+ */
+
+static inline bool is_frame_racy(uintptr_t frame_addr) {
+    return sim->concurrent && sim->frame_db[frame_addr >> OFFSET_BITS].is_shared;
+}
 
-    phy_mem[phy_addr] = data;
+static inline size_t page_run(virt_addr_t virt_addr, size_t len) {
+    size_t left = PAGE_SIZE - (virt_addr & (PAGE_SIZE - 1));
+    return left < len ? left : len;
+}
+
+static void begin_range_call() {
+    if (this_cpu->exec_log) {
+        begin_exec_log_call(this_cpu->exec_log);
+    }
+}
+
+static bool end_range_call(bool ok) {
+    if (this_cpu->exec_log) {
+        end_exec_log_call(this_cpu->exec_log);
+    }
+    return ok;
+}
+
+static bool read_pages(struct Proc *proc, virt_addr_t virt_addr, unsigned char *buf,
+                       size_t len) {
+    assert(proc != NULL);
+    assert(proc->page_table != NULL);
+
+    while (len > 0) {
+        size_t run = page_run(virt_addr, len);
+        struct ExecLogEntry entry = {0};
+        uintptr_t frame_addr = fault_in_for_read(proc, virt_addr, &entry);
+        if (frame_addr == 0) {
+            return false;
+        }
+
+        entry.action = READ;
+        entry.virt_addr = virt_addr;
+        entry.proc = proc;
+        if (this_cpu->exec_log && (entry.did_map || this_cpu->exec_log->log_reads)) {
+            push_to_exec_log(this_cpu->exec_log, entry);
+        }
+        proc->counters.reads++;
+
+        const unsigned char *src =
+            &sim->phy_mem[(frame_addr & ~PTE_FLAGS_MASK) + (virt_addr & (PAGE_SIZE - 1))];
+        if (is_frame_racy(frame_addr)) {
+            for (size_t i = 0; i < run; i++) {
+                buf[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+            }
+        } else {
+            memcpy(buf, src, run);
+        }
+        virt_addr += run;
+        buf += run;
+        len -= run;
+    }
+    return true;
+}
+
+// Read len bytes at virt_addr into buf, false if a page could not be read
+bool read_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char *buf,
+                size_t len) {
+    begin_range_call();
+    return end_range_call(read_pages(proc, virt_addr, buf, len));
+}
+
+/*
+ * Write data, or value if data is NULL, to len bytes at virt_addr
+ * A page that did not need a new frame logs its old contents along with the
+ * write, the whole write to the page is rolled back at once.
+ */
+static bool write_pages(struct Proc *proc, virt_addr_t virt_addr,
+                        const unsigned char *data, unsigned char value, size_t len) {
+    assert(proc != NULL);
+    assert(proc->page_table != NULL);
+
+    while (len > 0) {
+        size_t run = page_run(virt_addr, len);
+        struct ExecLogEntry entry = {0};
+        uintptr_t frame_addr = fault_in_for_write(proc, virt_addr, &entry);
+        if (frame_addr == 0) {
+            return false;
+        }
+
+        unsigned char *page = &sim->phy_mem[frame_addr & ~PTE_FLAGS_MASK];
+        entry.action = WRITE;
+        entry.virt_addr = virt_addr;
+        entry.length = run;
+        entry.proc = proc;
+        if (this_cpu->exec_log && entry.did_map) {
+            push_to_exec_log(this_cpu->exec_log, entry);
+        } else if (this_cpu->exec_log) {
+            push_page_to_exec_log(this_cpu->exec_log, entry, page);
+        }
+
+        unsigned char *dst = &page[virt_addr & (PAGE_SIZE - 1)];
+        if (is_frame_racy(frame_addr)) {
+            for (size_t i = 0; i < run; i++) {
+                __atomic_store_n(&dst[i], data ? data[i] : value, __ATOMIC_RELAXED);
+            }
+        } else if (data) {
+            memcpy(dst, data, run);
+        } else {
+            memset(dst, value, run);
+        }
+        proc->counters.writes++;
+        note_frame_write(frame_addr);
+
+        virt_addr += run;
+        data = data ? data + run : NULL;
+        len -= run;
+    }
+    return true;
+}
+
+// Write len bytes of buf to virt_addr, false if a page could not be written
+bool write_range(struct Proc *proc, virt_addr_t virt_addr, const unsigned char *buf,
+                 size_t len) {
+    assert(buf != NULL || len == 0);
+    begin_range_call();
+    return end_range_call(write_pages(proc, virt_addr, buf, 0, len));
+}
+
+// Set len bytes at virt_addr to value, false if a page could not be written
+bool fill_range(struct Proc *proc, virt_addr_t virt_addr, unsigned char value,
+                size_t len) {
+    begin_range_call();
+    return end_range_call(write_pages(proc, virt_addr, NULL, value, len));
+}
+
+/*
+ * Copy len bytes from src_addr of src to dst_addr of dst, the processes may be
+ * the same and the ranges may overlap. The part of every destination page is
+ * gathered from up to two source pages into the CPU's copy page first, since
+ * faulting in the destination may evict the source frame, and then written
+ * with one write. Returns false if a page could not be read or written.
+ */
+bool copy_range(struct Proc *dst, virt_addr_t dst_addr, struct Proc *src,
+                virt_addr_t src_addr, size_t len) {
+    unsigned char *buf = this_cpu->copy_page;
+    begin_range_call();
+
+    // an overlapping copy to a higher address is done from the end
+    bool backwards = dst == src && dst_addr > src_addr && dst_addr < src_addr + len;
+    while (len > 0) {
+        size_t run;
+        virt_addr_t from = src_addr, to = dst_addr;
+        if (backwards) {
+            size_t last = ((dst_addr + len - 1) & (PAGE_SIZE - 1)) + 1;
+            run = last < len ? last : len;
+            from += len - run;
+            to += len - run;
+        } else {
+            run = page_run(dst_addr, len);
+            src_addr += run;
+            dst_addr += run;
+        }
+
+        if (!read_pages(src, from, buf, run) || !write_pages(dst, to, buf, 0, run)) {
+            return end_range_call(false);
+        }
+        len -= run;
+    }
+    return end_range_call(true);
 }
 
 bool is_proc_same(struct Proc *proc1, struct Proc *proc2) {
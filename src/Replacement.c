@@ -0,0 +1,467 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Page replacement engine
+ * 1. replacement_on_fault is called before a frame is allocated for a page
+ * 2. replacement_select_victim is called only when memory is full, the victim
+ *    is removed from the policy's lists and returned to be evicted
+ * 3. replacement_on_map/on_access/on_free keep the lists up to date
+ *
+ * Clock and Second-Chance keep no reference bits of their own, they test and
+ * clear the accessed bits of the pages mapping a frame.
+ *
+ * All lists are intrusive doubly linked lists over frame (or ghost) indices,
+ * so every update on the access path is O(1).
+ */
+
+#define NIL INVALID_FRAME
+
+enum ListId { LIST_NONE, LIST_RESIDENT, LIST_T1, LIST_T2, LIST_B1, LIST_B2 };
+
+static void list_init(struct IndexList *list) {
+    list->head = NIL;
+    list->tail = NIL;
+    list->size = 0;
+}
+
+static void list_push_tail(struct IndexList *list, size_t *next, size_t *prev,
+                           size_t idx) {
+    next[idx] = NIL;
+    prev[idx] = list->tail;
+    if (list->tail != NIL) {
+        next[list->tail] = idx;
+    } else {
+        list->head = idx;
+    }
+    list->tail = idx;
+    list->size++;
+}
+
+static void list_remove(struct IndexList *list, size_t *next, size_t *prev, size_t idx) {
+    if (prev[idx] != NIL) {
+        next[prev[idx]] = next[idx];
+    } else {
+        list->head = next[idx];
+    }
+    if (next[idx] != NIL) {
+        prev[next[idx]] = prev[idx];
+    } else {
+        list->tail = prev[idx];
+    }
+    list->size--;
+}
+
+static size_t list_pop_head(struct IndexList *list, size_t *next, size_t *prev) {
+    size_t idx = list->head;
+    if (idx != NIL) {
+        list_remove(list, next, prev, idx);
+    }
+    return idx;
+}
+
+struct ReplacementEngine *create_replacement_engine(enum ReplacementPolicy policy,
+                                                    size_t frame_count) {
+    struct ReplacementEngine *engine =
+        (struct ReplacementEngine *)calloc(1, sizeof(struct ReplacementEngine));
+    engine->policy = policy;
+    engine->frame_count = frame_count;
+
+    engine->next = (size_t *)malloc(frame_count * sizeof(size_t));
+    engine->prev = (size_t *)malloc(frame_count * sizeof(size_t));
+    engine->list_id = (unsigned char *)calloc(frame_count, sizeof(unsigned char));
+    list_init(&engine->resident);
+    engine->clock_hand = 0;
+
+    list_init(&engine->t1);
+    list_init(&engine->t2);
+    list_init(&engine->b1);
+    list_init(&engine->b2);
+    list_init(&engine->ghost_free);
+    engine->arc_target = 0;
+    engine->pending_ghost_hit = LIST_NONE;
+
+    if (policy == REPLACE_ARC) {
+        // at most one ghost per usable frame, frame 0 is never used
+        size_t capacity = frame_count - 1;
+        engine->ghost_capacity = capacity;
+        engine->ghost_pid = (size_t *)malloc(capacity * sizeof(size_t));
+        engine->ghost_page_idx = (size_t *)malloc(capacity * sizeof(size_t));
+        engine->ghost_next = (size_t *)malloc(capacity * sizeof(size_t));
+        engine->ghost_prev = (size_t *)malloc(capacity * sizeof(size_t));
+        engine->ghost_hash_next = (size_t *)malloc(capacity * sizeof(size_t));
+        engine->ghost_list_id = (unsigned char *)calloc(capacity, sizeof(unsigned char));
+
+        engine->ghost_bucket_count = 1;
+        while (engine->ghost_bucket_count < 2 * capacity) {
+            engine->ghost_bucket_count <<= 1;
+        }
+        engine->ghost_buckets =
+            (size_t *)malloc(engine->ghost_bucket_count * sizeof(size_t));
+        for (size_t i = 0; i < engine->ghost_bucket_count; i++) {
+            engine->ghost_buckets[i] = NIL;
+        }
+        for (size_t i = 0; i < capacity; i++) {
+            list_push_tail(&engine->ghost_free, engine->ghost_next, engine->ghost_prev,
+                           i);
+        }
+    }
+    return engine;
+}
+
+void destroy_replacement_engine(struct ReplacementEngine *engine) {
+    free(engine->next);
+    free(engine->prev);
+    free(engine->list_id);
+    free(engine->ghost_pid);
+    free(engine->ghost_page_idx);
+    free(engine->ghost_next);
+    free(engine->ghost_prev);
+    free(engine->ghost_hash_next);
+    free(engine->ghost_list_id);
+    free(engine->ghost_buckets);
+    free(engine);
+}
+
+const char *replacement_policy_to_str(enum ReplacementPolicy policy) {
+    switch (policy) {
+    case REPLACE_FIFO:
+        return "FIFO";
+    case REPLACE_LRU:
+        return "LRU";
+    case REPLACE_CLOCK:
+        return "CLOCK";
+    case REPLACE_SECOND_CHANCE:
+        return "SECOND-CHANCE";
+    case REPLACE_ARC:
+        return "ARC";
+
+    default:
+        assert("Invalid replacement policy");
+    }
+    return NULL;
+}
+
+bool replacement_policy_from_str(const char *str, enum ReplacementPolicy *policy) {
+    static const char *names[] = {"fifo", "lru", "clock", "second-chance", "arc"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(str, names[i]) == 0) {
+            *policy = (enum ReplacementPolicy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * ARC ghost directory
+ * Ghosts only remember which page was evicted, they are found through a
+ * chained hash table keyed by (pid, page_idx).
+ */
+static size_t ghost_bucket(struct ReplacementEngine *engine, size_t pid,
+                           size_t page_idx) {
+    uint64_t hash = (page_idx ^ (pid << 48)) * 0x9E3779B97F4A7C15ull;
+    return (hash >> 32) & (engine->ghost_bucket_count - 1);
+}
+
+static size_t ghost_find(struct ReplacementEngine *engine, size_t pid,
+                         size_t page_idx) {
+    size_t g = engine->ghost_buckets[ghost_bucket(engine, pid, page_idx)];
+    while (g != NIL) {
+        if (engine->ghost_pid[g] == pid && engine->ghost_page_idx[g] == page_idx) {
+            return g;
+        }
+        g = engine->ghost_hash_next[g];
+    }
+    return NIL;
+}
+
+static struct IndexList *ghost_list(struct ReplacementEngine *engine,
+                                    unsigned char list_id) {
+    return list_id == LIST_B1 ? &engine->b1 : &engine->b2;
+}
+
+static void ghost_remove(struct ReplacementEngine *engine, size_t g) {
+    size_t *slot = &engine->ghost_buckets[ghost_bucket(engine, engine->ghost_pid[g],
+                                                       engine->ghost_page_idx[g])];
+    while (*slot != g) {
+        slot = &engine->ghost_hash_next[*slot];
+    }
+    *slot = engine->ghost_hash_next[g];
+
+    list_remove(ghost_list(engine, engine->ghost_list_id[g]), engine->ghost_next,
+                engine->ghost_prev, g);
+    engine->ghost_list_id[g] = LIST_NONE;
+    list_push_tail(&engine->ghost_free, engine->ghost_next, engine->ghost_prev, g);
+}
+
+static void ghost_insert(struct ReplacementEngine *engine, unsigned char list_id,
+                         size_t pid, size_t page_idx) {
+    if (engine->ghost_free.size == 0) {
+        ghost_remove(engine, engine->b2.size ? engine->b2.head : engine->b1.head);
+    }
+
+    size_t g = list_pop_head(&engine->ghost_free, engine->ghost_next, engine->ghost_prev);
+    engine->ghost_pid[g] = pid;
+    engine->ghost_page_idx[g] = page_idx;
+    engine->ghost_list_id[g] = list_id;
+    list_push_tail(ghost_list(engine, list_id), engine->ghost_next, engine->ghost_prev,
+                   g);
+
+    size_t *bucket = &engine->ghost_buckets[ghost_bucket(engine, pid, page_idx)];
+    engine->ghost_hash_next[g] = *bucket;
+    *bucket = g;
+
+    // keep |T1| + |B1| within the cache size
+    size_t cache_size = engine->frame_count - 1;
+    if (engine->t1.size + engine->b1.size > cache_size && engine->b1.size) {
+        ghost_remove(engine, engine->b1.head);
+    }
+}
+
+static struct IndexList *frame_list(struct ReplacementEngine *engine, size_t frame_idx) {
+    switch (engine->list_id[frame_idx]) {
+    case LIST_RESIDENT:
+        return &engine->resident;
+    case LIST_T1:
+        return &engine->t1;
+    case LIST_T2:
+        return &engine->t2;
+    }
+    return NULL;
+}
+
+static void move_frame_to(struct ReplacementEngine *engine, size_t frame_idx,
+                          unsigned char list_id) {
+    struct IndexList *list = frame_list(engine, frame_idx);
+    if (list != NULL) {
+        list_remove(list, engine->next, engine->prev, frame_idx);
+    }
+    engine->list_id[frame_idx] = list_id;
+    list = frame_list(engine, frame_idx);
+    if (list != NULL) {
+        list_push_tail(list, engine->next, engine->prev, frame_idx);
+    }
+}
+
+void replacement_on_fault(struct ReplacementEngine *engine, struct Proc *proc,
+                          size_t page_idx, bool is_major) {
+    engine->stats.faults++;
+    engine->stats.major_faults += is_major;
+
+    if (engine->policy != REPLACE_ARC) {
+        return;
+    }
+
+    // a hit in a ghost list adapts the target size of T1
+    engine->pending_ghost_hit = LIST_NONE;
+    size_t pid = proc ? proc->pid : 0;
+    size_t g = ghost_find(engine, pid, page_idx);
+    if (g == NIL) {
+        return;
+    }
+
+    size_t cache_size = engine->frame_count - 1;
+    size_t b1 = engine->b1.size, b2 = engine->b2.size;
+    if (engine->ghost_list_id[g] == LIST_B1) {
+        size_t delta = b2 > b1 ? b2 / b1 : 1;
+        engine->arc_target = engine->arc_target + delta < cache_size
+                                 ? engine->arc_target + delta
+                                 : cache_size;
+    } else {
+        size_t delta = b1 > b2 ? b1 / b2 : 1;
+        engine->arc_target = engine->arc_target > delta ? engine->arc_target - delta : 0;
+    }
+    engine->pending_ghost_hit = engine->ghost_list_id[g];
+    ghost_remove(engine, g);
+}
+
+static size_t select_clock_victim(struct ReplacementEngine *engine) {
+    // two full sweeps are enough to clear every reference bit once
+    for (size_t i = 0; i < 2 * engine->frame_count; i++) {
+        engine->clock_hand = (engine->clock_hand + 1) % engine->frame_count;
+        size_t frame_idx = engine->clock_hand;
+        if (engine->list_id[frame_idx] != LIST_RESIDENT) {
+            continue;
+        }
+        if (test_and_clear_frame_accessed(frame_idx)) {
+            continue;
+        }
+        engine->list_id[frame_idx] = LIST_NONE;
+        return frame_idx;
+    }
+    return NIL;
+}
+
+static size_t select_second_chance_victim(struct ReplacementEngine *engine) {
+    while (engine->resident.size) {
+        size_t frame_idx = list_pop_head(&engine->resident, engine->next, engine->prev);
+        if (!test_and_clear_frame_accessed(frame_idx)) {
+            engine->list_id[frame_idx] = LIST_NONE;
+            return frame_idx;
+        }
+        list_push_tail(&engine->resident, engine->next, engine->prev, frame_idx);
+    }
+    return NIL;
+}
+
+static size_t select_arc_victim(struct ReplacementEngine *engine) {
+    size_t t1 = engine->t1.size;
+    bool from_t1 = t1 >= 1 && ((engine->pending_ghost_hit == LIST_B2 &&
+                                t1 == engine->arc_target) ||
+                               t1 > engine->arc_target);
+    if (engine->t2.size == 0) {
+        from_t1 = true;
+    }
+
+    struct IndexList *list = from_t1 ? &engine->t1 : &engine->t2;
+    size_t frame_idx = list_pop_head(list, engine->next, engine->prev);
+    if (frame_idx == NIL) {
+        return NIL;
+    }
+    engine->list_id[frame_idx] = LIST_NONE;
+
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    ghost_insert(engine, from_t1 ? LIST_B1 : LIST_B2, frame->proc ? frame->proc->pid : 0,
+                 frame->page_idx);
+    return frame_idx;
+}
+
+// Returns the frame to be evicted, INVALID_FRAME if there is nothing to evict
+size_t replacement_select_victim(struct ReplacementEngine *engine) {
+    size_t frame_idx = NIL;
+
+    switch (engine->policy) {
+    case REPLACE_FIFO:
+    case REPLACE_LRU:
+        frame_idx = list_pop_head(&engine->resident, engine->next, engine->prev);
+        if (frame_idx != NIL) {
+            engine->list_id[frame_idx] = LIST_NONE;
+        }
+        break;
+    case REPLACE_CLOCK:
+        frame_idx = select_clock_victim(engine);
+        break;
+    case REPLACE_SECOND_CHANCE:
+        frame_idx = select_second_chance_victim(engine);
+        break;
+    case REPLACE_ARC:
+        frame_idx = select_arc_victim(engine);
+        break;
+
+    default:
+        assert("Invalid replacement policy");
+    }
+
+    if (frame_idx != NIL) {
+        engine->stats.evictions++;
+    }
+    return frame_idx;
+}
+
+void replacement_on_map(struct ReplacementEngine *engine, size_t frame_idx) {
+    switch (engine->policy) {
+    case REPLACE_FIFO:
+    case REPLACE_LRU:
+    case REPLACE_SECOND_CHANCE:
+        move_frame_to(engine, frame_idx, LIST_RESIDENT);
+        break;
+    case REPLACE_CLOCK:
+        // clock keeps no list, the hand sweeps over frame indices
+        engine->list_id[frame_idx] = LIST_RESIDENT;
+        break;
+    case REPLACE_ARC:
+        // pages seen recently enough to still have a ghost are frequent
+        move_frame_to(engine, frame_idx,
+                      engine->pending_ghost_hit != LIST_NONE ? LIST_T2 : LIST_T1);
+        engine->pending_ghost_hit = LIST_NONE;
+        break;
+
+    default:
+        assert("Invalid replacement policy");
+    }
+}
+
+void replacement_on_access(struct ReplacementEngine *engine, size_t frame_idx) {
+    if (engine->list_id[frame_idx] == LIST_NONE) {
+        return;
+    }
+
+    switch (engine->policy) {
+    case REPLACE_FIFO:
+    case REPLACE_CLOCK:
+    case REPLACE_SECOND_CHANCE:
+        break;
+    case REPLACE_LRU:
+        move_frame_to(engine, frame_idx, LIST_RESIDENT);
+        break;
+    case REPLACE_ARC:
+        move_frame_to(engine, frame_idx, LIST_T2);
+        break;
+
+    default:
+        assert("Invalid replacement policy");
+    }
+}
+
+// Forget a frame that was released without being evicted (unmap)
+void replacement_on_free(struct ReplacementEngine *engine, size_t frame_idx) {
+    if (engine->policy == REPLACE_CLOCK) {
+        engine->list_id[frame_idx] = LIST_NONE;
+    } else {
+        move_frame_to(engine, frame_idx, LIST_NONE);
+    }
+}
+
+void print_replacement_stats(struct ReplacementEngine *engine) {
+    struct ReplacementStats *stats = &engine->stats;
+    LOG_INFO("replacement policy: %s", replacement_policy_to_str(engine->policy));
+    LOG_INFO("page faults: %zu (major: %zu), evictions: %zu", stats->faults,
+             stats->major_faults, stats->evictions);
+    if (engine->policy == REPLACE_ARC) {
+        LOG_INFO("ARC T1 target: %zu, T1: %zu, T2: %zu, B1: %zu, B2: %zu",
+                 engine->arc_target, engine->t1.size, engine->t2.size, engine->b1.size,
+                 engine->b2.size);
+    }
+}
+
+/*
+ * Copy the state of an engine created with the same policy and frame count
+ * The arrays of dst are kept and overwritten.
+ */
+void copy_replacement_engine(struct ReplacementEngine *dst,
+                             struct ReplacementEngine *src) {
+    assert(dst->policy == src->policy && dst->frame_count == src->frame_count);
+    struct ReplacementEngine arrays = *dst;
+    size_t frames = src->frame_count;
+    size_t ghosts = src->ghost_capacity;
+
+    *dst = *src;
+    dst->next = arrays.next;
+    dst->prev = arrays.prev;
+    dst->list_id = arrays.list_id;
+    memcpy(dst->next, src->next, frames * sizeof(size_t));
+    memcpy(dst->prev, src->prev, frames * sizeof(size_t));
+    memcpy(dst->list_id, src->list_id, frames * sizeof(unsigned char));
+
+    if (src->policy != REPLACE_ARC) {
+        return;
+    }
+    dst->ghost_pid = arrays.ghost_pid;
+    dst->ghost_page_idx = arrays.ghost_page_idx;
+    dst->ghost_next = arrays.ghost_next;
+    dst->ghost_prev = arrays.ghost_prev;
+    dst->ghost_hash_next = arrays.ghost_hash_next;
+    dst->ghost_list_id = arrays.ghost_list_id;
+    dst->ghost_buckets = arrays.ghost_buckets;
+    memcpy(dst->ghost_pid, src->ghost_pid, ghosts * sizeof(size_t));
+    memcpy(dst->ghost_page_idx, src->ghost_page_idx, ghosts * sizeof(size_t));
+    memcpy(dst->ghost_next, src->ghost_next, ghosts * sizeof(size_t));
+    memcpy(dst->ghost_prev, src->ghost_prev, ghosts * sizeof(size_t));
+    memcpy(dst->ghost_hash_next, src->ghost_hash_next, ghosts * sizeof(size_t));
+    memcpy(dst->ghost_list_id, src->ghost_list_id, ghosts * sizeof(unsigned char));
+    memcpy(dst->ghost_buckets, src->ghost_buckets,
+           src->ghost_bucket_count * sizeof(size_t));
+}
@@ -0,0 +1,144 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Shared segments map one set of frames into the page tables of several
+ * processes. Attaching and detaching changes mappings outside of any
+ * operation, so like a fork it can not be rolled back and clears the exec log.
+ */
+
+// Drop one reference to a segment frame held by proc at page_idx
+static void put_shared_frame(size_t frame_idx, struct Proc *proc, size_t page_idx) {
+    if (remove_frame_mapping(sim->frame_allocator, frame_idx, proc, page_idx) == 0) {
+        free_frame(sim->frame_allocator, frame_idx);
+    }
+}
+
+// Returns NULL if there are not enough free frames, segment frames are never evicted
+struct SharedSegment *create_shared_segment(const char *name, size_t page_count) {
+    assert(page_count > 0);
+    if (sim->timeline) {
+        LOG_ERROR("%s: shared segments can not be created while a timeline is recording",
+                  name);
+        return NULL;
+    }
+
+    struct SharedSegment *segment =
+        (struct SharedSegment *)malloc(sizeof(struct SharedSegment));
+    segment->name = (char *)malloc(strlen(name) + 1);
+    strcpy(segment->name, name);
+    segment->frames = (size_t *)malloc(page_count * sizeof(size_t));
+    segment->page_count = 0;
+
+    while (segment->page_count < page_count) {
+        size_t frame_idx = alloc_frame(sim->frame_allocator);
+        if (frame_idx == INVALID_FRAME) {
+            LOG_ERROR("%s: Out of memory after %zu of %zu pages", name,
+                      segment->page_count, page_count);
+            destroy_shared_segment(segment);
+            return NULL;
+        }
+
+        sim->frame_db[frame_idx].is_shared = true;
+        sim->frame_db[frame_idx].proc = NULL;
+        sim->frame_db[frame_idx].page_idx = segment->page_count;
+        memset(&sim->phy_mem[frame_idx * FRAME_SIZE], 0, FRAME_SIZE);
+        segment->frames[segment->page_count++] = frame_idx;
+    }
+    return segment;
+}
+
+/*
+ * Give up the references of the segment itself
+ * Frames still attached somewhere stay mapped until their last page goes.
+ */
+void destroy_shared_segment(struct SharedSegment *segment) {
+    for (size_t i = 0; i < segment->page_count; i++) {
+        put_shared_frame(segment->frames[i], NULL, i);
+    }
+    free(segment->frames);
+    free(segment->name);
+    free(segment);
+}
+
+// Map every page of the segment starting at virt_addr, the range must be unmapped
+bool attach_shared_segment(struct Proc *proc, struct SharedSegment *segment,
+                           virt_addr_t virt_addr) {
+    struct PageTable *pt = proc->page_table;
+    size_t first_page = virt_addr / PAGE_SIZE;
+
+    if (sim->timeline) {
+        LOG_ERROR("%s: attaching %s is not supported while a timeline is recording",
+                  proc->name, segment->name);
+        return false;
+    }
+    if (virt_addr == 0 || virt_addr % PAGE_SIZE != 0 ||
+        first_page + segment->page_count > pt->size) {
+        LOG_ERROR("%s: can not attach %s at %p", proc->name, segment->name,
+                  (void *)virt_addr);
+        return false;
+    }
+    for (size_t i = 0; i < segment->page_count; i++) {
+        if (get_pte(pt, first_page + i) != 0 || is_page_evicted(pt, first_page + i)) {
+            LOG_ERROR("%s: page %zu is already mapped, can not attach %s", proc->name,
+                      first_page + i, segment->name);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < segment->page_count; i++) {
+        share_page(pt, first_page + i, segment->frames[i] * FRAME_SIZE | PTE_USER_PAGE);
+    }
+
+    if (this_cpu->exec_log) {
+        clear_exec_log(this_cpu->exec_log);
+    }
+    return true;
+}
+
+// Unmap the pages of the segment that are still mapped at virt_addr
+void detach_shared_segment(struct Proc *proc, struct SharedSegment *segment,
+                           virt_addr_t virt_addr) {
+    struct PageTable *pt = proc->page_table;
+    size_t first_page = virt_addr / PAGE_SIZE;
+
+    if (sim->timeline) {
+        LOG_ERROR("%s: detaching %s is not supported while a timeline is recording",
+                  proc->name, segment->name);
+        return;
+    }
+    for (size_t i = 0; i < segment->page_count; i++) {
+        uintptr_t frame_addr = get_page_table_entry(pt, first_page + i);
+        // the page may have been unmapped on its own since the attach
+        if (frame_addr == segment->frames[i] * FRAME_SIZE) {
+            release_page(pt, first_page + i, false);
+        }
+    }
+
+    if (this_cpu->exec_log) {
+        clear_exec_log(this_cpu->exec_log);
+    }
+}
+
+// Frames mapped by more than one page, counted once in the memory footprint
+void print_shared_frame_stats() {
+    size_t shared = 0, mappings = 0, pinned = 0;
+    for (size_t i = 1; i < sim->frame_count; i++) {
+        if (!sim->frame_db[i].is_used) {
+            continue;
+        }
+        size_t pages = frame_mapping_count(i);
+        pinned += sim->frame_db[i].is_shared;
+        if (pages > 1) {
+            shared++;
+            mappings += pages;
+        }
+    }
+    if (shared == 0 && pinned == 0) {
+        return;
+    }
+    LOG_INFO("shared frames: %zu (%zu mappings, %zu frames saved), segment frames: %zu",
+             shared, mappings, mappings - shared, pinned);
+}
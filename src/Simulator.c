@@ -0,0 +1,367 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Simulated machine and its CPUs
+ * The engine reaches the machine through sim and the running CPU through
+ * this_cpu, both are per host thread. Locking is only done while the CPUs
+ * run concurrently (run_on_cpus), the UI and single CPU runs never lock.
+ */
+
+_Thread_local struct Simulator *sim = NULL;
+_Thread_local struct CPU *this_cpu = NULL;
+_Thread_local unsigned page_shift = DEFAULT_PAGE_SHIFT;
+
+// The calling thread is bound to the first CPU of the new machine
+struct Simulator *create_simulator(struct SimulatorConfig config) {
+    assert(config.cpu_count > 0 && config.cpu_count <= MAX_CPU_COUNT);
+    assert(config.page_shift >= MIN_PAGE_SHIFT && config.page_shift <= MAX_PAGE_SHIFT);
+
+    // sizes below are in pages of the new machine
+    page_shift = config.page_shift;
+
+    struct Simulator *simulator = (struct Simulator *)malloc(sizeof(struct Simulator));
+    simulator->frame_count = config.frame_count;
+    simulator->page_shift = config.page_shift;
+    simulator->phy_mem = (unsigned char *)malloc(config.frame_count * FRAME_SIZE);
+    // frame 0 is never allocated, it is the zero page
+    memset(simulator->phy_mem, 0, FRAME_SIZE);
+    simulator->frame_db =
+        (struct FrameDBEntry *)calloc(config.frame_count, sizeof(struct FrameDBEntry));
+    simulator->frame_generation =
+        (uint32_t *)calloc(config.frame_count, sizeof(uint32_t));
+    simulator->frame_allocator = create_frame_allocator(config.frame_count);
+    simulator->replacement = create_replacement_engine(config.policy, config.frame_count);
+    simulator->timeline = NULL;
+    simulator->stack_distance = NULL;
+    simulator->heatmap = NULL;
+    simulator->swap = NULL;
+    simulator->zero_pool = NULL;
+    simulator->events = NULL;
+    simulator->page_table_version = 1;
+    simulator->concurrent = false;
+    pthread_mutex_init(&simulator->mm_lock, NULL);
+
+    // CPUs are cache line aligned, a CPU only writes to its own lines
+    simulator->cpu_count = config.cpu_count;
+    simulator->cpus = (struct CPU *)aligned_alloc(_Alignof(struct CPU),
+                                                  config.cpu_count * sizeof(struct CPU));
+    assert(simulator->cpus != NULL);
+    for (size_t i = 0; i < config.cpu_count; i++) {
+        struct CPU *cpu = &simulator->cpus[i];
+        memset(cpu, 0, sizeof(struct CPU));
+        cpu->id = i;
+        cpu->sim = simulator;
+        cpu->tlb = create_tlb(config.tlb);
+        cpu->exec_log = config.keep_exec_log ? create_exec_log(config.exec_log) : NULL;
+        cpu->held = CPU_UNLOCKED;
+        cpu->fault_page = (unsigned char *)malloc((size_t)1 << config.page_shift);
+        cpu->copy_page = (unsigned char *)malloc((size_t)1 << config.page_shift);
+        assert(cpu->fault_page != NULL && cpu->copy_page != NULL);
+        cpu->event_ring = (struct ReplacementEvent *)malloc(
+            CPU_EVENT_RING * sizeof(struct ReplacementEvent));
+        assert(cpu->event_ring != NULL);
+        pthread_mutex_init(&cpu->lock, NULL);
+    }
+    bind_cpu(&simulator->cpus[0]);
+    if (config.zero_pool_frames > 0) {
+        simulator->zero_pool = create_zero_pool(config.zero_pool_frames);
+    }
+    return simulator;
+}
+
+void destroy_simulator(struct Simulator *simulator) {
+    for (size_t i = 0; i < simulator->cpu_count; i++) {
+        struct CPU *cpu = &simulator->cpus[i];
+        destroy_tlb(cpu->tlb);
+        if (cpu->exec_log) {
+            destroy_exec_log(cpu->exec_log);
+        }
+        free(cpu->fault_page);
+        free(cpu->copy_page);
+        free(cpu->event_ring);
+        pthread_mutex_destroy(&cpu->lock);
+    }
+    free(simulator->cpus);
+
+    if (simulator->swap) {
+        destroy_swap(simulator->swap);
+    }
+    if (simulator->zero_pool) {
+        destroy_zero_pool(simulator->zero_pool);
+    }
+    pthread_mutex_destroy(&simulator->mm_lock);
+    destroy_replacement_engine(simulator->replacement);
+    destroy_frame_allocator(simulator->frame_allocator);
+    free(simulator->frame_db);
+    free(simulator->frame_generation);
+    free(simulator->phy_mem);
+    free(simulator);
+
+    if (sim == simulator) {
+        sim = NULL;
+        this_cpu = NULL;
+    }
+}
+
+// Run the calling thread as cpu, on the machine of the cpu
+void bind_cpu(struct CPU *cpu) {
+    sim = cpu->sim;
+    this_cpu = cpu;
+    page_shift = cpu->sim->page_shift;
+}
+
+// Move a process to another CPU, its translations are left behind
+void migrate_proc(struct Proc *proc, struct CPU *cpu) {
+    if (proc->cpu == cpu) {
+        return;
+    }
+    if (proc->cpu->tlb) {
+        tlb_flush_proc(proc->cpu->tlb, proc);
+    }
+    proc->cpu = cpu;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The clock is only read when the mutex is held by someone else
+static void lock_mutex(pthread_mutex_t *mutex, size_t *waits) {
+    if (pthread_mutex_trylock(mutex) == 0) {
+        return;
+    }
+    (*waits)++;
+    uint64_t start = now_ns();
+    pthread_mutex_lock(mutex);
+    this_cpu->stats.wait_ns += now_ns() - start;
+}
+
+static void apply_event(struct ReplacementEvent *event) {
+    if (event->proc) {
+        replacement_on_fault(sim->replacement, event->proc, event->page_idx,
+                             event->is_major);
+        replacement_on_map(sim->replacement, event->frame_idx);
+    } else {
+        replacement_on_access(sim->replacement, event->frame_idx);
+    }
+}
+
+static void apply_event_batch(struct CPU *cpu) {
+    for (size_t i = 0; i < cpu->event_count; i++) {
+        apply_event(&cpu->event_batch[i]);
+    }
+    cpu->event_count = 0;
+}
+
+/*
+ * Hand the events queued without mm_lock to the replacement engine, needs
+ * mm_lock. The rings of every CPU are taken, the batches still being filled
+ * only of the running CPU, or of every CPU with the world stopped.
+ */
+static void drain_replacement_events() {
+    if (sim->replacement == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < sim->cpu_count; i++) {
+        struct CPU *cpu = &sim->cpus[i];
+        size_t tail = __atomic_load_n(&cpu->ring_tail, __ATOMIC_ACQUIRE);
+        for (size_t head = cpu->ring_head; head != tail; head++) {
+            apply_event(&cpu->event_ring[head & (CPU_EVENT_RING - 1)]);
+        }
+        __atomic_store_n(&cpu->ring_head, tail, __ATOMIC_RELEASE);
+        if (cpu == this_cpu || this_cpu->held == CPU_LOCK_WORLD) {
+            apply_event_batch(cpu);
+        }
+    }
+}
+
+/*
+ * Raise the locks held by the running CPU to level
+ * The world can only be stopped with no lock held, so the locks held are
+ * dropped first: anything read under them may have changed since and false
+ * is returned. Locks are kept until cpu_unlock().
+ */
+bool cpu_lock(enum CPULock level) {
+    struct CPU *cpu = this_cpu;
+    if (!sim->concurrent || cpu->held >= level) {
+        return true;
+    }
+
+    bool kept = true;
+    if (level == CPU_LOCK_WORLD) {
+        kept = cpu->held == CPU_UNLOCKED;
+        cpu_unlock();
+        for (size_t i = 0; i < sim->cpu_count; i++) {
+            lock_mutex(&sim->cpus[i].lock, &cpu->stats.cpu_waits);
+        }
+        cpu->stats.world_stops++;
+    } else if (cpu->held == CPU_UNLOCKED) {
+        lock_mutex(&cpu->lock, &cpu->stats.cpu_waits);
+    }
+
+    if (level >= CPU_LOCK_MM) {
+        lock_mutex(&sim->mm_lock, &cpu->stats.mm_waits);
+        cpu->stats.mm_locks++;
+    }
+    cpu->held = level;
+    if (level >= CPU_LOCK_MM) {
+        // events so far are seen before the fault changes the lists
+        drain_replacement_events();
+    }
+    return kept;
+}
+
+void cpu_unlock() {
+    struct CPU *cpu = this_cpu;
+    if (!sim->concurrent || cpu->held == CPU_UNLOCKED) {
+        return;
+    }
+
+    if (cpu->held >= CPU_LOCK_MM) {
+        pthread_mutex_unlock(&sim->mm_lock);
+    }
+    if (cpu->held == CPU_LOCK_WORLD) {
+        for (size_t i = sim->cpu_count; i-- > 0;) {
+            pthread_mutex_unlock(&sim->cpus[i].lock);
+        }
+    } else {
+        pthread_mutex_unlock(&cpu->lock);
+    }
+    cpu->held = CPU_UNLOCKED;
+}
+
+/*
+ * Queue an event of the running CPU, a full batch is published on the ring of
+ * the CPU without a lock. Only a full ring makes the CPU take mm_lock.
+ */
+static void queue_event(struct ReplacementEvent event) {
+    struct CPU *cpu = this_cpu;
+    cpu->event_batch[cpu->event_count++] = event;
+    if (cpu->event_count < CPU_EVENT_BATCH) {
+        return;
+    }
+
+    size_t head = __atomic_load_n(&cpu->ring_head, __ATOMIC_ACQUIRE);
+    if (cpu->ring_tail - head > CPU_EVENT_RING - CPU_EVENT_BATCH) {
+        cpu->stats.ring_full++;
+        cpu_lock(CPU_LOCK_MM);
+        return;
+    }
+    size_t tail = cpu->ring_tail;
+    for (size_t i = 0; i < CPU_EVENT_BATCH; i++) {
+        cpu->event_ring[(tail + i) & (CPU_EVENT_RING - 1)] = cpu->event_batch[i];
+    }
+    __atomic_store_n(&cpu->ring_tail, tail + CPU_EVENT_BATCH, __ATOMIC_RELEASE);
+    cpu->event_count = 0;
+}
+
+/*
+ * Access to a resident frame for the replacement policy
+ * Without mm_lock the access is queued and handed over once the CPU or another
+ * one takes mm_lock, so the policy sees accesses a little late. A queued frame
+ * that got evicted meanwhile is ignored by the policy.
+ */
+void note_frame_access(size_t frame_idx) {
+    if (sim->replacement == NULL) {
+        return;
+    }
+    if (!sim->concurrent || this_cpu->held >= CPU_LOCK_MM) {
+        replacement_on_access(sim->replacement, frame_idx);
+        return;
+    }
+    queue_event((struct ReplacementEvent){.frame_idx = frame_idx});
+}
+
+/*
+ * Fault that mapped frame_idx without mm_lock, queued like an access
+ * Faults can only map frames from the frame cache this way and the world is
+ * stopped before a victim is picked, so the engine knows the frame by then.
+ */
+void note_frame_fault(size_t frame_idx, struct Proc *proc, size_t page_idx,
+                      bool is_major) {
+    if (sim->replacement == NULL) {
+        return;
+    }
+    queue_event((struct ReplacementEvent){.frame_idx = frame_idx,
+                                          .proc = proc,
+                                          .page_idx = page_idx,
+                                          .is_major = is_major});
+}
+
+struct CPURun {
+    struct CPU *cpu;
+    next_operation_fn next;
+    void *source;
+};
+
+static void *run_cpu(void *arg) {
+    struct CPURun *run = (struct CPURun *)arg;
+    bind_cpu(run->cpu);
+
+    struct Operation op;
+    while (run->next(run->source, &op)) {
+        cpu_lock(CPU_LOCK_OWN);
+        perform_operation(&op);
+        this_cpu->stats.ops++;
+        this_cpu->stats.local_ops += this_cpu->held == CPU_LOCK_OWN;
+        cpu_unlock();
+    }
+
+    // hand over the events still queued
+    cpu_lock(CPU_LOCK_MM);
+    cpu_unlock();
+    return NULL;
+}
+
+/*
+ * Run every CPU of the machine on a host thread until its source runs dry
+ * CPU i takes its operations from sources[i], they should only be of the
+ * processes on CPU i.
+ */
+void run_on_cpus(next_operation_fn next, void **sources) {
+    struct Simulator *simulator = sim;
+    size_t count = simulator->cpu_count;
+    pthread_t *threads = (pthread_t *)malloc(count * sizeof(pthread_t));
+    struct CPURun *runs = (struct CPURun *)malloc(count * sizeof(struct CPURun));
+
+    simulator->concurrent = count > 1;
+    for (size_t i = 0; i < count; i++) {
+        runs[i] = (struct CPURun){
+            .cpu = &simulator->cpus[i], .next = next, .source = sources[i]};
+        int err = pthread_create(&threads[i], NULL, run_cpu, &runs[i]);
+        assert(err == 0 && "[FATAL] Could not start a CPU thread");
+        (void)err;
+    }
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    simulator->concurrent = false;
+    // every CPU handed over its events on the way out, the frames it cached are
+    // free memory again
+    for (size_t i = 0; i < count; i++) {
+        return_cached_frames(simulator->frame_allocator, &simulator->cpus[i]);
+    }
+
+    free(runs);
+    free(threads);
+}
+
+void print_cpu_stats() {
+    for (size_t i = 0; i < sim->cpu_count; i++) {
+        struct CPUStats *stats = &sim->cpus[i].stats;
+        double local = stats->ops ? 100.0 * stats->local_ops / stats->ops : 0;
+
+        LOG_INFO("cpu %zu: ops: %zu (%.1f%% local), mm lock: %zu (waits: %zu)", i,
+                 stats->ops, local, stats->mm_locks, stats->mm_waits);
+        LOG_INFO("cpu %zu: world stops: %zu, cpu lock waits: %zu, time waiting: %.3f ms",
+                 i, stats->world_stops, stats->cpu_waits, stats->wait_ns / 1e6);
+        LOG_INFO("cpu %zu: faults from the frame cache: %zu, full event rings: %zu", i,
+                 stats->cached_faults, stats->ring_full);
+    }
+}
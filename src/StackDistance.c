@@ -0,0 +1,232 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * One pass LRU miss-ratio curve
+ * Access times only grow, so the tree runs out of room after tree_capacity
+ * accesses. The marks are then renumbered in order to 0 .. page_count - 1,
+ * which keeps every distance, and the tree is rebuilt. The tree is doubled
+ * when more than half of it would be live marks.
+ */
+
+static inline uint64_t mix_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+// The low bits decide the sampling, slots come from the high ones
+static inline size_t key_slot(uint64_t hash, size_t capacity) {
+    return (size_t)(hash >> 32) & (capacity - 1);
+}
+
+// Sample 1 in sample_rate pages, 0 or 1 tracks every page
+struct StackDistance *create_stack_distance(size_t sample_rate) {
+    struct StackDistance *sd =
+        (struct StackDistance *)calloc(1, sizeof(struct StackDistance));
+    sd->sample_threshold =
+        sample_rate > 1 ? SHARDS_MODULUS / sample_rate : SHARDS_MODULUS;
+    if (sd->sample_threshold == 0) {
+        sd->sample_threshold = 1;
+    }
+
+    sd->map_capacity = STACK_DISTANCE_INITIAL_CAPACITY;
+    sd->keys = (uint64_t *)calloc(sd->map_capacity, sizeof(uint64_t));
+    sd->last_access = (uint64_t *)malloc(sd->map_capacity * sizeof(uint64_t));
+    sd->tree_capacity = STACK_DISTANCE_INITIAL_CAPACITY;
+    sd->tree = (uint32_t *)calloc(sd->tree_capacity + 1, sizeof(uint32_t));
+    sd->histogram_size = STACK_DISTANCE_INITIAL_CAPACITY;
+    sd->histogram = (uint64_t *)calloc(sd->histogram_size, sizeof(uint64_t));
+    return sd;
+}
+
+void destroy_stack_distance(struct StackDistance *sd) {
+    free(sd->keys);
+    free(sd->last_access);
+    free(sd->tree);
+    free(sd->histogram);
+    free(sd);
+}
+
+// Fenwick tree, time t is at index t + 1
+static void tree_add(struct StackDistance *sd, uint64_t time, int32_t delta) {
+    for (size_t i = time + 1; i <= sd->tree_capacity; i += i & -i) {
+        sd->tree[i] += delta;
+    }
+}
+
+// Marks at times up to and including time
+static size_t tree_prefix(struct StackDistance *sd, uint64_t time) {
+    size_t sum = 0;
+    for (size_t i = time + 1; i > 0; i -= i & -i) {
+        sum += sd->tree[i];
+    }
+    return sum;
+}
+
+static void compact_tree(struct StackDistance *sd) {
+    if (sd->page_count * 2 > sd->tree_capacity) {
+        sd->tree_capacity *= 2;
+        free(sd->tree);
+        sd->tree = (uint32_t *)malloc((sd->tree_capacity + 1) * sizeof(uint32_t));
+    }
+
+    // times are distinct and below now, bucket the pages by time
+    size_t *by_time = (size_t *)malloc(sd->now * sizeof(size_t));
+    memset(by_time, 0xFF, sd->now * sizeof(size_t));
+    for (size_t slot = 0; slot < sd->map_capacity; slot++) {
+        if (sd->keys[slot] != 0) {
+            by_time[sd->last_access[slot]] = slot;
+        }
+    }
+    uint64_t time = 0;
+    for (uint64_t t = 0; t < sd->now; t++) {
+        if (by_time[t] != SIZE_MAX) {
+            sd->last_access[by_time[t]] = time++;
+        }
+    }
+    free(by_time);
+
+    // every time below page_count is marked, build the tree in place
+    memset(sd->tree, 0, (sd->tree_capacity + 1) * sizeof(uint32_t));
+    for (size_t i = 1; i <= time; i++) {
+        sd->tree[i] = 1;
+    }
+    for (size_t i = 1; i <= sd->tree_capacity; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= sd->tree_capacity) {
+            sd->tree[parent] += sd->tree[i];
+        }
+    }
+    sd->now = time;
+    sd->compactions++;
+}
+
+static void grow_map(struct StackDistance *sd) {
+    size_t old_capacity = sd->map_capacity;
+    uint64_t *old_keys = sd->keys;
+    uint64_t *old_last = sd->last_access;
+
+    sd->map_capacity *= 2;
+    sd->keys = (uint64_t *)calloc(sd->map_capacity, sizeof(uint64_t));
+    sd->last_access = (uint64_t *)malloc(sd->map_capacity * sizeof(uint64_t));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_keys[i] == 0) {
+            continue;
+        }
+        size_t slot = key_slot(mix_key(old_keys[i]), sd->map_capacity);
+        while (sd->keys[slot] != 0) {
+            slot = (slot + 1) & (sd->map_capacity - 1);
+        }
+        sd->keys[slot] = old_keys[i];
+        sd->last_access[slot] = old_last[i];
+    }
+    free(old_keys);
+    free(old_last);
+}
+
+static void record_distance(struct StackDistance *sd, size_t distance) {
+    if (distance >= sd->histogram_size) {
+        size_t old_size = sd->histogram_size;
+        while (distance >= sd->histogram_size) {
+            sd->histogram_size *= 2;
+        }
+        sd->histogram =
+            (uint64_t *)realloc(sd->histogram, sd->histogram_size * sizeof(uint64_t));
+        memset(sd->histogram + old_size, 0,
+               (sd->histogram_size - old_size) * sizeof(uint64_t));
+    }
+    sd->histogram[distance]++;
+}
+
+void stack_distance_access(struct StackDistance *sd, size_t pid, size_t page_idx) {
+    uint64_t key = ((uint64_t)pid << 40 | page_idx) + 1;
+    uint64_t hash = mix_key(key);
+    if ((hash & (SHARDS_MODULUS - 1)) >= sd->sample_threshold) {
+        sd->skipped++;
+        return;
+    }
+
+    sd->accesses++;
+    if (sd->now == sd->tree_capacity) {
+        compact_tree(sd);
+    }
+    if ((sd->page_count + 1) * 2 > sd->map_capacity) {
+        grow_map(sd);
+    }
+
+    size_t slot = key_slot(hash, sd->map_capacity);
+    while (sd->keys[slot] != 0 && sd->keys[slot] != key) {
+        slot = (slot + 1) & (sd->map_capacity - 1);
+    }
+
+    if (sd->keys[slot] == key) {
+        // pages accessed after the last access to this one
+        uint64_t last = sd->last_access[slot];
+        record_distance(sd, sd->page_count - tree_prefix(sd, last));
+        tree_add(sd, last, -1);
+    } else {
+        sd->keys[slot] = key;
+        sd->page_count++;
+        sd->cold_misses++;
+    }
+    tree_add(sd, sd->now, 1);
+    sd->last_access[slot] = sd->now++;
+}
+
+// A sampled distance hits with frames frames if it is below frames * rate
+static inline bool hits_with(struct StackDistance *sd, size_t distance, size_t frames) {
+    return (uint64_t)distance * SHARDS_MODULUS < (uint64_t)frames * sd->sample_threshold;
+}
+
+// Scale a count of sampled accesses to all accesses
+static size_t scale_to_all(struct StackDistance *sd, uint64_t sampled) {
+    if (sd->accesses == 0) {
+        return 0;
+    }
+    return (size_t)((double)sampled * (sd->accesses + sd->skipped) / sd->accesses + 0.5);
+}
+
+// Faults of LRU with frames frames, estimated when sampling
+size_t stack_distance_misses(struct StackDistance *sd, size_t frames) {
+    uint64_t hits = 0;
+    for (size_t d = 0; d < sd->histogram_size && hits_with(sd, d, frames); d++) {
+        hits += sd->histogram[d];
+    }
+    return scale_to_all(sd, sd->accesses - hits);
+}
+
+/*
+ * Print the curve as CSV to stdout. The curve is a step function, there is
+ * one line for every frame count at which it steps down.
+ */
+void print_miss_ratio_curve(struct StackDistance *sd) {
+    double rate = (double)sd->sample_threshold / SHARDS_MODULUS;
+    LOG_INFO("stack distance: %lu accesses (%.2f%% sampled), %zu pages, %zu compactions",
+             (unsigned long)(sd->accesses + sd->skipped), 100.0 * rate, sd->page_count,
+             sd->compactions);
+    LOG_INFO("stack distance: %zu KiB",
+             ((sd->map_capacity * 2 + sd->histogram_size) * sizeof(uint64_t) +
+              (sd->tree_capacity + 1) * sizeof(uint32_t)) >>
+                 10);
+
+    printf("frames,miss_ratio,misses\n");
+    uint64_t misses = sd->accesses;
+    printf("0,%.6f,%zu\n", sd->accesses ? 1.0 : 0.0, scale_to_all(sd, misses));
+    for (size_t d = 0; d < sd->histogram_size; d++) {
+        if (sd->histogram[d] == 0) {
+            continue;
+        }
+        misses -= sd->histogram[d];
+        // the fewest frames with which distance d hits
+        size_t frames = (size_t)((uint64_t)d * SHARDS_MODULUS / sd->sample_threshold) + 1;
+        printf("%zu,%.6f,%zu\n", frames, (double)misses / sd->accesses,
+               scale_to_all(sd, misses));
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,365 @@
+#include <fcntl.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Swap file and its I/O threads
+ * Slots and references are only touched by the CPU, the cache entries and
+ * the queue are shared with the I/O threads and guarded by the lock. An entry
+ * is not changed while its I/O is running, so the threads read it unlocked.
+ */
+
+static void *swap_io_thread(void *arg) {
+    struct Swap *swap = (struct Swap *)arg;
+
+    pthread_mutex_lock(&swap->lock);
+    for (;;) {
+        while (swap->queue_count == 0 && !swap->stop) {
+            pthread_cond_wait(&swap->pending, &swap->lock);
+        }
+        // the queue is drained before stopping
+        if (swap->queue_count == 0) {
+            break;
+        }
+        struct SwapCacheEntry *entry = &swap->cache[swap->queue[swap->queue_head]];
+        swap->queue_head = (swap->queue_head + 1) % swap->cache_size;
+        swap->queue_count--;
+        pthread_mutex_unlock(&swap->lock);
+
+        if (swap->device_latency_ns) {
+            struct timespec pause = {.tv_sec = swap->device_latency_ns / 1000000000,
+                                     .tv_nsec = swap->device_latency_ns % 1000000000};
+            nanosleep(&pause, NULL);
+        }
+        off_t offset = (off_t)entry->slot * swap->page_size;
+        ssize_t done = entry->io == SWAP_READING
+                           ? pread(swap->fd, entry->data, swap->page_size, offset)
+                           : pwrite(swap->fd, entry->data, swap->page_size, offset);
+        assert(done == (ssize_t)swap->page_size && "[FATAL] Swap I/O failed");
+        (void)done;
+
+        pthread_mutex_lock(&swap->lock);
+        entry->io = SWAP_IDLE;
+        pthread_cond_broadcast(&swap->done);
+    }
+    pthread_mutex_unlock(&swap->lock);
+    return NULL;
+}
+
+/*
+ * Create a swap file of config.size bytes at path, it is removed again when
+ * the swap is destroyed. Returns NULL if the file can not be created.
+ */
+struct Swap *create_swap(const char *path, struct SwapConfig config) {
+    size_t slot_count = config.size / PAGE_SIZE;
+    if (slot_count < 2 || config.io_threads == 0 || config.readahead == 0 ||
+        config.cache_pages <= config.readahead) {
+        LOG_ERROR("Invalid swap: %zu slots, %zu threads, %zu readahead, %zu cached",
+                  slot_count, config.io_threads, config.readahead, config.cache_pages);
+        return NULL;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)slot_count * PAGE_SIZE) != 0) {
+        LOG_ERROR("Failed to create swap file %s", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    struct Swap *swap = (struct Swap *)calloc(1, sizeof(struct Swap));
+    swap->path = strdup(path);
+    swap->fd = fd;
+    swap->page_size = PAGE_SIZE;
+    swap->device_latency_ns = config.device_latency_ns;
+    swap->slot_count = slot_count;
+    swap->slot_refs = (size_t *)calloc(slot_count, sizeof(size_t));
+    swap->slot_cache = (size_t *)calloc(slot_count, sizeof(size_t));
+    swap->cursor = 1;
+    swap->readahead = config.readahead;
+
+    swap->cache_size = config.cache_pages;
+    swap->cache =
+        (struct SwapCacheEntry *)calloc(swap->cache_size, sizeof(struct SwapCacheEntry));
+    swap->buffers = (unsigned char *)malloc(swap->cache_size * PAGE_SIZE);
+    assert(swap->buffers != NULL);
+    for (size_t i = 0; i < swap->cache_size; i++) {
+        swap->cache[i].data = &swap->buffers[i * PAGE_SIZE];
+    }
+    swap->queue = (size_t *)malloc(swap->cache_size * sizeof(size_t));
+
+    pthread_mutex_init(&swap->lock, NULL);
+    pthread_cond_init(&swap->pending, NULL);
+    pthread_cond_init(&swap->done, NULL);
+    swap->thread_count = config.io_threads;
+    swap->threads = (pthread_t *)malloc(swap->thread_count * sizeof(pthread_t));
+    for (size_t i = 0; i < swap->thread_count; i++) {
+        int err = pthread_create(&swap->threads[i], NULL, swap_io_thread, swap);
+        assert(err == 0 && "[FATAL] Could not start a swap I/O thread");
+        (void)err;
+    }
+
+    LOG_INFO("swap: %s, %zu slots, %zu I/O threads, readahead %zu", path, slot_count - 1,
+             swap->thread_count, swap->readahead);
+    return swap;
+}
+
+// Waits for the I/O still running
+void destroy_swap(struct Swap *swap) {
+    pthread_mutex_lock(&swap->lock);
+    swap->stop = true;
+    pthread_cond_broadcast(&swap->pending);
+    pthread_mutex_unlock(&swap->lock);
+    for (size_t i = 0; i < swap->thread_count; i++) {
+        pthread_join(swap->threads[i], NULL);
+    }
+
+    if (swap->used_slots != 0) {
+        LOG_WARN("swap: %zu slots still in use", swap->used_slots);
+    }
+    close(swap->fd);
+    unlink(swap->path);
+
+    pthread_cond_destroy(&swap->done);
+    pthread_cond_destroy(&swap->pending);
+    pthread_mutex_destroy(&swap->lock);
+    free(swap->threads);
+    free(swap->queue);
+    free(swap->buffers);
+    free(swap->cache);
+    free(swap->slot_cache);
+    free(swap->slot_refs);
+    free(swap->path);
+    free(swap);
+}
+
+/*
+ * Cache helpers, the lock is held by the caller
+ */
+
+static void wait_for_io(struct Swap *swap, struct SwapCacheEntry *entry) {
+    while (entry->io != SWAP_IDLE) {
+        pthread_cond_wait(&swap->done, &swap->lock);
+    }
+}
+
+// Reuse the next idle entry, NULL if every entry has I/O running and wait is not set
+static struct SwapCacheEntry *take_cache_entry(struct Swap *swap, size_t slot,
+                                               bool wait) {
+    for (;;) {
+        for (size_t i = 0; i < swap->cache_size; i++) {
+            size_t idx = swap->cache_hand;
+            struct SwapCacheEntry *entry = &swap->cache[idx];
+            swap->cache_hand = (swap->cache_hand + 1) % swap->cache_size;
+            if (entry->io != SWAP_IDLE) {
+                continue;
+            }
+            if (entry->slot != 0) {
+                swap->slot_cache[entry->slot] = 0;
+            }
+            entry->slot = slot;
+            entry->readahead = false;
+            swap->slot_cache[slot] = idx + 1;
+            return entry;
+        }
+        if (!wait) {
+            return NULL;
+        }
+        swap->stats.cache_waits++;
+        pthread_cond_wait(&swap->done, &swap->lock);
+    }
+}
+
+static struct SwapCacheEntry *cached_entry(struct Swap *swap, size_t slot) {
+    size_t idx = swap->slot_cache[slot];
+    return idx != 0 ? &swap->cache[idx - 1] : NULL;
+}
+
+static void submit_io(struct Swap *swap, struct SwapCacheEntry *entry, enum SwapIO io) {
+    entry->io = io;
+    size_t tail = (swap->queue_head + swap->queue_count) % swap->cache_size;
+    swap->queue[tail] = entry - swap->cache;
+    swap->queue_count++;
+    pthread_cond_signal(&swap->pending);
+}
+
+// Drop a reference, a slot nobody refers to is forgotten by the cache
+static void put_slot(struct Swap *swap, size_t slot) {
+    assert(swap->slot_refs[slot] > 0 && "[FATAL] Freeing a free swap slot");
+    if (--swap->slot_refs[slot] != 0) {
+        return;
+    }
+    // a write to the slot must not land after one to its next user
+    struct SwapCacheEntry *entry = cached_entry(swap, slot);
+    if (entry) {
+        wait_for_io(swap, entry);
+        entry->slot = 0;
+        swap->slot_cache[slot] = 0;
+    }
+    swap->used_slots--;
+}
+
+static size_t alloc_slot(struct Swap *swap) {
+    if (swap->used_slots == swap->slot_count - 1) {
+        return 0;
+    }
+    while (swap->slot_refs[swap->cursor] != 0) {
+        swap->cursor = swap->cursor + 1 < swap->slot_count ? swap->cursor + 1 : 1;
+    }
+    swap->used_slots++;
+    return swap->cursor;
+}
+
+/*
+ * Put the contents of a frame being evicted on swap, returns the slot holding
+ * them with a reference for every page mapping the frame, 0 if swap is full.
+ * A clean frame still on swap is not written again.
+ */
+size_t swap_out(struct Swap *swap, size_t frame_idx, bool dirty) {
+    struct FrameDBEntry *frame = &sim->frame_db[frame_idx];
+    size_t slot = frame->swap_slot;
+    frame->swap_slot = 0;
+
+    pthread_mutex_lock(&swap->lock);
+    if (slot != 0 && !dirty) {
+        // the reference of the frame is taken over by one of the pages
+        swap->slot_refs[slot] += frame->ref_count - 1;
+        swap->stats.clean_evictions++;
+        pthread_mutex_unlock(&swap->lock);
+        return slot;
+    }
+
+    // the copy on swap is stale, it is overwritten if nobody else refers to it
+    if (slot != 0 && swap->slot_refs[slot] > 1) {
+        put_slot(swap, slot);
+        slot = 0;
+    }
+    if (slot == 0) {
+        slot = alloc_slot(swap);
+    }
+    if (slot == 0) {
+        swap->stats.dropped++;
+        pthread_mutex_unlock(&swap->lock);
+        return 0;
+    }
+    swap->slot_refs[slot] = frame->ref_count;
+
+    struct SwapCacheEntry *entry = cached_entry(swap, slot);
+    if (entry) {
+        wait_for_io(swap, entry);
+        entry->readahead = false;
+    } else {
+        entry = take_cache_entry(swap, slot, true);
+    }
+    memcpy(entry->data, &sim->phy_mem[frame_idx * FRAME_SIZE], swap->page_size);
+    submit_io(swap, entry, SWAP_WRITING);
+    swap->stats.writes++;
+    pthread_mutex_unlock(&swap->lock);
+    return slot;
+}
+
+// Read the used slots of the cluster of slot that are not cached yet
+static void read_ahead(struct Swap *swap, size_t slot) {
+    size_t first = slot - slot % swap->readahead;
+    for (size_t s = first; s < first + swap->readahead && s < swap->slot_count; s++) {
+        if (s == slot || swap->slot_refs[s] == 0 || swap->slot_cache[s] != 0) {
+            continue;
+        }
+        // readahead never waits, it stops once every entry is busy
+        struct SwapCacheEntry *entry = take_cache_entry(swap, s, false);
+        if (entry == NULL) {
+            return;
+        }
+        entry->readahead = true;
+        submit_io(swap, entry, SWAP_READING);
+        swap->stats.readahead_reads++;
+    }
+}
+
+// Copy the contents of slot to page, waits for the read if it is not cached
+void swap_in(struct Swap *swap, size_t slot, unsigned char *page) {
+    assert(swap->slot_refs[slot] > 0 && "[FATAL] Reading a free swap slot");
+
+    pthread_mutex_lock(&swap->lock);
+    struct SwapCacheEntry *entry = cached_entry(swap, slot);
+    if (entry == NULL) {
+        entry = take_cache_entry(swap, slot, true);
+        submit_io(swap, entry, SWAP_READING);
+        swap->stats.reads++;
+        if (swap->readahead > 1) {
+            read_ahead(swap, slot);
+        }
+    } else if (entry->readahead) {
+        swap->stats.readahead_hits++;
+    } else {
+        swap->stats.cache_hits++;
+    }
+
+    // a page being written is in the cache already
+    if (entry->io == SWAP_READING) {
+        wait_for_io(swap, entry);
+    }
+    memcpy(page, entry->data, swap->page_size);
+    entry->readahead = false;
+    pthread_mutex_unlock(&swap->lock);
+}
+
+// One more page refers to slot, like a forked child
+void swap_dup(struct Swap *swap, size_t slot) {
+    assert(swap->slot_refs[slot] > 0 && "[FATAL] Sharing a free swap slot");
+    swap->slot_refs[slot]++;
+}
+
+void swap_free(struct Swap *swap, size_t slot) {
+    pthread_mutex_lock(&swap->lock);
+    put_slot(swap, slot);
+    pthread_mutex_unlock(&swap->lock);
+}
+
+void record_fault_latency(struct Swap *swap, uint64_t ns) {
+    swap->fault_latency[63 - __builtin_clzll(ns | 1)]++;
+    swap->stats.major_faults++;
+    if (ns > swap->stats.max_latency_ns) {
+        swap->stats.max_latency_ns = ns;
+    }
+}
+
+// Upper bound in us of the bucket holding the given share of the faults
+static double latency_percentile(struct Swap *swap, double share) {
+    size_t seen = 0;
+    for (size_t i = 0; i < SWAP_LATENCY_BUCKETS; i++) {
+        seen += swap->fault_latency[i];
+        if (seen >= share * swap->stats.major_faults) {
+            return ((uint64_t)2 << i) / 1e3;
+        }
+    }
+    return 0;
+}
+
+void print_swap_stats(struct Swap *swap) {
+    struct SwapStats *stats = &swap->stats;
+    LOG_INFO("swap: %zu / %zu slots used, %zu writes, %zu clean evictions, %zu dropped",
+             swap->used_slots, swap->slot_count - 1, stats->writes,
+             stats->clean_evictions, stats->dropped);
+    LOG_INFO("swap: %zu reads, %zu read ahead (%zu hits), %zu cache hits, %zu waits",
+             stats->reads, stats->readahead_reads, stats->readahead_hits,
+             stats->cache_hits, stats->cache_waits);
+    if (stats->major_faults == 0) {
+        return;
+    }
+
+    LOG_INFO("major fault latency: p50 < %.1f us, p99 < %.1f us, max %.1f us",
+             latency_percentile(swap, 0.5), latency_percentile(swap, 0.99),
+             stats->max_latency_ns / 1e3);
+    for (size_t i = 0; i < SWAP_LATENCY_BUCKETS; i++) {
+        if (swap->fault_latency[i] != 0) {
+            LOG_INFO("  %10.1f - %10.1f us: %zu", ((uint64_t)1 << i) / 1e3,
+                     ((uint64_t)2 << i) / 1e3, (size_t)swap->fault_latency[i]);
+        }
+    }
+}
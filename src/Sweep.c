@@ -0,0 +1,184 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Parameter sweep
+ * Every configuration gets a simulator of its own on one of the worker
+ * threads, the workers share nothing but the list of configurations. Each
+ * one replays the trace through its own read-only mapping, the file contents
+ * are kept once in the page cache.
+ */
+
+struct SweepPoint {
+    size_t frame_count;
+    unsigned page_shift;
+    enum ReplacementPolicy policy;
+
+    bool ok;
+    size_t ops;
+    struct ReplacementStats stats;
+    size_t tlb_lookups;
+    size_t tlb_misses;
+    double seconds;
+};
+
+struct Sweep {
+    const char *trace_path;
+    struct TLBConfig tlb; // of the calling thread's simulator, workers have none bound
+    struct SweepPoint *points;
+    size_t point_count;
+    size_t next_point; // taken with an atomic add
+};
+
+static double elapsed_seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void run_point(struct Sweep *sweep, struct SweepPoint *point) {
+    struct Simulator *simulator =
+        create_simulator((struct SimulatorConfig){.frame_count = point->frame_count,
+                                                  .page_shift = point->page_shift,
+                                                  .cpu_count = 1,
+                                                  .policy = point->policy,
+                                                  .tlb = sweep->tlb});
+    struct TraceReader *reader = trace_reader_open(sweep->trace_path);
+    if (reader == NULL) {
+        destroy_simulator(simulator);
+        return;
+    }
+
+    size_t proc_count = reader->header.proc_count;
+    struct Proc **procs = (struct Proc **)malloc(proc_count * sizeof(struct Proc *));
+    for (size_t i = 0; i < proc_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "pid %lu", (unsigned long)reader->pids[i]);
+        procs[i] = create_proc(name);
+        trace_reader_bind_proc(reader, i, procs[i]);
+    }
+
+    struct Operation op;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (trace_reader_next(reader, &op)) {
+        perform_operation(&op);
+        point->ops++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    point->seconds = elapsed_seconds(&start, &end);
+    point->ok = trace_reader_verify(reader);
+    point->stats = simulator->replacement->stats;
+    for (size_t i = 0; i < proc_count; i++) {
+        struct TLBStats *stats = &procs[i]->tlb_stats;
+        point->tlb_lookups += stats->l1_hits + stats->l2_hits + stats->misses;
+        point->tlb_misses += stats->misses;
+        destroy_proc(procs[i]);
+    }
+    free(procs);
+    trace_reader_close(reader);
+    destroy_simulator(simulator);
+}
+
+static void *sweep_worker(void *arg) {
+    struct Sweep *sweep = (struct Sweep *)arg;
+    for (;;) {
+        size_t idx = __atomic_fetch_add(&sweep->next_point, 1, __ATOMIC_RELAXED);
+        if (idx >= sweep->point_count) {
+            return NULL;
+        }
+        run_point(sweep, &sweep->points[idx]);
+    }
+}
+
+// One line per configuration, grouped so that each group is a miss-ratio curve
+static void print_sweep_csv(struct Sweep *sweep) {
+    printf("frames,page_size,policy,ops,faults,major_faults,evictions,fault_rate,"
+           "tlb_miss_rate,seconds\n");
+    for (size_t i = 0; i < sweep->point_count; i++) {
+        struct SweepPoint *point = &sweep->points[i];
+        if (!point->ok) {
+            continue;
+        }
+        double fault_rate = point->ops ? (double)point->stats.faults / point->ops : 0;
+        double tlb_miss_rate =
+            point->tlb_lookups ? (double)point->tlb_misses / point->tlb_lookups : 0;
+
+        printf("%zu,%zu,%s,%zu,%zu,%zu,%zu,%.6f,%.6f,%.3f\n", point->frame_count,
+               (size_t)1 << point->page_shift,
+               replacement_policy_to_str(point->policy), point->ops, point->stats.faults,
+               point->stats.major_faults, point->stats.evictions, fault_rate,
+               tlb_miss_rate, point->seconds);
+    }
+}
+
+/*
+ * Run every combination of the configured values on the trace and print the
+ * results as CSV to stdout. Lists left empty take the value of the simulator
+ * the calling thread is bound to, its TLB geometry is used by every run.
+ */
+int run_sweep(struct SweepConfig *config, const char *trace_path) {
+    if (config->frame_count_values == 0) {
+        config->frame_counts[config->frame_count_values++] = sim->frame_count;
+    }
+    if (config->page_shift_values == 0) {
+        config->page_shifts[config->page_shift_values++] = sim->page_shift;
+    }
+    if (config->policy_values == 0) {
+        config->policies[config->policy_values++] = sim->replacement->policy;
+    }
+
+    struct Sweep sweep = {
+        .trace_path = trace_path, .tlb = tlb_config(sim->cpus[0].tlb), .next_point = 0};
+    sweep.point_count =
+        config->page_shift_values * config->policy_values * config->frame_count_values;
+    sweep.points =
+        (struct SweepPoint *)calloc(sweep.point_count, sizeof(struct SweepPoint));
+
+    size_t idx = 0;
+    for (size_t s = 0; s < config->page_shift_values; s++) {
+        for (size_t p = 0; p < config->policy_values; p++) {
+            for (size_t f = 0; f < config->frame_count_values; f++) {
+                sweep.points[idx++] =
+                    (struct SweepPoint){.frame_count = config->frame_counts[f],
+                                        .page_shift = config->page_shifts[s],
+                                        .policy = config->policies[p]};
+            }
+        }
+    }
+
+    size_t jobs = config->jobs ? config->jobs : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > sweep.point_count) {
+        jobs = sweep.point_count;
+    }
+    LOG_INFO("sweep: %zu configurations on %zu threads", sweep.point_count, jobs);
+
+    pthread_t *threads = (pthread_t *)malloc(jobs * sizeof(pthread_t));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < jobs; i++) {
+        int err = pthread_create(&threads[i], NULL, sweep_worker, &sweep);
+        assert(err == 0 && "[FATAL] Could not start a sweep worker");
+        (void)err;
+    }
+    for (size_t i = 0; i < jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(threads);
+
+    print_sweep_csv(&sweep);
+    fflush(stdout);
+
+    int status = 0;
+    for (size_t i = 0; i < sweep.point_count; i++) {
+        if (!sweep.points[i].ok) {
+            status = 1;
+        }
+    }
+    LOG_INFO("sweep time: %.3f s", elapsed_seconds(&start, &end));
+    free(sweep.points);
+    return status;
+}
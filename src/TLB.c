@@ -0,0 +1,267 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * TLB is modeled as two set-associative levels
+ * 1. L1 is looked up first, on a hit the translation is returned
+ * 2. on L1 miss L2 is looked up, a L2 hit is promoted into L1
+ * 3. on a miss in both, the caller walks the page table and inserts the
+ *    translation into both levels
+ *
+ * Only translation results are modeled, the TLB does not change behaviour.
+ * A huge page takes a single entry tagged with its page class, so lookups
+ * probe one class after another like split TLBs do.
+ */
+
+static bool is_tlb_level_valid(size_t entries, size_t ways) {
+    return ways > 0 && entries >= ways && entries % ways == 0;
+}
+
+// Both levels hold a whole number of sets
+bool is_tlb_config_valid(struct TLBConfig config) {
+    return is_tlb_level_valid(config.l1_entries, config.l1_ways) &&
+           is_tlb_level_valid(config.l2_entries, config.l2_ways);
+}
+
+static void init_tlb_level(struct TLBLevel *level, size_t entries, size_t ways) {
+    assert(is_tlb_level_valid(entries, ways) &&
+           "TLB entries should be a multiple of associativity");
+
+    level->ways = ways;
+    level->sets = entries / ways;
+    level->entries = (struct TLBEntry *)calloc(entries, sizeof(struct TLBEntry));
+    assert(level->entries != NULL);
+}
+
+struct TLB *create_tlb(struct TLBConfig config) {
+    struct TLB *new_tlb = (struct TLB *)malloc(sizeof(struct TLB));
+    init_tlb_level(&new_tlb->l1, config.l1_entries, config.l1_ways);
+    init_tlb_level(&new_tlb->l2, config.l2_entries, config.l2_ways);
+    new_tlb->policy = config.policy;
+    new_tlb->clock = 0;
+    new_tlb->rng_state = 0x9E3779B97F4A7C15ull;
+    return new_tlb;
+}
+
+void destroy_tlb(struct TLB *tlb) {
+    free(tlb->l1.entries);
+    free(tlb->l2.entries);
+    free(tlb);
+}
+
+const char *tlb_policy_to_str(enum TLBPolicy policy) {
+    switch (policy) {
+    case TLB_LRU:
+        return "LRU";
+    case TLB_FIFO:
+        return "FIFO";
+    case TLB_RANDOM:
+        return "RANDOM";
+
+    default:
+        assert("Invalid TLB policy");
+    }
+    return NULL;
+}
+
+bool tlb_policy_from_str(const char *str, enum TLBPolicy *policy) {
+    static const char *names[] = {"lru", "fifo", "random"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(str, names[i]) == 0) {
+            *policy = (enum TLBPolicy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Geometry and policy a TLB was created with
+struct TLBConfig tlb_config(struct TLB *tlb) {
+    return (struct TLBConfig){.l1_entries = tlb->l1.sets * tlb->l1.ways,
+                              .l1_ways = tlb->l1.ways,
+                              .l2_entries = tlb->l2.sets * tlb->l2.ways,
+                              .l2_ways = tlb->l2.ways,
+                              .policy = tlb->policy};
+}
+
+static inline struct TLBEntry *tlb_set(struct TLBLevel *level, size_t page_idx) {
+    return &level->entries[(page_idx % level->sets) * level->ways];
+}
+
+// page_idx is counted in pages of the class
+static struct TLBEntry *lookup_level(struct TLBLevel *level, size_t asid,
+                                     size_t page_idx, enum PageClass class) {
+    struct TLBEntry *set = tlb_set(level, page_idx);
+    for (size_t i = 0; i < level->ways; i++) {
+        if (set[i].valid && set[i].page_idx == page_idx && set[i].asid == asid &&
+            set[i].page_class == class) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+static uint64_t next_random(struct TLB *tlb) {
+    // xorshift64
+    uint64_t x = tlb->rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return tlb->rng_state = x;
+}
+
+// pick the way to be replaced in the set, invalid ways are used first
+static struct TLBEntry *select_victim(struct TLB *tlb, struct TLBLevel *level,
+                                      size_t page_idx) {
+    struct TLBEntry *set = tlb_set(level, page_idx);
+    struct TLBEntry *victim = &set[0];
+
+    for (size_t i = 0; i < level->ways; i++) {
+        if (!set[i].valid) {
+            return &set[i];
+        }
+        if (set[i].stamp < victim->stamp) {
+            victim = &set[i];
+        }
+    }
+
+    if (tlb->policy == TLB_RANDOM) {
+        victim = &set[next_random(tlb) % level->ways];
+    }
+    return victim;
+}
+
+static void insert_level(struct TLB *tlb, struct TLBLevel *level, size_t asid,
+                         size_t page_idx, enum PageClass class, uintptr_t pte) {
+    struct TLBEntry *entry = lookup_level(level, asid, page_idx, class);
+    if (entry == NULL) {
+        entry = select_victim(tlb, level, page_idx);
+    }
+    *entry = (struct TLBEntry){.valid = true,
+                               .page_class = class,
+                               .asid = asid,
+                               .page_idx = page_idx,
+                               .pte = pte,
+                               .stamp = ++tlb->clock};
+}
+
+// Entry of the base page page_idx inside the cached page
+static inline uintptr_t base_page_pte(struct TLBEntry *entry, size_t page_idx) {
+    size_t offset = page_idx & (page_class_pages(entry->page_class) - 1);
+    return entry->pte + offset * PAGE_SIZE;
+}
+
+static struct TLBEntry *lookup_page(struct TLB *tlb, struct TLBLevel *level,
+                                    struct Proc *proc, size_t page_idx) {
+    struct TLBEntry *entry = lookup_level(level, proc->pid, page_idx, PAGE_BASE);
+    size_t *huge_pages = proc->page_table->stats.huge_pages;
+
+    // only classes the process maps are probed
+    for (enum PageClass class = PAGE_HUGE; entry == NULL && class < PAGE_CLASS_COUNT;
+         class++) {
+        if (huge_pages[class] != 0) {
+            entry = lookup_level(level, proc->pid, page_idx >> (class * PT_INDEX_BITS),
+                                 class);
+        }
+    }
+    if (entry != NULL && tlb->policy == TLB_LRU) {
+        // FIFO keeps the insertion stamp, LRU refreshes it on every hit
+        entry->stamp = ++tlb->clock;
+    }
+    return entry;
+}
+
+// Returns the cached page table entry of the page, 0 on a TLB miss
+uintptr_t tlb_lookup(struct TLB *tlb, struct Proc *proc, size_t page_idx) {
+    struct TLBEntry *entry = lookup_page(tlb, &tlb->l1, proc, page_idx);
+    if (entry != NULL) {
+        proc->tlb_stats.l1_hits++;
+        return base_page_pte(entry, page_idx);
+    }
+
+    entry = lookup_page(tlb, &tlb->l2, proc, page_idx);
+    if (entry != NULL) {
+        proc->tlb_stats.l2_hits++;
+        insert_level(tlb, &tlb->l1, proc->pid, entry->page_idx, entry->page_class,
+                     entry->pte);
+        return base_page_pte(entry, page_idx);
+    }
+
+    proc->tlb_stats.misses++;
+    return 0;
+}
+
+// pte is the entry of the base page, as returned by the page table walk
+void tlb_insert(struct TLB *tlb, struct Proc *proc, size_t page_idx, uintptr_t pte) {
+    enum PageClass class = pte_page_class(pte);
+    size_t offset = page_idx & (page_class_pages(class) - 1);
+    size_t tag = page_idx >> (class * PT_INDEX_BITS);
+
+    pte -= offset * PAGE_SIZE;
+    insert_level(tlb, &tlb->l1, proc->pid, tag, class, pte);
+    insert_level(tlb, &tlb->l2, proc->pid, tag, class, pte);
+}
+
+static bool invalidate_level(struct TLBLevel *level, size_t asid, size_t page_idx) {
+    bool found = false;
+    for (enum PageClass class = PAGE_BASE; class < PAGE_CLASS_COUNT; class++) {
+        struct TLBEntry *entry =
+            lookup_level(level, asid, page_idx >> (class * PT_INDEX_BITS), class);
+        if (entry != NULL) {
+            entry->valid = false;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Drop the translation of a page from both levels (invlpg), of any page class
+void tlb_invalidate(struct TLB *tlb, struct Proc *proc, size_t page_idx) {
+    bool l1_found = invalidate_level(&tlb->l1, proc->pid, page_idx);
+    bool l2_found = invalidate_level(&tlb->l2, proc->pid, page_idx);
+    if (l1_found || l2_found) {
+        proc->tlb_stats.flushes++;
+    }
+}
+
+static void flush_level(struct TLBLevel *level, size_t asid) {
+    for (size_t i = 0; i < level->sets * level->ways; i++) {
+        if (level->entries[i].asid == asid) {
+            level->entries[i].valid = false;
+        }
+    }
+}
+
+// Drop every translation tagged with the process's ASID
+void tlb_flush_proc(struct TLB *tlb, struct Proc *proc) {
+    flush_level(&tlb->l1, proc->pid);
+    flush_level(&tlb->l2, proc->pid);
+    proc->tlb_stats.flushes++;
+}
+
+void print_tlb_stats(struct TLB *tlb, struct Proc *proc) {
+    struct TLBStats *stats = &proc->tlb_stats;
+    size_t lookups = stats->l1_hits + stats->l2_hits + stats->misses;
+    double hit_rate = lookups ? 100.0 * (lookups - stats->misses) / lookups : 0;
+
+    size_t l1_reach = tlb->l1.sets * tlb->l1.ways * PAGE_SIZE;
+    size_t l2_reach = tlb->l2.sets * tlb->l2.ways * PAGE_SIZE;
+
+    // memory covered by the entries the process holds right now
+    size_t current_reach = 0;
+    for (size_t i = 0; i < tlb->l2.sets * tlb->l2.ways; i++) {
+        struct TLBEntry *entry = &tlb->l2.entries[i];
+        if (entry->valid && entry->asid == proc->pid) {
+            current_reach += page_class_pages(entry->page_class) * PAGE_SIZE;
+        }
+    }
+
+    LOG_INFO("%s: TLB (%s) lookups: %zu, hit rate: %.2f%%", proc->name,
+             tlb_policy_to_str(tlb->policy), lookups, hit_rate);
+    LOG_INFO("%s: L1 hits: %zu, L2 hits: %zu, misses: %zu, flushes: %zu", proc->name,
+             stats->l1_hits, stats->l2_hits, stats->misses, stats->flushes);
+    LOG_INFO("TLB reach: L1 %zu KB, L2 %zu KB with base pages, %s: L2 holds %zu KB",
+             l1_reach / 1024, l2_reach / 1024, proc->name, current_reach / 1024);
+}
@@ -0,0 +1,238 @@
+#include <fcntl.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Streaming parser for text access traces
+ * The file is read in large chunks into one buffer and lines are parsed in
+ * place, nothing is allocated per line. Only a partial line at the end of a
+ * chunk is moved to the front of the buffer before the next read.
+ *
+ * The traced process may read memory that it never wrote inside the trace
+ * (stack, data segment, ...). Such a read maps the zero page, like the first
+ * read of an untouched page does on a real machine.
+ */
+
+#define TEXT_TRACE_BUF_SIZE (4 << 20)
+#define TEXT_TRACE_INITIAL_PAGES 4096
+
+struct TextTraceReader *text_trace_open(const char *path, struct Proc *proc) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open trace %s", path);
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    struct TextTraceReader *reader =
+        (struct TextTraceReader *)calloc(1, sizeof(struct TextTraceReader));
+    reader->fd = fd;
+    reader->buf_size = TEXT_TRACE_BUF_SIZE;
+    reader->buf = (char *)malloc(reader->buf_size);
+    reader->proc = proc;
+    reader->touched_capacity = TEXT_TRACE_INITIAL_PAGES;
+    reader->touched = (uint64_t *)calloc(reader->touched_capacity, sizeof(uint64_t));
+    return reader;
+}
+
+void text_trace_close(struct TextTraceReader *reader) {
+    LOG_INFO("text trace: %zu lines, %zu skipped, %zu pages touched", reader->lines,
+             reader->skipped_lines, reader->touched_count);
+    close(reader->fd);
+    free(reader->buf);
+    free(reader->touched);
+    free(reader);
+}
+
+static inline size_t page_slot(uint64_t key, size_t capacity) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+static void grow_touched_set(struct TextTraceReader *reader) {
+    size_t old_capacity = reader->touched_capacity;
+    uint64_t *old = reader->touched;
+
+    reader->touched_capacity *= 2;
+    reader->touched = (uint64_t *)calloc(reader->touched_capacity, sizeof(uint64_t));
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i] == 0) {
+            continue;
+        }
+        size_t slot = page_slot(old[i], reader->touched_capacity);
+        while (reader->touched[slot] != 0) {
+            slot = (slot + 1) & (reader->touched_capacity - 1);
+        }
+        reader->touched[slot] = old[i];
+    }
+    free(old);
+}
+
+// Count the pages the trace touches
+static void touch_page(struct TextTraceReader *reader, size_t page_idx) {
+    uint64_t key = (uint64_t)page_idx + 1;
+    size_t slot = page_slot(key, reader->touched_capacity);
+    while (reader->touched[slot] != 0) {
+        if (reader->touched[slot] == key) {
+            return;
+        }
+        slot = (slot + 1) & (reader->touched_capacity - 1);
+    }
+
+    reader->touched[slot] = key;
+    if (++reader->touched_count * 2 > reader->touched_capacity) {
+        grow_touched_set(reader);
+    }
+}
+
+static inline int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // lower case
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Parse one line, returns the number of operations produced (0, 1 or 2)
+ * Lines are "<kind> <hex address>[,size]" with optional leading spaces.
+ */
+static int parse_line(struct TextTraceReader *reader, const char *p, const char *end,
+                      struct Operation ops[2]) {
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (end - p < 3 || p[1] != ' ') {
+        return 0;
+    }
+
+    char kind = *p;
+    p += 2;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+        p += 2;
+    }
+
+    virt_addr_t addr = 0;
+    int digits = 0;
+    for (int d; p < end && (d = hex_digit(*p)) >= 0; p++, digits++) {
+        addr = (addr << 4) | (virt_addr_t)d;
+    }
+    if (digits == 0 || digits > 16) {
+        return 0;
+    }
+
+    bool is_load = false, is_store = false;
+    switch (kind) {
+    case 'L':
+    case 'R':
+    case 'r':
+        is_load = true;
+        break;
+    case 'S':
+    case 'W':
+    case 'w':
+        is_store = true;
+        break;
+    case 'M':
+        is_load = is_store = true;
+        break;
+
+    default:
+        return 0; // instruction fetch or unknown line
+    }
+
+    int count = 0;
+    touch_page(reader, addr / PAGE_SIZE);
+    if (is_load) {
+        ops[count++] = (struct Operation){.action = READ,
+                                          .proc = reader->proc,
+                                          .virt_addr = addr,
+                                          .data = 0};
+    }
+    if (is_store) {
+        // traces carry no data, store the low byte of the address
+        ops[count++] = (struct Operation){.action = WRITE,
+                                          .proc = reader->proc,
+                                          .virt_addr = addr,
+                                          .data = (unsigned char)addr};
+    }
+    return count;
+}
+
+// read more of the file, keeping the unparsed tail of the buffer
+static bool fill_buffer(struct TextTraceReader *reader) {
+    size_t tail = reader->len - reader->pos;
+    memmove(reader->buf, reader->buf + reader->pos, tail);
+    reader->len = tail;
+    reader->pos = 0;
+
+    if (tail == reader->buf_size) {
+        // a single line filling the whole buffer is garbage, drop it
+        reader->len = 0;
+        reader->skip_line = true;
+        tail = 0;
+    }
+
+    ssize_t n = read(reader->fd, reader->buf + tail, reader->buf_size - tail);
+    if (n <= 0) {
+        reader->eof = true;
+        return false;
+    }
+    reader->len += n;
+    return true;
+}
+
+// Produce the next operation, returns false at the end of the trace
+bool text_trace_next(struct TextTraceReader *reader, struct Operation *op) {
+    if (reader->has_pending) {
+        *op = reader->pending;
+        reader->has_pending = false;
+        return true;
+    }
+
+    while (true) {
+        char *line = reader->buf + reader->pos;
+        char *end = memchr(line, '\n', reader->len - reader->pos);
+        if (end == NULL) {
+            if (!reader->eof && fill_buffer(reader)) {
+                continue;
+            }
+            if (reader->pos == reader->len) {
+                return false;
+            }
+            // last line without a newline
+            line = reader->buf + reader->pos;
+            end = reader->buf + reader->len;
+        }
+        reader->pos = end - reader->buf + (end != reader->buf + reader->len);
+
+        if (reader->skip_line) {
+            reader->skip_line = false;
+            reader->skipped_lines++;
+            continue;
+        }
+
+        reader->lines++;
+        struct Operation ops[2];
+        int count = parse_line(reader, line, end, ops);
+        if (count == 0) {
+            reader->skipped_lines++;
+            continue;
+        }
+
+        *op = ops[0];
+        if (count == 2) {
+            reader->pending = ops[1];
+            reader->has_pending = true;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,354 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Timeline keeps the operations of a run and snapshots of the state taken
+ * every interval operations
+ * 1. stepping performs the next operation, snapshots are taken on the way
+ * 2. seeking restores the last snapshot at or before the target (binary
+ *    search) and replays at most interval - 1 operations
+ *
+ * Frames written since the last snapshot taken or restored (base) are
+ * tracked in a dirty bitmap. A new snapshot copies only dirty frames and
+ * shares the rest with base, a restore copies only the frames that differ
+ * between the current state and the snapshot.
+ */
+
+static inline bool is_dirty(struct Timeline *tl, size_t frame_idx) {
+    return tl->dirty[frame_idx / 64] & (1ull << (frame_idx % 64));
+}
+
+void timeline_mark_dirty(struct Timeline *tl, size_t frame_idx) {
+    tl->dirty[frame_idx / 64] |= 1ull << (frame_idx % 64);
+}
+
+// Manual changes are not part of the timeline, no snapshot may capture them
+void timeline_mark_diverged(struct Timeline *tl) {
+    tl->diverged = true;
+}
+
+static size_t dirty_words() {
+    return (sim->frame_count + 63) / 64;
+}
+
+static size_t frame_db_chunk_count() {
+    return (sim->frame_count + SNAPSHOT_DB_CHUNK - 1) / SNAPSHOT_DB_CHUNK;
+}
+
+static size_t frame_db_chunk_size(size_t chunk) {
+    size_t first = chunk * SNAPSHOT_DB_CHUNK;
+    size_t count = sim->frame_count - first < SNAPSHOT_DB_CHUNK ? sim->frame_count - first
+                                                            : SNAPSHOT_DB_CHUNK;
+    return count * sizeof(struct FrameDBEntry);
+}
+
+static struct SnapshotBlock *create_block(const void *data, size_t size) {
+    struct SnapshotBlock *block =
+        (struct SnapshotBlock *)malloc(sizeof(struct SnapshotBlock) + size);
+    assert(block != NULL);
+    block->ref_count = 1;
+    memcpy(block->data, data, size);
+    return block;
+}
+
+static struct SnapshotBlock *share_block(struct SnapshotBlock *block) {
+    block->ref_count++;
+    return block;
+}
+
+static void release_block(struct SnapshotBlock *block) {
+    if (block != NULL && --block->ref_count == 0) {
+        free(block);
+    }
+}
+
+static void count_entry(size_t page_idx, uintptr_t entry, void *arg) {
+    (void)page_idx;
+    (void)entry;
+    (*(size_t *)arg)++;
+}
+
+static void save_entry(size_t page_idx, uintptr_t entry, void *arg) {
+    struct PageTableSnapshot *snap = (struct PageTableSnapshot *)arg;
+    snap->page_idx[snap->count] = page_idx;
+    snap->entries[snap->count] = entry;
+    snap->count++;
+}
+
+static struct PageTableSnapshot *create_page_table_snapshot(struct PageTable *pt) {
+    struct PageTableSnapshot *snap =
+        (struct PageTableSnapshot *)malloc(sizeof(struct PageTableSnapshot));
+    size_t count = 0;
+    for_each_page_table_entry(pt, count_entry, &count);
+
+    snap->ref_count = 1;
+    snap->version = pt->version;
+    snap->count = 0;
+    snap->page_idx = (size_t *)malloc(count * sizeof(size_t));
+    snap->entries = (uintptr_t *)malloc(count * sizeof(uintptr_t));
+    for_each_page_table_entry(pt, save_entry, snap);
+    return snap;
+}
+
+static void release_page_table_snapshot(struct PageTableSnapshot *snap) {
+    if (--snap->ref_count == 0) {
+        free(snap->page_idx);
+        free(snap->entries);
+        free(snap);
+    }
+}
+
+static void load_page_table_snapshot(struct PageTable *pt,
+                                     struct PageTableSnapshot *snap) {
+    clear_page_table(pt);
+    for (size_t i = 0; i < snap->count; i++) {
+        load_page_table_entry(pt, snap->page_idx[i], snap->entries[i]);
+    }
+    pt->version = snap->version;
+}
+
+static struct Snapshot *take_snapshot(struct Timeline *tl) {
+    struct Snapshot *base = tl->base;
+    struct Snapshot *snap = (struct Snapshot *)malloc(sizeof(struct Snapshot));
+    snap->op_idx = tl->position;
+
+    snap->frames = (struct SnapshotBlock **)calloc(sim->frame_count, sizeof(void *));
+    for (size_t i = 1; i < sim->frame_count; i++) {
+        if (is_frame_unused(i)) {
+            continue;
+        }
+        if (base && !is_dirty(tl, i)) {
+            assert(base->frames[i] != NULL && "[FATAL] Clean frame missing in base");
+            snap->frames[i] = share_block(base->frames[i]);
+            tl->stats.frames_shared++;
+        } else {
+            snap->frames[i] = create_block(&sim->phy_mem[i * FRAME_SIZE], FRAME_SIZE);
+            tl->stats.frame_copies++;
+        }
+    }
+
+    // a frame_db chunk covers exactly one word of the dirty bitmap
+    size_t chunks = frame_db_chunk_count();
+    snap->frame_db_chunks = (struct SnapshotBlock **)malloc(chunks * sizeof(void *));
+    for (size_t c = 0; c < chunks; c++) {
+        if (base && tl->dirty[c] == 0) {
+            snap->frame_db_chunks[c] = share_block(base->frame_db_chunks[c]);
+        } else {
+            snap->frame_db_chunks[c] = create_block(&sim->frame_db[c * SNAPSHOT_DB_CHUNK],
+                                                    frame_db_chunk_size(c));
+        }
+    }
+
+    snap->page_tables =
+        (struct PageTableSnapshot **)malloc(tl->proc_count * sizeof(void *));
+    for (size_t k = 0; k < tl->proc_count; k++) {
+        struct PageTable *pt = tl->procs[k]->page_table;
+        if (base && base->page_tables[k]->version == pt->version) {
+            snap->page_tables[k] = base->page_tables[k];
+            snap->page_tables[k]->ref_count++;
+        } else {
+            snap->page_tables[k] = create_page_table_snapshot(pt);
+        }
+    }
+
+    snap->allocator = create_frame_allocator(sim->frame_count);
+    copy_frame_allocator(snap->allocator, sim->frame_allocator);
+    snap->replacement = NULL;
+    if (sim->replacement) {
+        snap->replacement =
+            create_replacement_engine(sim->replacement->policy, sim->frame_count);
+        copy_replacement_engine(snap->replacement, sim->replacement);
+    }
+
+    memset(tl->dirty, 0, dirty_words() * sizeof(uint64_t));
+    tl->base = snap;
+    return snap;
+}
+
+static void destroy_snapshot(struct Timeline *tl, struct Snapshot *snap) {
+    for (size_t i = 0; i < sim->frame_count; i++) {
+        release_block(snap->frames[i]);
+    }
+    for (size_t c = 0; c < frame_db_chunk_count(); c++) {
+        release_block(snap->frame_db_chunks[c]);
+    }
+    for (size_t k = 0; k < tl->proc_count; k++) {
+        release_page_table_snapshot(snap->page_tables[k]);
+    }
+    destroy_frame_allocator(snap->allocator);
+    if (snap->replacement) {
+        destroy_replacement_engine(snap->replacement);
+    }
+    free(snap->frames);
+    free(snap->frame_db_chunks);
+    free(snap->page_tables);
+    free(snap);
+}
+
+// Index of the last snapshot with op_idx <= op_idx
+static size_t find_snapshot(struct Timeline *tl, size_t op_idx) {
+    size_t lo = 0;
+    size_t hi = tl->snapshot_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tl->snapshots[mid]->op_idx <= op_idx) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void insert_snapshot(struct Timeline *tl, struct Snapshot *snap) {
+    if (tl->snapshot_count == tl->snapshot_capacity) {
+        tl->snapshot_capacity *= 2;
+        tl->snapshots = (struct Snapshot **)realloc(
+            tl->snapshots, tl->snapshot_capacity * sizeof(struct Snapshot *));
+        assert(tl->snapshots != NULL);
+    }
+
+    size_t pos = tl->snapshot_count;
+    if (tl->snapshot_count > 0) {
+        pos = find_snapshot(tl, snap->op_idx) + 1;
+    }
+    memmove(&tl->snapshots[pos + 1], &tl->snapshots[pos],
+            (tl->snapshot_count - pos) * sizeof(struct Snapshot *));
+    tl->snapshots[pos] = snap;
+    tl->snapshot_count++;
+}
+
+static void restore_snapshot(struct Timeline *tl, struct Snapshot *snap) {
+    struct Snapshot *base = tl->base;
+
+    // a frame differs from the snapshot if it was written or base holds another copy
+    for (size_t i = 1; i < sim->frame_count; i++) {
+        if (snap->frames[i] != NULL &&
+            (is_dirty(tl, i) || base->frames[i] != snap->frames[i])) {
+            memcpy(&sim->phy_mem[i * FRAME_SIZE], snap->frames[i]->data, FRAME_SIZE);
+            bump_frame_generation(i);
+        }
+    }
+    for (size_t c = 0; c < frame_db_chunk_count(); c++) {
+        if (tl->dirty[c] != 0 || base->frame_db_chunks[c] != snap->frame_db_chunks[c]) {
+            memcpy(&sim->frame_db[c * SNAPSHOT_DB_CHUNK], snap->frame_db_chunks[c]->data,
+                   frame_db_chunk_size(c));
+        }
+    }
+    for (size_t k = 0; k < tl->proc_count; k++) {
+        struct Proc *proc = tl->procs[k];
+        if (proc->page_table->version != snap->page_tables[k]->version) {
+            load_page_table_snapshot(proc->page_table, snap->page_tables[k]);
+        }
+        if (proc->cpu->tlb) {
+            tlb_flush_proc(proc->cpu->tlb, proc);
+        }
+    }
+
+    copy_frame_allocator(sim->frame_allocator, snap->allocator);
+    if (sim->replacement) {
+        copy_replacement_engine(sim->replacement, snap->replacement);
+    }
+
+    // the undo history belongs to the state that was just replaced
+    if (this_cpu->exec_log) {
+        clear_exec_log(this_cpu->exec_log);
+    }
+
+    memset(tl->dirty, 0, dirty_words() * sizeof(uint64_t));
+    tl->base = snap;
+    tl->position = snap->op_idx;
+    tl->diverged = false;
+    tl->stats.restores++;
+}
+
+/*
+ * The current state becomes operation 0, processes touched by the operations
+ * must be in procs so that their page tables are part of the snapshots
+ */
+struct Timeline *create_timeline(struct Proc **procs, size_t proc_count,
+                                 size_t interval) {
+    assert(interval > 0);
+    assert(sim->frame_allocator->huge_pages == 0 &&
+           "Snapshots do not support huge pages");
+
+    struct Timeline *tl = (struct Timeline *)calloc(1, sizeof(struct Timeline));
+    tl->procs = (struct Proc **)malloc(proc_count * sizeof(struct Proc *));
+    memcpy(tl->procs, procs, proc_count * sizeof(struct Proc *));
+    tl->proc_count = proc_count;
+    tl->interval = interval;
+
+    tl->op_capacity = 16;
+    tl->ops = (struct Operation *)malloc(tl->op_capacity * sizeof(struct Operation));
+    tl->snapshot_capacity = 16;
+    tl->snapshots =
+        (struct Snapshot **)malloc(tl->snapshot_capacity * sizeof(struct Snapshot *));
+    tl->dirty = (uint64_t *)calloc(dirty_words(), sizeof(uint64_t));
+
+    insert_snapshot(tl, take_snapshot(tl));
+    return tl;
+}
+
+void destroy_timeline(struct Timeline *tl) {
+    for (size_t i = 0; i < tl->snapshot_count; i++) {
+        destroy_snapshot(tl, tl->snapshots[i]);
+    }
+    free(tl->snapshots);
+    free(tl->dirty);
+    free(tl->ops);
+    free(tl->procs);
+    free(tl);
+}
+
+void timeline_append(struct Timeline *tl, struct Operation *op) {
+    if (tl->op_count == tl->op_capacity) {
+        tl->op_capacity *= 2;
+        tl->ops = (struct Operation *)realloc(tl->ops,
+                                              tl->op_capacity * sizeof(struct Operation));
+        assert(tl->ops != NULL);
+    }
+    tl->ops[tl->op_count++] = *op;
+}
+
+// Perform the next operation, returns false once every operation was performed
+bool timeline_step(struct Timeline *tl) {
+    if (tl->position == tl->op_count) {
+        return false;
+    }
+    perform_operation(&tl->ops[tl->position]);
+    tl->position++;
+
+    if (!tl->diverged && tl->position % tl->interval == 0 &&
+        tl->snapshots[find_snapshot(tl, tl->position)]->op_idx != tl->position) {
+        insert_snapshot(tl, take_snapshot(tl));
+    }
+    return true;
+}
+
+// Bring the state to right before operation op_idx
+void timeline_seek(struct Timeline *tl, size_t op_idx) {
+    assert(op_idx <= tl->op_count && "[FATAL] Seek past the last operation");
+
+    // moving forward within the current interval needs no restore
+    struct Snapshot *snap = tl->snapshots[find_snapshot(tl, op_idx)];
+    if (tl->diverged || tl->position > op_idx || tl->position < snap->op_idx) {
+        restore_snapshot(tl, snap);
+    }
+
+    while (tl->position < op_idx) {
+        timeline_step(tl);
+        tl->stats.replayed_ops++;
+    }
+}
+
+void print_timeline_stats(struct Timeline *tl) {
+    struct TimelineStats *stats = &tl->stats;
+    LOG_INFO("timeline: %zu ops, %zu snapshots every %zu ops", tl->op_count,
+             tl->snapshot_count, tl->interval);
+    LOG_INFO("snapshot frames: %zu copied, %zu shared (%zu KB copied)",
+             stats->frame_copies, stats->frames_shared,
+             stats->frame_copies * FRAME_SIZE / 1024);
+    LOG_INFO("restores: %zu, replayed ops: %zu", stats->restores, stats->replayed_ops);
+}
@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Trace files are written through a buffered FILE and read back through mmap
+ * Reading decodes records in place from the mapping, nothing is copied and
+ * already consumed parts of the mapping are dropped as the reader advances,
+ * so traces larger than memory can be replayed.
+ */
+
+#define TRACE_WRITE_BUF_SIZE (1 << 20)
+#define TRACE_MAX_RECORD_SIZE 32
+#define TRACE_RELEASE_CHUNK ((size_t)64 << 20)
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline size_t write_varint(unsigned char *buf, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (unsigned char)value;
+    return len;
+}
+
+static inline bool read_varint(const unsigned char **cursor, const unsigned char *end,
+                               uint64_t *value) {
+    const unsigned char *p = *cursor;
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *cursor = p;
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct TraceWriter *trace_writer_open(const char *path, const uint64_t *pids,
+                                      size_t proc_count) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_ERROR("Failed to create trace %s", path);
+        return NULL;
+    }
+
+    struct TraceWriter *writer = (struct TraceWriter *)malloc(sizeof(struct TraceWriter));
+    writer->file = file;
+    writer->header = (struct TraceHeader){.version = TRACE_VERSION,
+                                          .proc_count = proc_count,
+                                          .checksum = FNV_OFFSET_BASIS};
+    memcpy(writer->header.magic, TRACE_MAGIC, sizeof(writer->header.magic));
+    writer->last_addr = (virt_addr_t *)calloc(proc_count, sizeof(virt_addr_t));
+    writer->buf = (unsigned char *)malloc(TRACE_WRITE_BUF_SIZE);
+    writer->buf_used = 0;
+
+    // header is rewritten with the final counts on close
+    fwrite(&writer->header, sizeof(writer->header), 1, file);
+    fwrite(pids, sizeof(uint64_t), proc_count, file);
+    return writer;
+}
+
+static bool flush_trace_writer(struct TraceWriter *writer) {
+    writer->header.checksum =
+        fnv1a(writer->header.checksum, writer->buf, writer->buf_used);
+    writer->header.body_size += writer->buf_used;
+    bool ok = fwrite(writer->buf, 1, writer->buf_used, writer->file) == writer->buf_used;
+    writer->buf_used = 0;
+    return ok;
+}
+
+bool trace_writer_append(struct TraceWriter *writer, size_t proc_idx,
+                         struct Operation *op) {
+    assert(proc_idx < writer->header.proc_count);
+
+    if (writer->buf_used + TRACE_MAX_RECORD_SIZE > TRACE_WRITE_BUF_SIZE &&
+        !flush_trace_writer(writer)) {
+        return false;
+    }
+
+    unsigned char *buf = writer->buf + writer->buf_used;
+    size_t len = 0;
+
+    if (proc_idx < TRACE_PROC_ESCAPE) {
+        buf[len++] = (unsigned char)(op->action | (proc_idx << 2));
+    } else {
+        buf[len++] = (unsigned char)(op->action | (TRACE_PROC_ESCAPE << 2));
+        len += write_varint(buf + len, proc_idx);
+    }
+
+    int64_t delta = (int64_t)(op->virt_addr - writer->last_addr[proc_idx]);
+    len += write_varint(buf + len, zigzag_encode(delta));
+    writer->last_addr[proc_idx] = op->virt_addr;
+
+    if (op->action == WRITE) {
+        buf[len++] = op->data;
+    }
+
+    writer->buf_used += len;
+    writer->header.op_count++;
+    return true;
+}
+
+bool trace_writer_close(struct TraceWriter *writer) {
+    bool ok = flush_trace_writer(writer);
+    ok = ok && fseek(writer->file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&writer->header, sizeof(writer->header), 1, writer->file) == 1;
+    ok = (fclose(writer->file) == 0) && ok;
+    if (!ok) {
+        LOG_ERROR("Failed to write trace");
+    }
+
+    free(writer->last_addr);
+    free(writer->buf);
+    free(writer);
+    return ok;
+}
+
+struct TraceReader *trace_reader_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open trace %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct TraceHeader)) {
+        LOG_ERROR("%s: not a trace file", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    const unsigned char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Failed to mmap trace %s", path);
+        close(fd);
+        return NULL;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    struct TraceHeader header;
+    memcpy(&header, map, sizeof(header));
+    size_t pids_size = (size_t)header.proc_count * sizeof(uint64_t);
+    if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.proc_count == 0 ||
+        sizeof(header) + pids_size + header.body_size != size) {
+        LOG_ERROR("%s: invalid trace header", path);
+        munmap((void *)map, size);
+        close(fd);
+        return NULL;
+    }
+
+    struct TraceReader *reader = (struct TraceReader *)malloc(sizeof(struct TraceReader));
+    reader->fd = fd;
+    reader->map = map;
+    reader->map_size = size;
+    reader->header = header;
+    reader->pids = (const uint64_t *)(map + sizeof(header));
+    reader->cursor = map + sizeof(header) + pids_size;
+    reader->end = map + size;
+    reader->released = map;
+    reader->procs = (struct Proc **)calloc(header.proc_count, sizeof(struct Proc *));
+    reader->last_addr = (virt_addr_t *)calloc(header.proc_count, sizeof(virt_addr_t));
+    reader->checksum = FNV_OFFSET_BASIS;
+    reader->ops_read = 0;
+    return reader;
+}
+
+// Every process index used in the trace must be bound before reading
+void trace_reader_bind_proc(struct TraceReader *reader, size_t proc_idx,
+                            struct Proc *proc) {
+    assert(proc_idx < reader->header.proc_count);
+    reader->procs[proc_idx] = proc;
+}
+
+// drop pages of the mapping that were already decoded
+static void release_consumed(struct TraceReader *reader) {
+    size_t consumed = reader->cursor - reader->released;
+    if (consumed < TRACE_RELEASE_CHUNK) {
+        return;
+    }
+    madvise((void *)reader->released, TRACE_RELEASE_CHUNK, MADV_DONTNEED);
+    reader->released += TRACE_RELEASE_CHUNK;
+}
+
+// Decode the next operation, returns false at the end of the trace or on error
+bool trace_reader_next(struct TraceReader *reader, struct Operation *op) {
+    const unsigned char *p = reader->cursor;
+    const unsigned char *end = reader->end;
+    if (p >= end) {
+        return false;
+    }
+
+    unsigned char tag = *p++;
+    uint64_t proc_idx = tag >> 2;
+    uint64_t delta;
+
+    if (proc_idx == TRACE_PROC_ESCAPE && !read_varint(&p, end, &proc_idx)) {
+        goto corrupt;
+    }
+    if ((tag & 3) > UNMAP || proc_idx >= reader->header.proc_count ||
+        !read_varint(&p, end, &delta)) {
+        goto corrupt;
+    }
+
+    op->action = (enum Action)(tag & 3);
+    op->proc = reader->procs[proc_idx];
+    op->virt_addr = reader->last_addr[proc_idx] + zigzag_decode(delta);
+    op->data = 0;
+    reader->last_addr[proc_idx] = op->virt_addr;
+
+    if (op->action == WRITE) {
+        if (p >= end) {
+            goto corrupt;
+        }
+        op->data = *p++;
+    }
+    assert(op->proc != NULL && "Trace process was not bound");
+
+    reader->checksum = fnv1a(reader->checksum, reader->cursor, p - reader->cursor);
+    reader->cursor = p;
+    reader->ops_read++;
+    release_consumed(reader);
+    return true;
+
+corrupt:
+    LOG_ERROR("Corrupt trace record at offset %zu", (size_t)(reader->cursor - reader->map));
+    reader->cursor = end;
+    return false;
+}
+
+// Once the whole trace was read, check it against the header
+bool trace_reader_verify(struct TraceReader *reader) {
+    if (reader->cursor != reader->end || reader->ops_read != reader->header.op_count) {
+        LOG_ERROR("Trace ended after %lu of %lu operations",
+                  (unsigned long)reader->ops_read, (unsigned long)reader->header.op_count);
+        return false;
+    }
+    if (reader->checksum != reader->header.checksum) {
+        LOG_ERROR("Trace checksum mismatch");
+        return false;
+    }
+    return true;
+}
+
+void trace_reader_close(struct TraceReader *reader) {
+    munmap((void *)reader->map, reader->map_size);
+    close(reader->fd);
+    free(reader->procs);
+    free(reader->last_addr);
+    free(reader);
+}
@@ -0,0 +1,173 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void perform_operation(struct Operation *op) {
+    switch (op->action) {
+    case WRITE:
+        set_memory(op->proc, op->virt_addr, op->data);
+        break;
+    case READ:
+        access_memory(op->proc, op->virt_addr);
+        break;
+    case UNMAP:
+        // a shared frame stays mapped by processes on other CPUs
+        cpu_lock(CPU_LOCK_WORLD);
+        unmap_page_by_virtual_addr(op->proc->page_table, op->virt_addr);
+        break;
+
+    default:
+        assert("Invalid action");
+    }
+}
+
+void print_operation(struct Operation *op) {
+    switch (op->action) {
+    case WRITE:
+        printf(">> Action: WRITE, ");
+        printf("data: %c, at %p, ", op->data, (void *)op->virt_addr);
+        break;
+    case READ:
+        printf(">> Action: READ, ");
+        printf("at %p, ", (void *)op->virt_addr);
+        break;
+    case UNMAP:
+        printf(">> Action: UNMAP, ");
+        printf("addr: %p, ", (void *)op->virt_addr);
+        break;
+
+    default:
+        assert("Invalid action");
+    }
+    printf("by proc: %s\n", op->proc->name);
+}
+
+const char *workload_kind_to_str(enum WorkloadKind kind) {
+    switch (kind) {
+    case WORKLOAD_SEQUENTIAL:
+        return "sequential";
+    case WORKLOAD_RANDOM:
+        return "random";
+    case WORKLOAD_HOTSET:
+        return "hotset";
+
+    default:
+        assert("Invalid workload");
+    }
+    return NULL;
+}
+
+bool workload_kind_from_str(const char *str, enum WorkloadKind *kind) {
+    for (int i = WORKLOAD_SEQUENTIAL; i <= WORKLOAD_HOTSET; i++) {
+        if (strcmp(str, workload_kind_to_str((enum WorkloadKind)i)) == 0) {
+            *kind = (enum WorkloadKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Workload *create_workload(struct WorkloadConfig config, struct Proc **procs) {
+    assert(config.proc_count > 0 && config.page_count > 0);
+
+    struct Workload *workload = (struct Workload *)malloc(sizeof(struct Workload));
+    workload->config = config;
+    workload->procs = procs;
+    workload->issued = 0;
+    workload->cursor = 0;
+
+    // splitmix64 step so that small seeds still give a well mixed state
+    uint64_t seed = config.seed + 0x9E3779B97F4A7C15ull;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+    workload->rng_state = (seed ^ (seed >> 31)) | 1;
+
+    size_t bits = config.proc_count * config.page_count;
+    workload->touched = (uint64_t *)calloc((bits + 63) / 64, sizeof(uint64_t));
+    return workload;
+}
+
+void destroy_workload(struct Workload *workload) {
+    free(workload->touched);
+    free(workload);
+}
+
+// Every process already has all pages of the workload, so reads may come first
+void mark_workload_populated(struct Workload *workload) {
+    size_t bits = workload->config.proc_count * workload->config.page_count;
+    memset(workload->touched, 0xFF, (bits + 63) / 64 * sizeof(uint64_t));
+}
+
+static inline uint64_t next_random(struct Workload *workload) {
+    // xorshift64*
+    uint64_t x = workload->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    workload->rng_state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// uniform number in [0, bound) using a multiply-shift instead of a division
+static inline size_t random_below(struct Workload *workload, size_t bound) {
+    return (size_t)(((unsigned __int128)next_random(workload) * bound) >> 64);
+}
+
+// page index relative to the workload's region, page 0 is the guard page
+static size_t next_page(struct Workload *workload, size_t *offset) {
+    struct WorkloadConfig *config = &workload->config;
+
+    switch (config->kind) {
+    case WORKLOAD_SEQUENTIAL: {
+        // walk memory one cache line at a time
+        virt_addr_t addr = workload->cursor;
+        workload->cursor += 64;
+        *offset = addr & (PAGE_SIZE - 1);
+        return (addr / PAGE_SIZE) % config->page_count;
+    }
+    case WORKLOAD_RANDOM:
+        *offset = random_below(workload, PAGE_SIZE);
+        return random_below(workload, config->page_count);
+    case WORKLOAD_HOTSET: {
+        // 90% of accesses go to the hottest 10% of pages
+        size_t hot_pages = config->page_count / 10 ? config->page_count / 10 : 1;
+        *offset = random_below(workload, PAGE_SIZE);
+        if (random_below(workload, 10) != 0) {
+            return random_below(workload, hot_pages);
+        }
+        return random_below(workload, config->page_count);
+    }
+
+    default:
+        assert("Invalid workload");
+    }
+    return 0;
+}
+
+// Produce the next operation, returns false once the workload is exhausted
+bool next_workload_operation(struct Workload *workload, struct Operation *op) {
+    struct WorkloadConfig *config = &workload->config;
+    if (workload->issued == config->op_count) {
+        return false;
+    }
+
+    size_t proc_idx = config->proc_count == 1
+                          ? 0
+                          : random_below(workload, config->proc_count);
+    size_t offset = 0;
+    size_t page = next_page(workload, &offset);
+
+    size_t bit = proc_idx * config->page_count + page;
+    bool touched = workload->touched[bit / 64] & (1ull << (bit % 64));
+    bool is_write = !touched || random_below(workload, 100) < config->write_percent;
+    workload->touched[bit / 64] |= 1ull << (bit % 64);
+
+    op->proc = workload->procs[proc_idx];
+    op->action = is_write ? WRITE : READ;
+    op->virt_addr = (page + 1) * PAGE_SIZE + offset;
+    op->data = is_write ? 'a' + (workload->issued % 26) : 0;
+
+    workload->issued++;
+    return true;
+}
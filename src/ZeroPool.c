@@ -0,0 +1,187 @@
+#include <paging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Pre-zeroed frame pool
+ * Frames in the pool are used frames without a mapping, only the pool and
+ * its thread touch them. The thread zeroes the frame right after the ready
+ * ones, the CPU only takes ready frames off the head and frames the thread is
+ * not at off the tail, so neither has to wait for the other.
+ *
+ * The pool is refilled from the free stack, where unmapped frames go. Once
+ * memory is full a fault evicts a frame into the pool before it takes a
+ * zeroed one, so the victim is zeroed in the background instead of by the
+ * fault that reuses it.
+ */
+
+static void *zero_frames(void *arg) {
+    struct ZeroPool *pool = (struct ZeroPool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->ready == pool->count && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        size_t frame_idx = pool->frames[(pool->head + pool->ready) % pool->capacity];
+        pool->busy = true;
+        pthread_mutex_unlock(&pool->lock);
+
+        memset(&pool->phy_mem[frame_idx * pool->page_size], 0, pool->page_size);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy = false;
+        pool->ready++;
+        pool->stats.zeroed++;
+        pthread_cond_broadcast(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// The pool starts out empty, it is filled by the first fault
+struct ZeroPool *create_zero_pool(size_t capacity) {
+    assert(capacity > 0);
+    struct ZeroPool *pool = (struct ZeroPool *)calloc(1, sizeof(struct ZeroPool));
+    pool->phy_mem = sim->phy_mem;
+    pool->page_size = PAGE_SIZE;
+    pool->capacity = capacity;
+    pool->frames = (size_t *)malloc(capacity * sizeof(size_t));
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    int err = pthread_create(&pool->thread, NULL, zero_frames, pool);
+    assert(err == 0 && "[FATAL] Could not start the zeroing thread");
+    (void)err;
+    return pool;
+}
+
+// The frames of the pool go away with the frame allocator
+void destroy_zero_pool(struct ZeroPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->thread, NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->frames);
+    free(pool);
+}
+
+// Oldest zeroed frame, INVALID_FRAME if none is ready yet
+size_t take_zeroed_frame(struct ZeroPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t frame_idx = INVALID_FRAME;
+    if (pool->ready > 0) {
+        frame_idx = pool->frames[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pool->ready--;
+        pool->stats.hits++;
+    } else {
+        pool->stats.misses++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return frame_idx;
+}
+
+// Any frame of the pool, zeroed or not, INVALID_FRAME if the pool is empty
+size_t take_back_pool_frame(struct ZeroPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    // the only frame left may be the one being zeroed
+    while (pool->ready == 0 && pool->count == 1 && pool->busy) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    size_t frame_idx = INVALID_FRAME;
+    if (pool->ready > 0) {
+        frame_idx = pool->frames[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->ready--;
+    } else if (pool->count > 0) {
+        frame_idx = pool->frames[(pool->head + pool->count - 1) % pool->capacity];
+    }
+    if (frame_idx != INVALID_FRAME) {
+        pool->count--;
+        pool->stats.taken_back++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return frame_idx;
+}
+
+/*
+ * Take the given frame out of the pool, false if it is not in the pool
+ * Rollback uses it to get a frame back at its address, the frames after it
+ * move up one slot.
+ */
+bool take_pool_frame(struct ZeroPool *pool, size_t frame_idx) {
+    pthread_mutex_lock(&pool->lock);
+    size_t i;
+    for (;;) {
+        i = 0;
+        while (i < pool->count &&
+               pool->frames[(pool->head + i) % pool->capacity] != frame_idx) {
+            i++;
+        }
+        // the thread may be zeroing it
+        if (i != pool->ready || !pool->busy) {
+            break;
+        }
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    bool found = i < pool->count;
+    if (found) {
+        if (i < pool->ready) {
+            pool->ready--;
+        }
+        for (; i + 1 < pool->count; i++) {
+            pool->frames[(pool->head + i) % pool->capacity] =
+                pool->frames[(pool->head + i + 1) % pool->capacity];
+        }
+        pool->count--;
+        pool->stats.taken_back++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return found;
+}
+
+// Move free frames into the pool until it is full
+void refill_zero_pool(struct ZeroPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t added = 0;
+    while (pool->count < pool->capacity) {
+        size_t frame_idx = alloc_frame(sim->frame_allocator);
+        if (frame_idx == INVALID_FRAME) {
+            break;
+        }
+        pool->frames[(pool->head + pool->count) % pool->capacity] = frame_idx;
+        pool->count++;
+        added++;
+    }
+    if (added) {
+        pthread_cond_signal(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void print_zero_pool_stats(struct ZeroPool *pool) {
+    struct ZeroPoolStats *stats = &pool->stats;
+    size_t faults = stats->hits + stats->misses;
+    LOG_INFO("zero pool: %zu / %zu frames, %zu zeroed in the background", pool->count,
+             pool->capacity, stats->zeroed);
+    LOG_INFO("zero pool: %zu of %zu faults got a zeroed frame (%.1f%%), %zu taken back",
+             stats->hits, faults, faults ? 100.0 * stats->hits / faults : 0.0,
+             stats->taken_back);
+    if (stats->reclaimed) {
+        LOG_INFO("zero pool: %zu frames evicted into the pool", stats->reclaimed);
+    }
+}
@@ -3,21 +3,337 @@
 #include <stdlib.h>
 #include <string.h>
 
-static_assert(DEFAULT_MEMORY_SIZE % FRAME_SIZE == 0,
-              "DEFAULT_MEMORY_SIZE size should be divisible by FRAME_SIZE");
+struct Options {
+    bool headless;
+    struct HeadlessConfig headless_config;
+    struct SimulatorConfig simulator_config;
+    const char *events_path;
+    const char *decode_events_path;
+    size_t view_pages;
+    const char *swap_path;
+    struct SwapConfig swap_config;
+};
 
-unsigned char *phy_mem = NULL;
-size_t last_frame_id = 0;
-struct ExecLog *exec_log = NULL;
-struct FrameDBEntry frame_db[DEFAULT_FRAME_COUNT];
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --headless           run a workload without the UI\n");
+    printf("  --workload <kind>    sequential, random or hotset (default: random)\n");
+    printf("  --ops <n>            number of operations to run\n");
+    printf("  --pages <n>          pages touched by each process\n");
+    printf("  --procs <n>          number of processes\n");
+    printf("  --writes <percent>   share of writes to already touched pages\n");
+    printf("  --seed <n>           workload random seed\n");
+    printf("  --fork               fork every process from the first one after it\n");
+    printf("                       touched all pages (pre-fork worker pool)\n");
+    printf("  --shared <n>         the first n pages of every process are one shared\n");
+    printf("                       segment\n");
+    printf("  --frames <n>         physical frames (default: %d)\n", DEFAULT_FRAME_COUNT);
+    printf("  --cpus <n>           simulated CPUs, each runs its share of the processes\n");
+    printf("                       on a host thread (default: %d)\n", DEFAULT_CPU_COUNT);
+    printf("  --page-size <bytes>  base page size, 4K to 64K (default: 4K)\n");
+    printf("  --huge-page <bytes>  map faults in untouched ranges with huge pages of\n");
+    printf("                       512 or 512 * 512 base pages (2M or 1G with 4K)\n");
+    printf("  --policy <name>      fifo, lru, clock, second-chance or arc\n");
+    printf("  --tlb-l1 <n>         L1 TLB entries (default: %zu)\n",
+           DEFAULT_TLB_CONFIG.l1_entries);
+    printf("  --tlb-l2 <n>         L2 TLB entries (default: %zu)\n",
+           DEFAULT_TLB_CONFIG.l2_entries);
+    printf("  --tlb-ways <l1>[,<l2>]  TLB associativity, one value sets both levels\n");
+    printf("                       (default: %zu,%zu)\n", DEFAULT_TLB_CONFIG.l1_ways,
+           DEFAULT_TLB_CONFIG.l2_ways);
+    printf("  --tlb-policy <name>  lru, fifo or random (default: lru)\n");
+    printf("  --sweep-frames <list>      run the workload once for every frame count,\n");
+    printf("  --sweep-page-sizes <list>  page size and policy in the comma separated\n");
+    printf("  --sweep-policies <list>    lists, in parallel, and print CSV to stdout\n");
+    printf("  --jobs <n>           sweep threads (default: one per host core)\n");
+    printf("  --events <file>      write fault, map, unmap, evict and rollback events to\n");
+    printf("                       a binary event trace\n");
+    printf("  --decode-events <file>  print an event trace as text and exit\n");
+    printf("  --counters <file>    write snapshots of the process counters, as JSON if\n");
+    printf("                       file ends in .json and CSV otherwise\n");
+    printf("  --counters-every <n> operations between snapshots (default: %d)\n",
+           DEFAULT_COUNTERS_INTERVAL);
+    printf("  --mrc                print the LRU miss-ratio curve of the run as CSV\n");
+    printf("  --mrc-sample <n>     only track 1 in n pages for the curve (SHARDS)\n");
+    printf("  --view-pages <n>     page table rows of the UI, scroll and shift+scroll\n");
+    printf("                       to zoom (default: %d)\n", DEFAULT_VIEW_PAGE_COUNT);
+    printf("  --heatmap <file>     write the decayed access heat of frames, pages and\n");
+    printf("                       huge page ranges as CSV\n");
+    printf("  --heat-half-life <n> accesses after which the heat of an access halves\n");
+    printf("                       (default: %d)\n", DEFAULT_HEAT_HALF_LIFE);
+    printf("  --swap <file>        write evicted pages to a swap file, deleted at exit\n");
+    printf("  --swap-size <bytes>  size of the swap file (default: %zu MiB)\n",
+           DEFAULT_SWAP_CONFIG.size >> 20);
+    printf("  --swap-threads <n>   swap I/O threads (default: %zu)\n",
+           DEFAULT_SWAP_CONFIG.io_threads);
+    printf("  --swap-readahead <n> slots of a readahead cluster, 1: no readahead\n");
+    printf("                       (default: %zu)\n", DEFAULT_SWAP_CONFIG.readahead);
+    printf("  --swap-latency <us>  added to every swap read and write\n");
+    printf("  --zero-pool <n>      frames a background thread keeps zeroed for faults\n");
+    printf("  --log                keep the exec log in headless mode\n");
+    printf("  --log-size <bytes>   memory cap of the exec log (default: %d MiB)\n",
+           (int)(DEFAULT_EXEC_LOG_CONFIG.max_bytes >> 20));
+    printf("  --log-reads          also log reads that do not fault\n");
+    printf("  --trace <file>       replay a binary trace instead of a workload\n");
+    printf("  --lackey <file>      replay a valgrind lackey or R/W address log\n");
+    printf("  --record <file>      write the workload to a binary trace and exit\n");
+    printf("  --bisect <cond>      find the first operation after which cond holds:\n");
+    printf("                       used:<frames>, faults:<n>, mapped:<proc>:<addr>,\n");
+    printf("                       byte:<proc>:<addr>=<value> (proc is 0 based)\n");
+    printf("  --checkpoint <n>     operations between bisect snapshots (default: %d)\n",
+           DEFAULT_CHECKPOINT_INTERVAL);
+}
+
+static bool is_page_size(size_t size) {
+    return (size & (size - 1)) == 0 && size >= ((size_t)1 << MIN_PAGE_SHIFT) &&
+           size <= ((size_t)1 << MAX_PAGE_SHIFT);
+}
+
+// Numbers may end in K, M or G
+static bool parse_size(const char *str, size_t *out) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 0);
+    if (*str == '\0') {
+        return false;
+    }
+    switch (*end) {
+    case 'G':
+        value <<= 10;
+        // fall through
+    case 'M':
+        value <<= 10;
+        // fall through
+    case 'K':
+        value <<= 10;
+        end++;
+        break;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+// One associativity for both TLB levels or one for each, as l1,l2
+static bool parse_tlb_ways(const char *str, struct TLBConfig *tlb) {
+    const char *comma = strchr(str, ',');
+    if (comma == NULL) {
+        return parse_size(str, &tlb->l1_ways) && parse_size(str, &tlb->l2_ways);
+    }
+    char l1[32];
+    size_t len = comma - str;
+    if (len >= sizeof(l1)) {
+        return false;
+    }
+    memcpy(l1, str, len);
+    l1[len] = '\0';
+    return parse_size(l1, &tlb->l1_ways) && parse_size(comma + 1, &tlb->l2_ways);
+}
+
+// Comma separated values of a --sweep-* option, added to the sweep lists
+static bool parse_sweep_list(const char *arg, const char *list, struct SweepConfig *sweep) {
+    char buf[1024];
+    if (strlen(list) >= sizeof(buf)) {
+        return false;
+    }
+    strcpy(buf, list);
+
+    for (char *item = strtok(buf, ","); item != NULL; item = strtok(NULL, ",")) {
+        size_t number;
+        if (strcmp(arg, "--sweep-policies") == 0) {
+            if (sweep->policy_values == MAX_SWEEP_VALUES ||
+                !replacement_policy_from_str(item,
+                                             &sweep->policies[sweep->policy_values++])) {
+                return false;
+            }
+        } else if (!parse_size(item, &number)) {
+            return false;
+        } else if (strcmp(arg, "--sweep-frames") == 0 && number > 1 &&
+                   sweep->frame_count_values < MAX_SWEEP_VALUES) {
+            sweep->frame_counts[sweep->frame_count_values++] = number;
+        } else if (strcmp(arg, "--sweep-page-sizes") == 0 && is_page_size(number) &&
+                   sweep->page_shift_values < MAX_SWEEP_VALUES) {
+            sweep->page_shifts[sweep->page_shift_values++] = __builtin_ctzll(number);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
 
-int main() {
-    LOG_INFO("arch: %d bit", 8 * (int)sizeof(uintptr_t));
+static bool parse_options(int argc, char **argv, struct Options *options) {
+    struct WorkloadConfig *workload = &options->headless_config.workload;
+    struct SimulatorConfig *simulator = &options->simulator_config;
 
-    phy_mem = malloc(DEFAULT_MEMORY_SIZE);
-    exec_log = create_exec_log();
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        size_t number;
 
-    LOG_INFO("default table size: %d pages", DEFAULT_PAGE_TABLE_SIZE);
+        if (strcmp(arg, "--help") == 0) {
+            return false;
+        } else if (strcmp(arg, "--headless") == 0) {
+            options->headless = true;
+        } else if (strcmp(arg, "--log") == 0) {
+            simulator->keep_exec_log = true;
+        } else if (strcmp(arg, "--mrc") == 0) {
+            options->headless = true;
+            options->headless_config.mrc = true;
+        } else if (strcmp(arg, "--fork") == 0) {
+            options->headless_config.prefork = true;
+        } else if (strcmp(arg, "--log-reads") == 0) {
+            simulator->exec_log.log_reads = true;
+        } else if (value == NULL) {
+            LOG_ERROR("Unknown option or missing value: %s", arg);
+            return false;
+        } else if (strcmp(arg, "--workload") == 0) {
+            if (!workload_kind_from_str(value, &workload->kind)) {
+                LOG_ERROR("Unknown workload: %s", value);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--trace") == 0) {
+            options->headless_config.trace_path = value;
+            i++;
+        } else if (strcmp(arg, "--lackey") == 0) {
+            options->headless_config.text_trace_path = value;
+            i++;
+        } else if (strcmp(arg, "--events") == 0) {
+            options->events_path = value;
+            i++;
+        } else if (strcmp(arg, "--decode-events") == 0) {
+            options->decode_events_path = value;
+            i++;
+        } else if (strcmp(arg, "--counters") == 0) {
+            options->headless_config.counters_path = value;
+            i++;
+        } else if (strcmp(arg, "--heatmap") == 0) {
+            options->headless = true;
+            options->headless_config.heatmap_path = value;
+            i++;
+        } else if (strcmp(arg, "--swap") == 0) {
+            options->headless = true;
+            options->swap_path = value;
+            i++;
+        } else if (strcmp(arg, "--record") == 0) {
+            options->headless_config.record_path = value;
+            i++;
+        } else if (strcmp(arg, "--bisect") == 0) {
+            if (!bisect_condition_from_str(value,
+                                           &options->headless_config.bisect_condition)) {
+                LOG_ERROR("Invalid bisect condition: %s", value);
+                return false;
+            }
+            options->headless_config.bisect = true;
+            i++;
+        } else if (strcmp(arg, "--sweep-frames") == 0 ||
+                   strcmp(arg, "--sweep-page-sizes") == 0 ||
+                   strcmp(arg, "--sweep-policies") == 0) {
+            if (!parse_sweep_list(arg, value, &options->headless_config.sweep_config)) {
+                LOG_ERROR("Invalid value for %s: %s", arg, value);
+                return false;
+            }
+            // a sweep has no UI
+            options->headless = true;
+            options->headless_config.sweep = true;
+            i++;
+        } else if (strcmp(arg, "--policy") == 0) {
+            if (!replacement_policy_from_str(value, &simulator->policy)) {
+                LOG_ERROR("Unknown replacement policy: %s", value);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--tlb-policy") == 0) {
+            if (!tlb_policy_from_str(value, &simulator->tlb.policy)) {
+                LOG_ERROR("Unknown TLB policy: %s", value);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--tlb-ways") == 0) {
+            if (!parse_tlb_ways(value, &simulator->tlb)) {
+                LOG_ERROR("Invalid value for %s: %s", arg, value);
+                return false;
+            }
+            i++;
+        } else if (parse_size(value, &number)) {
+            if (strcmp(arg, "--ops") == 0) {
+                workload->op_count = number;
+            } else if (strcmp(arg, "--pages") == 0 && number > 0) {
+                workload->page_count = number;
+            } else if (strcmp(arg, "--procs") == 0 && number > 0) {
+                workload->proc_count = number;
+            } else if (strcmp(arg, "--writes") == 0 && number <= 100) {
+                workload->write_percent = number;
+            } else if (strcmp(arg, "--shared") == 0) {
+                options->headless_config.shared_pages = number;
+            } else if (strcmp(arg, "--seed") == 0) {
+                workload->seed = number;
+            } else if (strcmp(arg, "--log-size") == 0 && number > 0) {
+                simulator->exec_log.max_bytes = number;
+            } else if (strcmp(arg, "--checkpoint") == 0 && number > 0) {
+                options->headless_config.checkpoint_interval = number;
+            } else if (strcmp(arg, "--frames") == 0 && number > 1) {
+                simulator->frame_count = number;
+            } else if (strcmp(arg, "--cpus") == 0 && number > 0 &&
+                       number <= MAX_CPU_COUNT) {
+                simulator->cpu_count = number;
+            } else if (strcmp(arg, "--page-size") == 0 && is_page_size(number)) {
+                simulator->page_shift = __builtin_ctzll(number);
+            } else if (strcmp(arg, "--jobs") == 0 && number > 0) {
+                options->headless_config.sweep_config.jobs = number;
+            } else if (strcmp(arg, "--counters-every") == 0 && number > 0) {
+                options->headless_config.counters_interval = number;
+            } else if (strcmp(arg, "--mrc-sample") == 0 && number > 0) {
+                options->headless = true;
+                options->headless_config.mrc = true;
+                options->headless_config.mrc_sample = number;
+            } else if (strcmp(arg, "--view-pages") == 0 && number > 0 &&
+                       number <= MAX_PAGE_COUNT) {
+                options->view_pages = number;
+            } else if (strcmp(arg, "--heat-half-life") == 0 && number > 0) {
+                options->headless_config.heat_half_life = number;
+            } else if (strcmp(arg, "--swap-size") == 0) {
+                options->swap_config.size = number;
+            } else if (strcmp(arg, "--swap-threads") == 0 && number > 0) {
+                options->swap_config.io_threads = number;
+            } else if (strcmp(arg, "--swap-readahead") == 0 && number > 0) {
+                options->swap_config.readahead = number;
+                if (options->swap_config.cache_pages <= number) {
+                    options->swap_config.cache_pages = 2 * number;
+                }
+            } else if (strcmp(arg, "--swap-latency") == 0) {
+                options->swap_config.device_latency_ns = number * 1000;
+            } else if (strcmp(arg, "--zero-pool") == 0) {
+                // the UI snapshots frames the pool thread may be zeroing
+                options->headless = true;
+                simulator->zero_pool_frames = number;
+            } else if (strcmp(arg, "--huge-page") == 0) {
+                options->headless_config.huge_page_size = number;
+            } else if (strcmp(arg, "--tlb-l1") == 0) {
+                simulator->tlb.l1_entries = number;
+            } else if (strcmp(arg, "--tlb-l2") == 0) {
+                simulator->tlb.l2_entries = number;
+            } else {
+                LOG_ERROR("Invalid option: %s %s", arg, value);
+                return false;
+            }
+            i++;
+        } else {
+            LOG_ERROR("Invalid value for %s: %s", arg, value);
+            return false;
+        }
+    }
+    if (!is_tlb_config_valid(simulator->tlb)) {
+        LOG_ERROR("TLB entries must be a non-zero multiple of the ways of the level");
+        return false;
+    }
+    return true;
+}
+
+static int run_visualisation(size_t page_count) {
+    LOG_INFO("virtual address space: %d bit, %d level page table", VIRT_ADDR_BITS,
+             PT_LEVELS);
     struct Proc *proc1 = create_proc("proc 1");
 
     printf("Select visualisation:\n");
@@ -28,19 +344,73 @@ int main() {
     switch (getchar()) {
     case '1':
         struct Proc *proc2 = create_proc("proc 2");
-        multi_process_visualisation(proc1, proc2);
+        multi_process_visualisation(proc1, proc2, page_count);
+        print_tlb_stats(proc2->cpu->tlb, proc2);
         destroy_proc(proc2);
         break;
     case '2':
-        memory_inspector_visualisation(proc1);
+        memory_inspector_visualisation(proc1, page_count);
         break;
     default:
         printf("Invalid choice\n");
     }
 
+    print_tlb_stats(proc1->cpu->tlb, proc1);
     destroy_proc(proc1);
-    destroy_exec_log(exec_log);
-    free(phy_mem);
-
+    print_replacement_stats(sim->replacement);
     return 0;
 }
+
+int main(int argc, char **argv) {
+    struct Options options = {
+        .headless = false,
+        .view_pages = DEFAULT_VIEW_PAGE_COUNT,
+        .swap_config = DEFAULT_SWAP_CONFIG,
+        .headless_config = {.workload = DEFAULT_WORKLOAD_CONFIG,
+                            .checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL,
+                            .counters_interval = DEFAULT_COUNTERS_INTERVAL},
+        .simulator_config = {.frame_count = DEFAULT_FRAME_COUNT,
+                             .page_shift = DEFAULT_PAGE_SHIFT,
+                             .cpu_count = DEFAULT_CPU_COUNT,
+                             .policy = DEFAULT_REPLACEMENT_POLICY,
+                             .tlb = DEFAULT_TLB_CONFIG,
+                             .exec_log = DEFAULT_EXEC_LOG_CONFIG,
+                             .zero_pool_frames = DEFAULT_ZERO_POOL_FRAMES}};
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (options.decode_events_path) {
+        return decode_event_trace(options.decode_events_path);
+    }
+
+    // the UI needs the log for rollback, batch runs only keep it on request
+    if (!options.headless) {
+        options.simulator_config.keep_exec_log = true;
+        options.simulator_config.cpu_count = 1;
+    }
+    struct Simulator *simulator = create_simulator(options.simulator_config);
+    LOG_INFO("arch: %d bit, %zu KB pages", 8 * (int)sizeof(uintptr_t), PAGE_SIZE / 1024);
+
+    if (options.swap_path) {
+        simulator->swap = create_swap(options.swap_path, options.swap_config);
+        if (simulator->swap == NULL) {
+            destroy_simulator(simulator);
+            return 1;
+        }
+    }
+
+    if (options.events_path && !open_event_trace(options.events_path)) {
+        destroy_simulator(simulator);
+        return 1;
+    }
+
+    int status = options.headless ? run_headless(&options.headless_config)
+                                  : run_visualisation(options.view_pages);
+
+    if (simulator->events && !close_event_trace()) {
+        status = 1;
+    }
+    destroy_simulator(simulator);
+    return status;
+}
@@ -1,5 +1,6 @@
 #include <math.h>
 #include <raylib.h>
+#include <rlgl.h>
 #include <simulator-ui.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,39 +9,123 @@
 struct FocusCtx focus = {0};
 struct TestCase test_case = {0};
 
-size_t sim_page_size = 10;
-size_t sim_frame_count = 10;
+struct RowView page_view = {.row_count = DEFAULT_VIEW_PAGE_COUNT,
+                            .row_height = BOX_HEIGHT};
+struct RowView frame_view = {.row_count = DEFAULT_FRAME_COUNT, .row_height = BOX_HEIGHT};
+
+static struct {
+    Vector2 start, end;
+    Color color;
+    bool head;
+} arrows[MAX_ARROWS];
+static size_t arrow_count = 0;
+
+// screen y of the top of a row, rows above the view are at negative offsets
+static float row_y(struct RowView *view, size_t row) {
+    return TOP_PADDING + (float)(((double)row - view->scroll) * view->row_height);
+}
+
+static size_t first_visible_row(struct RowView *view) {
+    return (size_t)view->scroll;
+}
+
+static size_t end_visible_row(struct RowView *view) {
+    size_t end = (size_t)ceil(view->scroll + VIEW_HEIGHT / view->row_height);
+    return end < view->row_count ? end : view->row_count;
+}
+
+static bool is_row_visible(struct RowView *view, size_t row) {
+    return row >= first_visible_row(view) && row < end_visible_row(view);
+}
+
+static bool is_overview(struct RowView *view) {
+    return view->row_height < LOD_ROW_HEIGHT;
+}
+
+// row under screen y, -1 outside the view
+static int row_at_y(struct RowView *view, float y) {
+    if (y < TOP_PADDING || y >= TOP_PADDING + VIEW_HEIGHT) {
+        return -1;
+    }
+    size_t row = (size_t)(view->scroll + (y - TOP_PADDING) / view->row_height);
+    return row < view->row_count ? (int)row : -1;
+}
+
+// the whole column fits at the farthest zoom, rows are BOX_HEIGHT at the closest
+static void clamp_row_view(struct RowView *view) {
+    float min_height = (float)VIEW_HEIGHT / view->row_count;
+    if (view->row_height < min_height) {
+        view->row_height = min_height;
+    }
+    if (view->row_height > BOX_HEIGHT) {
+        view->row_height = BOX_HEIGHT;
+    }
+
+    double max_scroll = view->row_count - VIEW_HEIGHT / (double)view->row_height;
+    if (view->scroll > max_scroll) {
+        view->scroll = max_scroll;
+    }
+    if (view->scroll < 0) {
+        view->scroll = 0;
+    }
+}
+
+void init_row_views(size_t page_count, size_t frame_count) {
+    page_view = (struct RowView){.row_count = page_count, .row_height = BOX_HEIGHT};
+    frame_view = (struct RowView){.row_count = frame_count, .row_height = BOX_HEIGHT};
+    clamp_row_view(&page_view);
+    clamp_row_view(&frame_view);
+}
+
+static bool is_cursor_on_frames() {
+    float x = GetMouseX();
+    return x >= GetScreenWidth() / 2.f - BOX_WIDTH / 2.f &&
+           x <= GetScreenWidth() / 2.f + BOX_WIDTH / 2.f;
+}
+
+// The wheel scrolls the column under the cursor, with shift held it zooms it
+void row_view_scroll_handler() {
+    float wheel = GetMouseWheelMove();
+    if (wheel == 0) {
+        return;
+    }
+    struct RowView *view = is_cursor_on_frames() ? &frame_view : &page_view;
+
+    if (IsKeyDown(KEY_LEFT_SHIFT)) {
+        // keep the row under the cursor in place
+        float cursor_y = GetMouseY() - TOP_PADDING;
+        double cursor_row = view->scroll + cursor_y / view->row_height;
+        view->row_height *= wheel > 0 ? ZOOM_STEP : 1 / ZOOM_STEP;
+        clamp_row_view(view);
+        view->scroll = cursor_row - cursor_y / view->row_height;
+    } else {
+        // a notch moves a screen of overview, or a few rows
+        float rows_per_notch = is_overview(view) ? VIEW_HEIGHT / view->row_height / 4 : 2;
+        view->scroll -= wheel * rows_per_notch;
+    }
+    clamp_row_view(view);
+}
 
 int page_table_idx_at_cursor_left() {
     float x = GetMouseX();
-    float y = GetMouseY();
 
     // checks if cursor is outside the page table
     if (x < LEFT_PADDING || x > LEFT_PADDING + BOX_WIDTH) {
         return -1;
     }
-    if (y < TOP_PADDING || y > TOP_PADDING + BOX_HEIGHT * sim_page_size) {
-        return -1;
-    }
-
-    return (y - TOP_PADDING) / BOX_HEIGHT;
+    return row_at_y(&page_view, GetMouseY());
 }
 
 // get page table index the cursor is pointing to for right process
 int page_table_idx_at_cursor_right() {
     float x = GetMouseX();
-    float y = GetMouseY();
     size_t left_padding = GetScreenWidth() - LEFT_PADDING - BOX_WIDTH;
 
     // checks if cursor is outside the page table
     if (x < left_padding || x > left_padding + BOX_WIDTH) {
         return -1;
     }
-    if (y < TOP_PADDING || y > TOP_PADDING + BOX_HEIGHT * sim_page_size) {
-        return -1;
-    }
-
-    return (y - TOP_PADDING) / BOX_HEIGHT;
+    return row_at_y(&page_view, GetMouseY());
 }
 
 int page_table_idx_at_cursor() {
@@ -51,7 +136,23 @@ int page_table_idx_at_cursor() {
     }
 }
 
-void draw_arrow_head(Vector2 arrow_start, Vector2 arrow_end) {
+static bool can_frame_be_shared(size_t frame_idx) {
+    return sim->frame_db[frame_idx].is_shared || frame_mapping_count(frame_idx) > 1;
+}
+
+// arrows into a frame that can be mapped by more than one page are highlighted
+static Color arrow_color(size_t frame_idx) {
+    return can_frame_be_shared(frame_idx) ? SHARED_FRAME_COLOR : BOX_BOUNDRY_COLOR;
+}
+
+/*
+ * find coordinates of two points extending backwards from arrow tip
+ * cos/sin: convert angle to x/y coordinates
+ * head_length: extend the points backwards by head_length
+ * add arrow_end.x/y: shift the points relative to arrow tip
+ */
+static void arrow_head_points(Vector2 arrow_start, Vector2 arrow_end, Vector2 *p1,
+                              Vector2 *p2) {
     // calculate slope of arrow body
     float dx = arrow_end.x - arrow_start.x;
     float dy = arrow_end.y - arrow_start.y;
@@ -62,91 +163,456 @@ void draw_arrow_head(Vector2 arrow_start, Vector2 arrow_end) {
     float theta = .4f;
     float head_length = -50;
 
-    /*
-     * find coordinates of two points extending backwards from arrow tip
-     * cos/sin: convert angle to x/y coordinates
-     * head_length: extend the points backwards by head_length
-     * add arrow_end.x/y: shift the points relative to arrow tip
-     */
-    float x1 = arrow_end.x + (head_length * cosf(angle + theta));
-    float y1 = arrow_end.y + (head_length * sinf(angle + theta));
+    p1->x = arrow_end.x + (head_length * cosf(angle + theta));
+    p1->y = arrow_end.y + (head_length * sinf(angle + theta));
+
+    p2->x = arrow_end.x + (head_length * cosf(angle - theta));
+    p2->y = arrow_end.y + (head_length * sinf(angle - theta));
+}
+
+void draw_arrow_head(Vector2 arrow_start, Vector2 arrow_end, Color color) {
+    Vector2 p1, p2;
+    arrow_head_points(arrow_start, arrow_end, &p1, &p2);
+    DrawTriangle(arrow_end, p1, p2, color);
+}
+
+static void vertex(Vector2 v) {
+    rlVertex2f(v.x, v.y);
+}
+
+/*
+ * Draw the collected arrows as one run of triangles. Text is drawn with the
+ * font texture, so arrows drawn one by one in between would each start a new
+ * draw call.
+ */
+static void flush_arrows() {
+    // two triangles for the body and one for the head
+    rlCheckRenderBatchLimit(arrow_count * 9);
+    rlBegin(RL_TRIANGLES);
+    for (size_t i = 0; i < arrow_count; i++) {
+        Vector2 start = arrows[i].start, end = arrows[i].end;
+        float dx = end.x - start.x;
+        float dy = end.y - start.y;
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length == 0) {
+            continue;
+        }
+        float thickness = arrows[i].head ? NORMAL_LINE_THICKNESS : 1;
+        Vector2 up = {dy / length * thickness / 2, -dx / length * thickness / 2};
+        Vector2 start_up = {start.x + up.x, start.y + up.y};
+        Vector2 start_down = {start.x - up.x, start.y - up.y};
+        Vector2 end_up = {end.x + up.x, end.y + up.y};
+        Vector2 end_down = {end.x - up.x, end.y - up.y};
+
+        Color color = arrows[i].color;
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        vertex(start_up);
+        vertex(start_down);
+        vertex(end_up);
+        vertex(end_up);
+        vertex(start_down);
+        vertex(end_down);
+        if (arrows[i].head) {
+            Vector2 p1, p2;
+            arrow_head_points(start, end, &p1, &p2);
+            vertex(end);
+            vertex(p1);
+            vertex(p2);
+        }
+    }
+    rlEnd();
+    arrow_count = 0;
+}
+
+struct ArrowCtx {
+    bool from_right;
+    float last_y; // arrows starting on the same pixel row are drawn once
+};
+
+static void add_page_arrow(struct ArrowCtx *ctx, size_t page_idx, size_t frame_idx) {
+    float start_y = row_y(&page_view, page_idx) + page_view.row_height / 2.f;
+    if (is_overview(&page_view) && floorf(start_y) == ctx->last_y) {
+        return;
+    }
+    ctx->last_y = floorf(start_y);
+    assert(arrow_count < MAX_ARROWS);
+
+    float end_y = row_y(&frame_view, frame_idx) + frame_view.row_height / 2.f;
+    if (end_y < TOP_PADDING) {
+        end_y = TOP_PADDING;
+    } else if (end_y > TOP_PADDING + VIEW_HEIGHT) {
+        end_y = TOP_PADDING + VIEW_HEIGHT;
+    }
+
+    float screen_center = GetScreenWidth() / 2.f;
+    arrows[arrow_count].start.x = ctx->from_right
+                                      ? GetScreenWidth() - RIGHT_PADDING - BOX_WIDTH
+                                      : LEFT_PADDING + BOX_WIDTH;
+    arrows[arrow_count].start.y = start_y;
+    arrows[arrow_count].end.x = ctx->from_right ? screen_center + BOX_WIDTH / 2.f
+                                                : screen_center - BOX_WIDTH / 2.f;
+    arrows[arrow_count].end.y = end_y;
+    arrows[arrow_count].color = arrow_color(frame_idx);
+    arrows[arrow_count].head = !is_overview(&page_view) &&
+                               !is_overview(&frame_view) &&
+                               is_row_visible(&frame_view, frame_idx);
+    arrow_count++;
+}
 
-    float x2 = arrow_end.x + (head_length * cosf(angle - theta));
-    float y2 = arrow_end.y + (head_length * sinf(angle - theta));
+static void add_mapping_arrows(size_t page_idx, uintptr_t entry, void *arg) {
+    size_t first = first_visible_row(&page_view);
+    size_t end = end_visible_row(&page_view);
+    size_t pages = page_class_pages(pte_page_class(entry));
+    if (page_idx + pages <= first || page_idx >= end) {
+        return;
+    }
 
-    DrawTriangle(arrow_end, (Vector2){x1, y1}, (Vector2){x2, y2}, BOX_BOUNDRY_COLOR);
+    // every base page of a huge page has an arrow to its frame of the run
+    size_t i = page_idx < first ? first - page_idx : 0;
+    for (; i < pages && page_idx + i < end; i++) {
+        add_page_arrow((struct ArrowCtx *)arg, page_idx + i, (entry >> OFFSET_BITS) + i);
+    }
 }
 
-void draw_arrow_from_proc_left(size_t page_idx, size_t frame_idx) {
-    Vector2 arrow_start, arrow_end;
-    arrow_start.x = LEFT_PADDING + BOX_WIDTH;
-    arrow_start.y = TOP_PADDING + (page_idx * BOX_HEIGHT) + BOX_HEIGHT / 2.f;
+// Arrows from the mapped pages in the view to their frames
+void draw_page_arrows(struct Proc *proc, bool from_right) {
+    struct ArrowCtx ctx = {.from_right = from_right, .last_y = -1};
+    for_each_mapped_page(proc->page_table, add_mapping_arrows, &ctx);
+    flush_arrows();
+}
 
-    arrow_end.x = GetScreenWidth() / 2.f - BOX_WIDTH / 2.f;
-    arrow_end.y = TOP_PADDING + (frame_idx * BOX_HEIGHT) + BOX_HEIGHT / 2.f;
+static void draw_column_outline(struct RowView *view, float offset_x) {
+    float height = fminf(VIEW_HEIGHT, view->row_count * view->row_height);
+    Rectangle rec = {
+        .x = offset_x, .y = TOP_PADDING, .height = height, .width = BOX_WIDTH};
+    DrawRectangleLinesEx(rec, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
+}
 
-    DrawLineEx(arrow_start, arrow_end, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
-    draw_arrow_head(arrow_start, arrow_end);
+// rows start to end as a filled band, at least a pixel high
+static void draw_row_run(struct RowView *view, float offset_x, size_t start, size_t end,
+                         Color color) {
+    float y = row_y(view, start);
+    float height = fmaxf((end - start) * view->row_height, 1);
+    DrawRectangleRec((Rectangle){offset_x, y, BOX_WIDTH, height}, color);
 }
 
-void draw_arrow_from_proc_right(size_t page_idx, size_t frame_idx) {
-    Vector2 arrow_start, arrow_end;
-    arrow_start.x = GetScreenWidth() - RIGHT_PADDING - BOX_WIDTH;
-    arrow_start.y = TOP_PADDING + (page_idx * BOX_HEIGHT) + BOX_HEIGHT / 2.f;
+struct RunCtx {
+    float offset_x;
+    size_t start, end; // pending run of mapped pages
+};
 
-    arrow_end.x = GetScreenWidth() / 2.f + BOX_WIDTH / 2.f;
-    arrow_end.y = TOP_PADDING + (frame_idx * BOX_HEIGHT) + BOX_HEIGHT / 2.f;
+static void add_mapped_run(size_t page_idx, uintptr_t entry, void *arg) {
+    struct RunCtx *ctx = (struct RunCtx *)arg;
+    size_t end = page_idx + page_class_pages(pte_page_class(entry));
+    if (end <= first_visible_row(&page_view) || page_idx >= end_visible_row(&page_view)) {
+        return;
+    }
+    // runs less than a pixel apart are drawn as one
+    if (row_y(&page_view, page_idx) - row_y(&page_view, ctx->end) >= 1) {
+        if (ctx->end != ctx->start) {
+            draw_row_run(&page_view, ctx->offset_x, ctx->start, ctx->end, TEXT_COLOR);
+        }
+        ctx->start = page_idx;
+    }
+    ctx->end = end;
+}
 
-    DrawLineEx(arrow_start, arrow_end, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
-    draw_arrow_head(arrow_start, arrow_end);
+// letters of the flags a present page has: Writable, Cow, Dirty, Accessed, User
+static void pte_flags_to_str(uintptr_t pte, char *buf) {
+    static const struct {
+        uintptr_t flag;
+        char letter;
+    } flags[] = {{PTE_WRITABLE, 'W'},
+                 {PTE_COW, 'C'},
+                 {PTE_DIRTY, 'D'},
+                 {PTE_ACCESSED, 'A'},
+                 {PTE_USER, 'U'}};
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        if (pte & flags[i].flag) {
+            *buf++ = flags[i].letter;
+        }
+    }
+    *buf = '\0';
 }
 
 void draw_page_table(struct Proc *proc, size_t offset_x) {
     int font_size = 20;
-    int offset_y = TOP_PADDING;
-    for (size_t i = 0; i < sim_page_size; i++) {
-        Rectangle rec = {.x = offset_x,
-                         .y = i * BOX_HEIGHT + offset_y,
-                         .height = BOX_HEIGHT + NORMAL_LINE_THICKNESS,
-                         .width = BOX_WIDTH};
-        DrawRectangleLinesEx(rec, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
-
-        char buf[40];
-        sprintf(buf, "%zu: %p", i, (void *)proc->page_table->entries[i]);
-        DrawText(buf, offset_x + 10,
-                 i * BOX_HEIGHT + BOX_HEIGHT / 2 - font_size / 2 + offset_y, font_size,
-                 TEXT_COLOR);
+    float row_height = page_view.row_height;
+
+    if (is_overview(&page_view)) {
+        // mapped ranges only, the walk skips what is not mapped
+        struct RunCtx ctx = {.offset_x = offset_x};
+        for_each_mapped_page(proc->page_table, add_mapped_run, &ctx);
+        if (ctx.end != ctx.start) {
+            draw_row_run(&page_view, offset_x, ctx.start, ctx.end, TEXT_COLOR);
+        }
+        draw_column_outline(&page_view, offset_x);
+    } else {
+        for (size_t i = first_visible_row(&page_view); i < end_visible_row(&page_view);
+             i++) {
+            float y = row_y(&page_view, i);
+            Rectangle rec = {.x = offset_x,
+                             .y = y,
+                             .height = row_height + NORMAL_LINE_THICKNESS,
+                             .width = BOX_WIDTH};
+            DrawRectangleLinesEx(rec, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
+
+            char buf[40];
+            uintptr_t pte = get_pte(proc->page_table, i);
+            sprintf(buf, "%zu: %p", i, (void *)(pte & ~PTE_FLAGS_MASK));
+            DrawText(buf, offset_x + 10, y + row_height / 2 - font_size / 2, font_size,
+                     TEXT_COLOR);
+
+            // flags in small print above the address
+            pte_flags_to_str(pte, buf);
+            DrawText(buf, offset_x + 10, y + 4, font_size / 2, BOX_BOUNDRY_COLOR);
+        }
     }
 
     // draw different color box for selected cell
-    if (focus.is_selected && is_proc_same(focus.proc, proc)) {
+    if (focus.is_selected && is_proc_same(focus.proc, proc) &&
+        is_row_visible(&page_view, focus.page_table_idx)) {
         Rectangle rec = {.x = offset_x,
-                         .y = focus.page_table_idx * BOX_HEIGHT + offset_y,
-                         .height = BOX_HEIGHT + NORMAL_LINE_THICKNESS,
+                         .y = row_y(&page_view, focus.page_table_idx),
+                         .height = fmaxf(row_height, 1) + NORMAL_LINE_THICKNESS,
                          .width = BOX_WIDTH};
         DrawRectangleLinesEx(rec, NORMAL_LINE_THICKNESS, GREEN);
     }
 }
 
+// 0: free, 1: used, 2: mapped by more than one page
+static int frame_state(size_t frame_idx) {
+    if (is_frame_unused(frame_idx)) {
+        return 0;
+    }
+    return can_frame_be_shared(frame_idx) ? 2 : 1;
+}
+
+static void draw_frame_overview(float offset_x) {
+    static const Color colors[] = {BLANK, TEXT_COLOR, SHARED_FRAME_COLOR};
+    // frames that share a pixel row are one cell in the color of the busiest
+    size_t cell = 1;
+    if (frame_view.row_height < 1) {
+        cell = (size_t)ceilf(1 / frame_view.row_height);
+    }
+    size_t end = end_visible_row(&frame_view);
+    size_t run_start = first_visible_row(&frame_view);
+    int run_state = 0;
+
+    for (size_t i = run_start; i < end; i += cell) {
+        int state = 0;
+        for (size_t j = i; j < i + cell && j < end; j++) {
+            if (frame_state(j) > state) {
+                state = frame_state(j);
+            }
+        }
+        if (state != run_state) {
+            if (run_state != 0) {
+                draw_row_run(&frame_view, offset_x, run_start, i, colors[run_state]);
+            }
+            run_start = i;
+            run_state = state;
+        }
+    }
+    if (run_state != 0) {
+        draw_row_run(&frame_view, offset_x, run_start, end, colors[run_state]);
+    }
+    draw_column_outline(&frame_view, offset_x);
+}
+
 void draw_physical_memory() {
     int font_size = 20;
     int offset_x = GetScreenWidth() / 2 - BOX_WIDTH / 2;
-    int offset_y = TOP_PADDING;
-    for (size_t i = 0; i < sim_frame_count; i++) {
+    float row_height = frame_view.row_height;
+
+    if (is_overview(&frame_view)) {
+        draw_frame_overview(offset_x);
+        return;
+    }
+    for (size_t i = first_visible_row(&frame_view); i < end_visible_row(&frame_view);
+         i++) {
+        float y = row_y(&frame_view, i);
         Rectangle rec = {.x = offset_x,
-                         .y = i * BOX_HEIGHT + offset_y,
-                         .height = BOX_HEIGHT + NORMAL_LINE_THICKNESS,
+                         .y = y,
+                         .height = row_height + NORMAL_LINE_THICKNESS,
                          .width = BOX_WIDTH};
         DrawRectangleLinesEx(rec, 2, BOX_BOUNDRY_COLOR);
 
-        char buf[20];
-        sprintf(buf, "0x%lx", i << 12);
-        DrawText(buf, offset_x + 10,
-                 i * BOX_HEIGHT + BOX_HEIGHT / 2 - font_size / 2 + offset_y, font_size,
+        // shared frames show how many pages map them
+        char buf[32];
+        if (frame_mapping_count(i) > 1) {
+            sprintf(buf, "0x%zx x%zu", i * FRAME_SIZE, frame_mapping_count(i));
+        } else {
+            sprintf(buf, "0x%zx", i * FRAME_SIZE);
+        }
+        DrawText(buf, offset_x + 10, y + row_height / 2 - font_size / 2, font_size,
                  TEXT_COLOR);
     }
 }
 
+/*
+ * Heatmap texture, one section for the frames and one per process
+ * A pixel is a cell of cell_rows rows. Cells run down the lines of a section
+ * and then on in the next column, so a section stretched over a column keeps
+ * the order of the rows. Heats are relative to the hottest cell of the
+ * section, they only change with an access, so the texture is only updated
+ * when there was one.
+ */
+struct HeatSection {
+    size_t pid; // 0 for the frames
+    size_t row_count;
+    size_t cell_rows;
+    size_t line; // first line in the texture
+    size_t width, lines;
+};
+
+static struct {
+    Texture2D texture;
+    Color *pixels;
+    double *cells;
+    struct HeatSection *sections;
+    size_t section_count;
+    uint64_t drawn_accesses;
+    bool shown;
+} heat = {0};
+
+static struct HeatSection heat_section(size_t pid, size_t row_count, size_t line) {
+    size_t max_cells = (size_t)HEATMAP_WIDTH * VIEW_HEIGHT;
+    size_t cell_rows = (row_count + max_cells - 1) / max_cells;
+    size_t cells = (row_count + cell_rows - 1) / cell_rows;
+    size_t width = (cells + VIEW_HEIGHT - 1) / VIEW_HEIGHT;
+    return (struct HeatSection){.pid = pid,
+                                .row_count = row_count,
+                                .cell_rows = cell_rows,
+                                .line = line,
+                                .width = width,
+                                .lines = (cells + width - 1) / width};
+}
+
+// Start tracking heat, the views must be set up
+void load_heatmap(struct Proc **procs, size_t proc_count) {
+    assert(sim->heatmap == NULL && "[FATAL] Heatmap is already loaded");
+    sim->heatmap = create_heatmap(sim->frame_count, UI_HEAT_HALF_LIFE);
+
+    heat.section_count = proc_count + 1;
+    heat.sections =
+        (struct HeatSection *)malloc(heat.section_count * sizeof(struct HeatSection));
+    heat.sections[0] = heat_section(0, frame_view.row_count, 0);
+    size_t lines = heat.sections[0].lines;
+    for (size_t i = 0; i < proc_count; i++) {
+        heat.sections[i + 1] = heat_section(procs[i]->pid, page_view.row_count, lines);
+        lines += heat.sections[i + 1].lines;
+    }
+
+    heat.cells = (double *)malloc((size_t)HEATMAP_WIDTH * VIEW_HEIGHT * sizeof(double));
+    heat.pixels = (Color *)malloc((size_t)HEATMAP_WIDTH * lines * sizeof(Color));
+    for (size_t i = 0; i < (size_t)HEATMAP_WIDTH * lines; i++) {
+        heat.pixels[i] = HEAT_COLD_COLOR;
+    }
+    Image image = GenImageColor(HEATMAP_WIDTH, lines, HEAT_COLD_COLOR);
+    heat.texture = LoadTextureFromImage(image);
+    UnloadImage(image);
+    heat.drawn_accesses = 0;
+}
+
+void unload_heatmap() {
+    UnloadTexture(heat.texture);
+    free(heat.pixels);
+    free(heat.cells);
+    free(heat.sections);
+    destroy_heatmap(sim->heatmap);
+    sim->heatmap = NULL;
+}
+
+void heatmap_key_handler() {
+    if (IsKeyReleased(KEY_H)) {
+        heat.shown = !heat.shown;
+    }
+}
+
+bool is_heatmap_shown() {
+    return heat.shown;
+}
+
+static void add_cell_heat(struct HeatSection *section, size_t row, double value) {
+    size_t cell = row / section->cell_rows;
+    if (value > heat.cells[cell]) {
+        heat.cells[cell] = value;
+    }
+}
+
+static void add_page_heat(size_t pid, size_t page_idx, double value, void *arg) {
+    struct HeatSection *section = (struct HeatSection *)arg;
+    if (pid == section->pid && page_idx < section->row_count) {
+        add_cell_heat(section, page_idx, value);
+    }
+}
+
+// cold to red to hot, square root to tell apart the pages that are not the hottest
+static Color heat_color(double ratio) {
+    float t = sqrtf((float)ratio);
+    Color from = t < .5f ? HEAT_COLD_COLOR : HEX_RED_COLOR;
+    Color to = t < .5f ? HEX_RED_COLOR : HEAT_HOT_COLOR;
+    float f = t < .5f ? t * 2 : t * 2 - 1;
+    return (Color){(unsigned char)(from.r + (to.r - from.r) * f),
+                   (unsigned char)(from.g + (to.g - from.g) * f),
+                   (unsigned char)(from.b + (to.b - from.b) * f), 255};
+}
+
+static void update_heat_section(struct HeatSection *section) {
+    size_t cells = section->width * section->lines;
+    memset(heat.cells, 0, cells * sizeof(double));
+    if (section->pid == 0) {
+        for (size_t i = 0; i < section->row_count; i++) {
+            add_cell_heat(section, i, heatmap_frame_heat(sim->heatmap, i));
+        }
+    } else {
+        for_each_page_heat(sim->heatmap, add_page_heat, section);
+    }
+
+    double max = 0;
+    for (size_t i = 0; i < cells; i++) {
+        max = heat.cells[i] > max ? heat.cells[i] : max;
+    }
+    for (size_t i = 0; i < cells; i++) {
+        size_t x = i / section->lines;
+        size_t y = section->line + i % section->lines;
+        double ratio = max > 0 ? heat.cells[i] / max : 0;
+        heat.pixels[y * HEATMAP_WIDTH + x] = heat_color(ratio);
+    }
+}
+
+void update_heatmap() {
+    if (!heat.shown || sim->heatmap->accesses == heat.drawn_accesses) {
+        return;
+    }
+    for (size_t i = 0; i < heat.section_count; i++) {
+        update_heat_section(&heat.sections[i]);
+    }
+    UpdateTexture(heat.texture, heat.pixels);
+    heat.drawn_accesses = sim->heatmap->accesses;
+}
+
+static void draw_heat_section(struct HeatSection *section, float offset_x) {
+    Rectangle source = {0, section->line, section->width, section->lines};
+    Rectangle dest = {offset_x, TOP_PADDING, BOX_WIDTH, VIEW_HEIGHT};
+    DrawTexturePro(heat.texture, source, dest, (Vector2){0, 0}, 0, WHITE);
+    DrawRectangleLinesEx(dest, NORMAL_LINE_THICKNESS, BOX_BOUNDRY_COLOR);
+}
+
+// The whole address space of the view, not only the rows scrolled to
+void draw_page_heat(struct Proc *proc, size_t offset_x) {
+    for (size_t i = 1; i < heat.section_count; i++) {
+        if (heat.sections[i].pid == proc->pid) {
+            draw_heat_section(&heat.sections[i], offset_x);
+        }
+    }
+}
+
+void draw_frame_heat() {
+    draw_heat_section(&heat.sections[0], GetScreenWidth() / 2.f - BOX_WIDTH / 2.f);
+}
+
 char *action_to_str(enum Action action) {
     switch (action) {
     case WRITE:
@@ -177,9 +643,28 @@ void operation_to_str(struct Operation *op, size_t idx, char *buf, size_t size)
     }
 }
 
+// first operation listed in the .text section, the current one is third
+static int text_section_range_start() {
+    return test_case.curr_operation_idx - 2;
+}
+
+// get the operation index the cursor is pointing to in the .text section
+int operation_idx_at_cursor() {
+    int row = (GetMouseY() - DIVIDER_POS) / 30;
+    if (GetMouseY() < DIVIDER_POS || row < 1 || row > 7) {
+        return -1;
+    }
+
+    int idx = text_section_range_start() + row - 1;
+    if (idx < 0 || idx >= (int)test_case.operation_count) {
+        return -1;
+    }
+    return idx;
+}
+
 void draw_text_section() {
     DrawText(".text", 30, DIVIDER_POS, 20, TITLE_COLOR);
-    int range_start = test_case.curr_operation_idx - 2;
+    int range_start = text_section_range_start();
     int range_end = range_start + 6;
 
     for (int i = range_start; i <= range_end; i++) {
@@ -198,44 +683,6 @@ void draw_text_section() {
     }
 }
 
-void perform_operation(struct Operation *op) {
-    switch (op->action) {
-    case WRITE:
-        set_memory(op->proc, op->virt_addr, op->data);
-        break;
-    case READ:
-        access_memory(op->proc, op->virt_addr);
-        break;
-    case UNMAP:
-        unmap_page_by_virtual_addr(op->proc->page_table, op->virt_addr);
-        break;
-
-    default:
-        assert("Invalid action");
-    }
-}
-
-void print_operation(struct Operation *op) {
-    switch (op->action) {
-    case WRITE:
-        printf(">> Action: WRITE, ");
-        printf("data: %c, at %p, ", op->data, (void *)op->virt_addr);
-        break;
-    case READ:
-        printf(">> Action: READ, ");
-        printf("at %p, ", (void *)op->virt_addr);
-        break;
-    case UNMAP:
-        printf(">> Action: UNMAP, ");
-        printf("addr: %p, ", (void *)op->virt_addr);
-        break;
-
-    default:
-        assert("Invalid action");
-    }
-    printf("by proc: %s\n", op->proc->name);
-}
-
 void draw_divider() {
     Vector2 divider_start = (Vector2){0, DIVIDER_POS};
     Vector2 divider_end = (Vector2){GetScreenWidth(), DIVIDER_POS};
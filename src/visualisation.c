@@ -10,32 +10,36 @@
 
 static struct Proc *proc1 = NULL;
 static struct Proc *proc2 = NULL;
+static struct SharedSegment *segment = NULL;
 
 static void next_operation_handler() {
     if (IsKeyReleased(KEY_N) &&
         test_case.curr_operation_idx < test_case.operation_count) {
         print_operation(&test_case.ops[test_case.curr_operation_idx]);
-        perform_operation(&test_case.ops[test_case.curr_operation_idx]);
-        test_case.curr_operation_idx++;
+        timeline_step(sim->timeline);
+        test_case.curr_operation_idx = sim->timeline->position;
     }
     if (IsKeyReleased(KEY_P)) {
-        roll_back_opearation(exec_log);
+        roll_back_opearation(this_cpu->exec_log);
+        timeline_mark_diverged(sim->timeline);
     }
 
     if (IsKeyReleased(KEY_SPACE) && focus.is_selected) {
         struct PageTable *selected_pt = focus.proc->page_table;
 
         // decide if page will be mapped or unmapped
-        if (selected_pt->entries[focus.page_table_idx] == 0) {
-            set_memory(focus.proc, focus.page_table_idx << 12, 0xFF);
+        if (get_page_table_entry(selected_pt, focus.page_table_idx) == 0) {
+            set_memory(focus.proc, focus.page_table_idx * PAGE_SIZE, 0xFF);
         } else {
             unmap_page_by_page_idx(selected_pt, focus.page_table_idx);
         }
+        timeline_mark_diverged(sim->timeline);
     }
 
     if (IsKeyReleased(KEY_L)) {
-        print_exec_stack(exec_log);
+        print_exec_stack(this_cpu->exec_log);
     }
+    heatmap_key_handler();
 }
 
 static struct Proc *proc_at_cursor() {
@@ -45,6 +49,14 @@ static struct Proc *proc_at_cursor() {
 
 static void mouse_click_handler() {
     if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+        // clicking an operation in the .text section jumps right before it
+        int op_idx = operation_idx_at_cursor();
+        if (op_idx != -1) {
+            timeline_seek(sim->timeline, op_idx);
+            test_case.curr_operation_idx = op_idx;
+            return;
+        }
+
         int idx = page_table_idx_at_cursor();
         if (idx == -1) {
             return;
@@ -76,28 +88,26 @@ static void render_loop() {
 
         size_t left_padding = LEFT_PADDING;
         size_t right_padding = GetScreenWidth() - left_padding - BOX_WIDTH;
-        draw_page_table(proc1, left_padding);
-        draw_page_table(proc2, right_padding);
-        draw_physical_memory();
-
-        for (size_t i = 0; i < sim_page_size; i++) {
-            if (proc1->page_table->entries[i] != 0) {
-                size_t frame_idx = proc1->page_table->entries[i] >> 12;
-                draw_arrow_from_proc_left(i, frame_idx);
-            }
-        }
-
-        for (size_t i = 0; i < sim_page_size; i++) {
-            if (proc2->page_table->entries[i] != 0) {
-                size_t frame_idx = proc2->page_table->entries[i] >> 12;
-                draw_arrow_from_proc_right(i, frame_idx);
-            }
+        update_heatmap();
+        BeginScissorMode(0, TOP_PADDING, GetScreenWidth(), VIEW_HEIGHT);
+        if (is_heatmap_shown()) {
+            draw_page_heat(proc1, left_padding);
+            draw_page_heat(proc2, right_padding);
+            draw_frame_heat();
+        } else {
+            draw_page_table(proc1, left_padding);
+            draw_page_table(proc2, right_padding);
+            draw_physical_memory();
+            draw_page_arrows(proc1, false);
+            draw_page_arrows(proc2, true);
         }
+        EndScissorMode();
 
         draw_divider();
         draw_text_section();
 
         mouse_click_handler();
+        row_view_scroll_handler();
 
         EndDrawing();
     }
@@ -105,9 +115,12 @@ static void render_loop() {
 
 static void init_visualsation() {
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Paging Simulator");
+    struct Proc *procs[] = {proc1, proc2};
+    load_heatmap(procs, 2);
 
     render_loop();
 
+    unload_heatmap();
     CloseWindow();
 }
 
@@ -154,6 +167,16 @@ static void create_test_case_1() {
     test_case.ops[i++] =
         (struct Operation){.action = READ, .proc = proc2, .virt_addr = 0x3000};
 
+    // the shared segment is at 0x5000 in proc1 and at 0x6000 in proc2
+    test_case.ops[i++] = (struct Operation){
+        .action = WRITE, .proc = proc1, .data = 'S', .virt_addr = 0x5000};
+    test_case.ops[i++] =
+        (struct Operation){.action = READ, .proc = proc2, .virt_addr = 0x6000};
+    test_case.ops[i++] = (struct Operation){
+        .action = WRITE, .proc = proc2, .data = 'T', .virt_addr = 0x7000};
+    test_case.ops[i++] =
+        (struct Operation){.action = READ, .proc = proc1, .virt_addr = 0x6000};
+
     test_case.ops[i++] =
         (struct Operation){.action = UNMAP, .proc = proc1, .virt_addr = 0x1000};
     test_case.ops[i++] =
@@ -162,15 +185,33 @@ static void create_test_case_1() {
     test_case.operation_count = i;
 }
 
-void multi_process_visualisation(struct Proc *_proc1, struct Proc *_proc2) {
+void multi_process_visualisation(struct Proc *_proc1, struct Proc *_proc2,
+                                 size_t page_count) {
     proc1 = _proc1;
     proc2 = _proc2;
-    proc1->page_table->size = sim_page_size;
-    proc2->page_table->size = sim_page_size;
+    init_row_views(page_count, sim->frame_count);
+
+    // two pages mapped by both processes, at different addresses
+    segment = create_shared_segment("shm", 2);
+    if (segment) {
+        attach_shared_segment(proc1, segment, 0x5000);
+        attach_shared_segment(proc2, segment, 0x6000);
+    }
 
     create_test_case_1();
 
+    struct Proc *procs[] = {proc1, proc2};
+    sim->timeline = create_timeline(procs, 2, UI_CHECKPOINT_INTERVAL);
+    for (size_t i = 0; i < test_case.operation_count; i++) {
+        timeline_append(sim->timeline, &test_case.ops[i]);
+    }
+
     init_visualsation();
 
+    destroy_timeline(sim->timeline);
+    sim->timeline = NULL;
     free(test_case.ops);
+    if (segment) {
+        destroy_shared_segment(segment);
+    }
 }
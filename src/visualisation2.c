@@ -22,16 +22,17 @@ static void keyboard_handler() {
         struct PageTable *selected_pt = focus.proc->page_table;
 
         // decide if page will be mapped or unmapped
-        if (selected_pt->entries[focus.page_table_idx] == 0) {
-            set_memory(focus.proc, focus.page_table_idx << 12, 0xFF);
+        if (get_page_table_entry(selected_pt, focus.page_table_idx) == 0) {
+            set_memory(focus.proc, focus.page_table_idx * PAGE_SIZE, 0xFF);
         } else {
             unmap_page_by_page_idx(selected_pt, focus.page_table_idx);
         }
     }
 
     if (IsKeyReleased(KEY_L)) {
-        print_exec_stack(exec_log);
+        print_exec_stack(this_cpu->exec_log);
     }
+    heatmap_key_handler();
 }
 
 static struct Proc *proc_at_cursor() {
@@ -65,6 +66,11 @@ static void mouse_click_handler() {
 }
 
 static void scroll_handler() {
+    if (GetMouseX() < INSPECTOR_X) {
+        row_view_scroll_handler();
+        return;
+    }
+
     int scroll_multiplier = 4;
     viewport_offset += GetMouseWheelMove() * scroll_multiplier;
     if (viewport_offset < 0) {
@@ -72,44 +78,89 @@ static void scroll_handler() {
     }
 }
 
+/*
+ * The inspector is kept in a texture, a row is drawn again only if it shows
+ * other addresses, its page got another frame or the frame was written.
+ */
+struct InspectorRow {
+    virt_addr_t addr;
+    uintptr_t pte;
+    uint32_t generation;
+    bool drawn;
+};
+
+static RenderTexture2D inspector_texture;
+static struct InspectorRow inspector_rows[INSPECTOR_ROWS];
+
+static void load_memory_inspector() {
+    inspector_texture =
+        LoadRenderTexture(INSPECTOR_WIDTH, INSPECTOR_ROWS * INSPECTOR_ROW_HEIGHT);
+    BeginTextureMode(inspector_texture);
+    ClearBackground(BG_COLOR);
+    EndTextureMode();
+}
+
+static void unload_memory_inspector() {
+    UnloadRenderTexture(inspector_texture);
+}
+
+static bool is_row_current(struct InspectorRow *row, virt_addr_t addr, uintptr_t pte,
+                           uint32_t generation) {
+    return row->drawn && row->addr == addr && row->pte == pte &&
+           row->generation == generation;
+}
+
+// Rows are INSPECTOR_COLS aligned, so a row never crosses a page
+static void draw_inspector_row(int row, virt_addr_t addr) {
+    unsigned char data[INSPECTOR_COLS];
+    inspect_memory_range(proc, addr, data, INSPECTOR_COLS);
+
+    int pos_y = row * INSPECTOR_ROW_HEIGHT;
+    DrawRectangle(0, pos_y, INSPECTOR_WIDTH, INSPECTOR_ROW_HEIGHT, BG_COLOR);
+    DrawText(TextFormat("%03X: ", (unsigned)addr), 0, pos_y, INSPECTOR_FONT_SIZE, BLUE);
+
+    int hex_x = INSPECTOR_ADDR_WIDTH;
+    int ascii_x = hex_x + INSPECTOR_COLS * INSPECTOR_HEX_WIDTH;
+    for (int j = 0; j < INSPECTOR_COLS; j++) {
+        DrawText(TextFormat("%02X", data[j]), hex_x + j * INSPECTOR_HEX_WIDTH, pos_y,
+                 INSPECTOR_FONT_SIZE, HEX_RED_COLOR);
+        DrawText(TextFormat("%c", isprint(data[j]) ? data[j] : '.'),
+                 ascii_x + j * INSPECTOR_CHAR_WIDTH, pos_y, INSPECTOR_FONT_SIZE, BLUE);
+    }
+}
+
 static void draw_memory_inspector() {
-    int font_size = 14;
-    int start_x = 980;
-    int start_y = TOP_PADDING;
-    int offset = viewport_offset;
-
-    int total_rows = 48;
-    int total_cols = 16;
-
-    for (int i = 0; i < total_rows; i++) {
-        int idx = (i + offset) * total_cols;
-        if (focus.is_selected) {
-            idx += focus.page_table_idx << 12;
-        }
-        DrawText(TextFormat("%03X: ", idx), start_x - 50, start_y + (i * 15), font_size,
-                 BLUE);
-        for (int j = 0; j < total_cols; j++) {
-            unsigned char data = inspect_memory(proc, idx + j);
-            int pos_x = start_x + j * 25;
-            int pos_y = start_y + i * 15;
-            DrawText(TextFormat("%02X", data), pos_x, pos_y, font_size, HEX_RED_COLOR);
-        }
+    virt_addr_t base = (virt_addr_t)viewport_offset * INSPECTOR_COLS;
+    if (focus.is_selected) {
+        base += focus.page_table_idx * PAGE_SIZE;
     }
 
-    start_x += total_cols * 25;
-    for (int i = 0; i < total_rows; i++) {
-        int idx = (i + offset) * total_cols;
-        for (int j = 0; j < total_cols; j++) {
-            unsigned char data = inspect_memory(proc, idx + j);
-            int pos_x = start_x + j * 10;
-            int pos_y = start_y + i * 15;
-            if (isprint(data)) {
-                DrawText(TextFormat("%c", data), pos_x, pos_y, font_size, BLUE);
-            } else {
-                DrawText(TextFormat("."), pos_x, pos_y, font_size, BLUE);
-            }
+    bool drawing = false;
+    for (int i = 0; i < INSPECTOR_ROWS; i++) {
+        virt_addr_t addr = base + (virt_addr_t)i * INSPECTOR_COLS;
+        uintptr_t pte = get_pte(proc->page_table, addr / PAGE_SIZE);
+        uint32_t generation = pte ? sim->frame_generation[pte >> OFFSET_BITS] : 0;
+        struct InspectorRow *row = &inspector_rows[i];
+        if (is_row_current(row, addr, pte, generation)) {
+            continue;
         }
+
+        if (!drawing) {
+            BeginTextureMode(inspector_texture);
+            drawing = true;
+        }
+        draw_inspector_row(i, addr);
+        *row = (struct InspectorRow){
+            .addr = addr, .pte = pte, .generation = generation, .drawn = true};
+    }
+    if (drawing) {
+        EndTextureMode();
     }
+
+    // render textures are stored upside down
+    Texture2D texture = inspector_texture.texture;
+    DrawTextureRec(texture, (Rectangle){0, 0, texture.width, -texture.height},
+                   (Vector2){INSPECTOR_X, TOP_PADDING}, WHITE);
 }
 
 static void render_loop() {
@@ -121,16 +172,18 @@ static void render_loop() {
                  TITLE_COLOR);
 
         size_t left_padding = LEFT_PADDING;
-        draw_page_table(proc, left_padding);
-        draw_physical_memory();
-        draw_memory_inspector();
-
-        for (size_t i = 0; i < sim_page_size; i++) {
-            if (proc->page_table->entries[i] != 0) {
-                size_t frame_idx = proc->page_table->entries[i] >> 12;
-                draw_arrow_from_proc_left(i, frame_idx);
-            }
+        update_heatmap();
+        BeginScissorMode(0, TOP_PADDING, INSPECTOR_X, VIEW_HEIGHT);
+        if (is_heatmap_shown()) {
+            draw_page_heat(proc, left_padding);
+            draw_frame_heat();
+        } else {
+            draw_page_table(proc, left_padding);
+            draw_physical_memory();
+            draw_page_arrows(proc, false);
         }
+        EndScissorMode();
+        draw_memory_inspector();
 
         mouse_click_handler();
         keyboard_handler();
@@ -141,15 +194,19 @@ static void render_loop() {
 }
 static void init_visualsation() {
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Paging Simulator");
+    load_memory_inspector();
+    load_heatmap(&proc, 1);
 
     render_loop();
 
+    unload_heatmap();
+    unload_memory_inspector();
     CloseWindow();
 }
 
-void memory_inspector_visualisation(struct Proc *_proc) {
+void memory_inspector_visualisation(struct Proc *_proc, size_t page_count) {
     proc = _proc;
-    proc->page_table->size = sim_page_size;
+    init_row_views(page_count, sim->frame_count);
 
     // create_test_case_1();
 